@@ -8,6 +8,7 @@
 #include "../Grid.h"
 #include <QString>
 #include <functional>
+#include <chrono>
 
 template <typename Projection = pmp::Orthographic>
 class PhotometricRemeshing
@@ -61,6 +62,46 @@ public:
 		num_pixels_ = mesh_.n_faces();
 	}
 
+	// Regular grid of quads with a vertex every step pixels, covering the same area as create_domain:
+	// the remeshing refines it where the curvature requires, instead of collapsing a quad per pixel.
+	// Only for a full mask, otherwise falls back to create_domain.
+	void create_coarse_domain(int step)
+	{
+		bool full = width_ > 2 && height_ > 2;
+		for (int v = 1; full && v < height_ - 1; ++v)
+			for (int u = 1; full && u < width_ - 1; ++u)
+				full = mask_.at(v, u) > 127;
+
+		if (step <= 1 || !full)
+		{
+			create_domain();
+			return;
+		}
+
+		auto coords = [step](int size)
+		{
+			std::vector<pmp::Scalar> c;
+			for (int i = 0; i < size - 2; i += step)
+				c.push_back(i + 0.5);
+			c.push_back(size - 1.5);
+			return c;
+		};
+		std::vector<pmp::Scalar> us = coords(width_);
+		std::vector<pmp::Scalar> vs = coords(height_);
+		int nu = us.size();
+
+		mesh_ = pmp::SurfaceMesh();
+		for (pmp::Scalar v : vs)
+			for (pmp::Scalar u : us)
+				mesh_.add_vertex(pmp::Point(u, v, 1.));
+
+		for (int j = 0; j + 1 < int(vs.size()); ++j)
+			for (int i = 0; i + 1 < nu; ++i)
+				mesh_.add_quad(pmp::Vertex(j * nu + i), pmp::Vertex(j * nu + i + 1), pmp::Vertex((j + 1) * nu + i + 1), pmp::Vertex((j + 1) * nu + i));
+
+		num_pixels_ = (width_ - 2) * (height_ - 2);
+	}
+
 	void triangulate()
 	{
 		// Triangulate Quad-Mesh
@@ -68,27 +109,48 @@ public:
 		triangulator.triangulate(pmp::Triangulation::Objective::MAX_ANGLE); // Objective doesn't matter in the particular case
 	}
 
+	// max_faces: above the budget the error is raised (the faces scale about as 1/error, sqrt to not overshoot)
+	// and up to a few more iterations are run.
+	// max_seconds: stops when the next iteration would exceed the time, the mesh is valid after each iteration.
 	void remesh(pmp::Scalar l_min, pmp::Scalar l_max, pmp::Scalar approx_error, int iterations = 10, bool delaunay = true,
-				std::function<bool(QString stage, int percent)> *callback = nullptr)
+				std::function<bool(QString stage, int percent)> *callback = nullptr, int max_faces = 0, float max_seconds = 0)
 	{
 		// Start remeshing
 		pmp::ScreenRemeshing<Projection> remesher(mesh_, normals_, mask_, projection_);
 
-		for (int i = 0; i != iterations; ++i)
+		auto start = std::chrono::steady_clock::now();
+		const int extra_iterations = 5;
+		for (int i = 0; i < iterations + extra_iterations; ++i)
 		{
-			if(callback && !(*callback)("Remeshing", 100*i/iterations))
+			bool over_budget = max_faces > 0 && n_faces() > max_faces;
+			if (i >= iterations && !over_budget)
+				break;
+
+			float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+			if (max_seconds > 0 && i > 0 && elapsed*(i + 1)/i > max_seconds)
+				break;
+
+			int percent = 100*std::min(i, iterations)/iterations;
+			if (max_seconds > 0)
+				percent = std::max(percent, int(100*elapsed/max_seconds));
+			if(callback && !(*callback)("Remeshing", std::min(percent, 99)))
 				return;
+
+			if (over_budget)
+				approx_error *= std::sqrt(pmp::Scalar(n_faces())/max_faces);
 			remesher.adaptive_remeshing(l_min, l_max, approx_error, 1, delaunay);
 		}
 	}
 
+	// coarse_step > 1 starts from a grid with a vertex every coarse_step pixels.
 	void run(pmp::Scalar l_min, pmp::Scalar l_max, pmp::Scalar approx_error, int iterations = 10, bool delaunay = true,
-			 std::function<bool(QString stage, int percent)> *callback = nullptr)
+			 std::function<bool(QString stage, int percent)> *callback = nullptr,
+			 int coarse_step = 1, int max_faces = 0, float max_seconds = 0)
 	{
 		// smoothen_normals(l_min);
-		create_domain();
+		create_coarse_domain(coarse_step);
 		triangulate();
-		remesh(l_min, l_max, approx_error, iterations, delaunay, callback);
+		remesh(l_min, l_max, approx_error, iterations, delaunay, callback, max_faces, max_seconds);
 
 		std::cout << "Remeshing: " << n_pixels() << " Pixels -> " << n_vertices() << " Vertices\n";
 	}
@@ -126,29 +126,28 @@ private:
 
 		max_abs_curvatures_ = Grid<float>(width, height, 0.0f);
 
-		Eigen::GeneralizedSelfAdjointEigenSolver<Eigen::Matrix<Scalar, 2, 2>> solver;
-
-		Eigen::Matrix<Scalar, 3, 2> dX = Eigen::Matrix<Scalar, 3, 2>::Zero(); dX(0, 0) = 1; dX(1, 1) = 1;
-		Eigen::Matrix<Scalar, 3, 2> dN;
-
-		Eigen::Matrix<Scalar, 2, 2> I, II;
-		Normal normal;
-
 		Grid<Eigen::Vector3f> blurredNormals = normals_.gaussianBlur(5, sigma_);
 
 		for(auto &n: blurredNormals)
 			n /= n.norm();
 
-		int hp, hm, vp, vm;
-
-		umin_ = width;
-		vmin_ = height;
-		umax_ = 0;
-		vmax_ = 0;
+		// Rows are independent, the bounds of each row are merged afterwards.
+		std::vector<int> row_umin(height, width), row_umax(height, 0);
 
 		// Take derivatives to calculate curvature
-		for (int v = 0; v != height; ++v)
+#pragma omp parallel for schedule(dynamic, 16)
+		for (int v = 0; v < height; ++v)
 		{
+			Eigen::GeneralizedSelfAdjointEigenSolver<Eigen::Matrix<Scalar, 2, 2>> solver;
+
+			Eigen::Matrix<Scalar, 3, 2> dX = Eigen::Matrix<Scalar, 3, 2>::Zero(); dX(0, 0) = 1; dX(1, 1) = 1;
+			Eigen::Matrix<Scalar, 3, 2> dN;
+
+			Eigen::Matrix<Scalar, 2, 2> I, II;
+			Normal normal;
+
+			int hp, hm, vp, vm;
+
 			for (int u = 0; u != width; ++u)
 			{
 				hp = u + 1 < width ? u + 1 : u;
@@ -191,10 +190,8 @@ private:
 					// Save pixel-wise maximum absolute curvature
 					max_abs_curvatures_.at(v, u) = solver.eigenvalues().array().abs().matrix().maxCoeff();
 
-					umin_ = std::min(u, umin_);
-					vmin_ = std::min(v, vmin_);
-					umax_ = std::max(u + 1, umax_);
-					vmax_ = std::max(v + 1, vmax_);
+					row_umin[v] = std::min(u, row_umin[v]);
+					row_umax[v] = std::max(u + 1, row_umax[v]);
 				}
 				else
 				{
@@ -202,6 +199,20 @@ private:
 				}
 			}
 		}
+
+		umin_ = width;
+		vmin_ = height;
+		umax_ = 0;
+		vmax_ = 0;
+		for (int v = 0; v != height; ++v)
+		{
+			if (row_umax[v] == 0)
+				continue;
+			umin_ = std::min(row_umin[v], umin_);
+			umax_ = std::max(row_umax[v], umax_);
+			vmin_ = std::min(v, vmin_);
+			vmax_ = std::max(v + 1, vmax_);
+		}
 	}
 
 public:
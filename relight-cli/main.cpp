@@ -40,6 +40,10 @@ void help() {
 	cout << "\t  -M        : extract median image (7/8th quantile) \n";
 
 	cout << "\t  -w        : number of workers (default 8)\n";
+	cout << "\t  -K <dir>  : checkpoint folder, reuses the base and resumes an interrupted build\n";
+	cout << "\t  -B <int>  : decode and fit <int> horizontal bands in parallel (default 1, for large images), the -w workers are split among the bands\n";
+	cout << "\t  -G        : coordinator, worker processes can help through the checkpoint folder (needs -K)\n";
+	cout << "\t  -W        : worker, fits bands for the coordinator run with the same arguments\n";
 	cout << "\t  -k <int>x<int>+<int>+<int>: Cropping extracts only the widthxheight+offx+offy part\n";
 
 	cout << "\nIgnore exotic parameters below here\n\n";
@@ -117,7 +121,7 @@ int main(int argc, char *argv[]) {
 
 	opterr = 0;
 	char c;
-	while ((c  = getopt (argc, argv, "hmMn3:r:d:q:p:s:c:reE:b:y:S:R:CD:Q:L:k:P:I:v")) != -1)
+	while ((c  = getopt (argc, argv, "hmMn3:r:d:q:p:s:c:reE:b:y:S:R:CD:Q:L:k:P:I:vw:HK:B:GW")) != -1)
 		switch (c)
 		{
 		case 'h':
@@ -230,7 +234,19 @@ int main(int argc, char *argv[]) {
 		}
 			break;
 		case 'w':
-			builder.nworkers = std::min(atoi(optarg), 1);
+			builder.nworkers = std::max(atoi(optarg), 1);
+			break;
+		case 'K':
+			builder.checkpoint = optarg;
+			break;
+		case 'B':
+			builder.nbands = uint32_t(std::max(atoi(optarg), 1));
+			break;
+		case 'G':
+			builder.role = RtiBuilder::COORDINATOR;
+			break;
+		case 'W':
+			builder.role = RtiBuilder::WORKER;
 			break;
 		case 'e':
 			evaluate_error = true;
@@ -548,6 +564,11 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
+	if(builder.role != RtiBuilder::STANDALONE && builder.checkpoint.empty()) {
+		cerr << "Coordinator and workers share the checkpoint folder, use -K!\n" << endl;
+		return 1;
+	}
+
 	QString out = output;
 	int size = 0; //size of the output
 
@@ -555,7 +576,23 @@ int main(int argc, char *argv[]) {
 		if(out.endsWith(".ptm") || out.endsWith(".rti"))
 			builder.commonMinMax = true; //needed by legacy formats
 
-		builder.init(callback);
+		if(builder.role != RtiBuilder::STANDALONE && (out.endsWith(".ptm") || out.endsWith(".rti"))) {
+			cerr << "Coordinator and workers fit strips of relight or deepzoom outputs only, not .ptm or .rti!\n" << endl;
+			return 1;
+		}
+
+		if(!builder.init(callback)) {
+			cerr << "Failed building the base: " << builder.error << " !\n" << endl;
+			return 1;
+		}
+
+		if(builder.role == RtiBuilder::WORKER) {
+			if(!builder.work()) {
+				cerr << "Worker failed: " << builder.error << " !\n" << endl;
+				return 1;
+			}
+			return 0;
+		}
 
 		if(out.endsWith(".ptm")) {
 			size = builder.savePTM(output);
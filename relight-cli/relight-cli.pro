@@ -55,6 +55,7 @@ SOURCES += main.cpp \
     ../src/colorprofile.cpp \
     ../src/jpeg_decoder.cpp \
     ../src/image_decoder.cpp \
+    ../src/image_encoder.cpp \
     ../src/tiff_decoder.cpp \
     ../src/png_decoder.cpp \
     ../src/exr_decoder.cpp \
@@ -96,6 +97,7 @@ HEADERS += \
     ../src/colorprofile.h \
     ../src/jpeg_decoder.h \
     ../src/image_decoder.h \
+    ../src/image_encoder.h \
     ../src/tiff_decoder.h \
     ../src/png_decoder.h \
     ../src/exr_decoder.h \
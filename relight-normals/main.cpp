@@ -7,13 +7,22 @@
 #include <QStringList>
 #include <QImage>
 #include <QFileInfo>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QThread>
+#include <QTextStream>
 
 #include "../src/normals/normalstask.h"
 #include "../src/project.h"
 #include "../src/imageset.h"
 #include "../src/getopt.h"
+#include "../src/relight_threadpool.h"
 
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 extern int opterr;
 
@@ -43,6 +52,44 @@ struct CLINormalsParameters : public NormalsParameters {
 	QString output_normalmap;
 	QString output_heightmap;
 	double scale_down = 0.0;
+
+	// Batch options
+	QString batch_manifest;
+	QString batch_report;
+	int batch_jobs = 2;
+	bool batch_options = false; //any of --batch, --jobs, --report given.
+};
+
+//per dataset timings of the batch report, seconds.
+struct JobTiming {
+	QString input;
+	QString output;
+	bool ok = false;
+	QString error;
+	double start = 0.0;  //since the beginning of the batch
+	double init = 0.0;   //project or folder loading
+	double run = 0.0;    //normals, flattening, integration and saving
+	double total = 0.0;
+	int images = 0;
+	int width = 0;
+	int height = 0;
+
+	QJsonObject toJson() const {
+		QJsonObject obj;
+		obj["input"] = input;
+		obj["output"] = output;
+		obj["status"] = ok ? "done" : "failed";
+		if(!ok)
+			obj["error"] = error;
+		obj["start"] = start;
+		obj["init"] = init;
+		obj["run"] = run;
+		obj["total"] = total;
+		obj["images"] = images;
+		obj["width"] = width;
+		obj["height"] = height;
+		return obj;
+	}
 };
 
 void help() {
@@ -52,10 +99,10 @@ void help() {
 	cout << "Input:\n";
 	cout << "  <folder>              : Process folder with .lp file\n";
 	cout << "  <project.relight>     : Process .relight project file\n";
-	cout << "  <normalmap.png/jpg>   : Process existing normal map\n\n";
+	cout << "  <normalmap.png/jpg>   : Process existing normal map (also .tif, .tiff, .exr)\n\n";
 	
 	cout << "Normal generation options (for folder/project input):\n";
-	cout << "  -s <solver>           : Normal solver: l2 (default), sbl*, rpca* (*not implemented yet)\n";
+	cout << "  -s <solver>           : Normal solver: l2 (default), robust, sbl, rpca\n";
 	cout << "  -3 <radius[:offset]>  : 3D light positions, dome radius and optional offset\n";
 	cout << "  -k <w>x<h>+<x>+<y>    : Crop to width x height at offset x,y\n\n";
 	
@@ -67,14 +114,25 @@ void help() {
 	cout << "Integration options:\n";
 	cout << "  -i <method>           : Integration method: bni, fft, assm (default: none)\n";
 	cout << "  --bni-k <float>       : BNI discontinuity parameter (default: 2.0)\n";
-	cout << "  --assm-error <float>  : ASSM target error (default: 0.1)\n\n";
+	cout << "  --assm-error <float>  : ASSM target error (default: 0.1)\n";
+	cout << "  --assm-faces <int>    : ASSM triangle budget (default: 0, no limit)\n";
+	cout << "  --assm-time <float>   : ASSM remeshing time limit in seconds (default: 0, no limit)\n";
+	cout << "  --mesh-error <float>  : Adaptive .ply mesh error in pixels (default: 0, full grid)\n\n";
 	
 	cout << "Output options:\n";
 	cout << "  -o <output>           : Output file (without extension)\n";
 	cout << "  --save-normals <file> : Save normal map\n";
+	cout << "  --normals-format <f>  : Normal map format: jpg (default), png (16 bit), tiff (16 bit), exr (half float)\n";
 	cout << "  --scale-down <float>  : Scale down by factor\n";
 	cout << "  -q <int>              : JPEG quality (default: 95)\n\n";
 	
+	cout << "Batch options:\n";
+	cout << "  --batch <manifest>    : Process the datasets listed in the manifest, one per line, each line\n";
+	cout << "                          with the options and input of a single run (# starts a comment),\n";
+	cout << "                          relative paths are resolved against the current directory, not the manifest's\n";
+	cout << "  --jobs <int>          : Datasets processed at the same time, sharing the threads (default: 2)\n";
+	cout << "  --report <file.json>  : Per dataset timing report (default: <manifest>_report.json)\n\n";
+
 	cout << "Other options:\n";
 	cout << "  -h, --help            : Show this help\n";
 }
@@ -96,13 +154,21 @@ bool parseArgs(int argc, char *argv[], CLINormalsParameters &config) {
 		{(char*)"bni-k", required_argument, 0, 1003},
 		{(char*)"assm-error", required_argument, 0, 1006},
 		{(char*)"save-normals", required_argument, 0, 1007},
+		{(char*)"mesh-error", required_argument, 0, 1008},
+		{(char*)"assm-faces", required_argument, 0, 1010},
+		{(char*)"assm-time", required_argument, 0, 1011},
+		{(char*)"normals-format", required_argument, 0, 1012},
 		{(char*)"scale-down", required_argument, 0, 1009},
+		{(char*)"batch", required_argument, 0, 1013},
+		{(char*)"jobs", required_argument, 0, 1014},
+		{(char*)"report", required_argument, 0, 1015},
 		{(char*)"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
 	};
 	
 	int c;
 	int option_index = 0;
+	optind = 0; //restart, manifest lines are parsed one after the other.
 	
 	while ((c = getopt_long(argc, argv, "hs:3:k:i:o:q:", long_options, &option_index)) != -1) {
 		switch (c) {
@@ -112,16 +178,11 @@ bool parseArgs(int argc, char *argv[], CLINormalsParameters &config) {
 		case 's': {
 			QString solver_str = QString(optarg).toLower();
 			if (solver_str == "l2") config.solver = NORMALS_L2;
-			else if (solver_str == "sbl") {
-				cerr << "SBL solver is not implemented yet" << endl;
-				return false;
-			}
-			else if (solver_str == "rpca") {
-				cerr << "RPCA solver is not implemented yet" << endl;
-				return false;
-			}
+			else if (solver_str == "robust") config.solver = NORMALS_ROBUST;
+			else if (solver_str == "sbl") config.solver = NORMALS_SBL;
+			else if (solver_str == "rpca") config.solver = NORMALS_RPCA;
 			else {
-				cerr << "Unknown solver: " << optarg << ". Available: l2" << endl;
+				cerr << "Unknown solver: " << optarg << ". Available: l2, robust, sbl, rpca" << endl;
 				return false;
 			}
 			config.generate_normals = true;
@@ -190,9 +251,42 @@ bool parseArgs(int argc, char *argv[], CLINormalsParameters &config) {
 		case 1007: // --save-normals
 			config.output_normalmap = QString(optarg);
 			break;
+		case 1008: // --mesh-error
+			config.mesh_error = QString(optarg).toDouble();
+			break;
 		case 1009: // --scale-down
 			config.scale_down = QString(optarg).toDouble();
 			break;
+		case 1010: // --assm-faces
+			config.assm_max_faces = QString(optarg).toInt();
+			break;
+		case 1011: // --assm-time
+			config.assm_max_seconds = QString(optarg).toDouble();
+			break;
+		case 1012: { // --normals-format
+			QString format = QString(optarg).toLower();
+			if (format == "jpg" || format == "jpeg") config.normalmap_format = NORMALMAP_JPEG;
+			else if (format == "png") config.normalmap_format = NORMALMAP_PNG16;
+			else if (format == "tif" || format == "tiff") config.normalmap_format = NORMALMAP_TIFF16;
+			else if (format == "exr") config.normalmap_format = NORMALMAP_EXR;
+			else {
+				cerr << "Unknown normal map format: " << optarg << endl;
+				return false;
+			}
+			break;
+		}
+		case 1013: // --batch
+			config.batch_manifest = QString(optarg);
+			config.batch_options = true;
+			break;
+		case 1014: // --jobs
+			config.batch_jobs = std::max(1, QString(optarg).toInt());
+			config.batch_options = true;
+			break;
+		case 1015: // --report
+			config.batch_report = QString(optarg);
+			config.batch_options = true;
+			break;
 		case '?':
 			cerr << "Unknown option: " << char(optopt) << endl;
 			return false;
@@ -202,7 +296,7 @@ bool parseArgs(int argc, char *argv[], CLINormalsParameters &config) {
 	// Get input path
 	if (optind < argc) {
 		config.input_path = QString(argv[optind]);
-	} else {
+	} else if (config.batch_manifest.isEmpty()) {
 		cerr << "No input specified" << endl;
 		return false;
 	}
@@ -210,44 +304,43 @@ bool parseArgs(int argc, char *argv[], CLINormalsParameters &config) {
 	return true;
 }
 
-int main(int argc, char *argv[]) {
-	QCoreApplication app(argc, argv);
-	
-	if (argc == 1) {
-		help();
-		return 1;
-	}
-	
-	CLINormalsParameters config;
-	if (!parseArgs(argc, argv, config)) {
-		return 1;
-	}
-	
+// Loads the input and runs the task, rows are solved in pool if not null.
+// Errors are returned in timing.error.
+bool processInput(CLINormalsParameters &config, RelightThreadPool *pool, bool verbose, JobTiming &timing) {
+	QElapsedTimer timer;
+	timer.start();
+	timing.input = config.input_path;
+
+	QFileInfo info(config.input_path);
+	QString suffix = info.suffix().toLower();
+	bool normalmap_input = suffix == "png" || suffix == "jpg" || suffix == "jpeg" ||
+		suffix == "tif" || suffix == "tiff" || suffix == "exr";
+
 	// Set up default output path if not specified
 	if (config.path.isEmpty()) {
-		QFileInfo info(config.input_path);
 		if (info.suffix().toLower() == "relight") {
 			config.path = info.absolutePath() + "/" + info.baseName() + "_normals.png";
-		} else if (info.suffix().toLower() == "png" || info.suffix().toLower() == "jpg" || info.suffix().toLower() == "jpeg") {
+		} else if (normalmap_input) {
 			config.path = info.absolutePath() + "/" + info.baseName() + "_processed.png";
 		} else if (info.isDir()) {
 			// It's a directory
 			QDir dir(config.input_path);
 			config.path = dir.absolutePath() + "/normals.png";
 		} else {
-			cerr << "Unknown input type: " << qPrintable(config.input_path) << endl;
-			return 1;
+			timing.error = "Unknown input type: " + config.input_path;
+			return false;
 		}
 	}
+	timing.output = config.path;
 	
 	// Create and configure the task
 	NormalsTask task;
+	task.shared_pool = pool;
 	
 	// Set parameters based on input type
-	QFileInfo info(config.input_path);
 	NormalsParameters params = config;
 	
-	if (info.suffix().toLower() == "png" || info.suffix().toLower() == "jpg" || info.suffix().toLower() == "jpeg") {
+	if (normalmap_input) {
 		// Processing existing normal map
 		params.compute = false;
 		params.input_path = config.input_path;
@@ -266,8 +359,8 @@ int main(int argc, char *argv[]) {
 			try {
 				project.load(config.input_path);
 			} catch (...) {
-				cerr << "Failed to load project: " << qPrintable(config.input_path) << endl;
-				return 1;
+				timing.error = "Failed to load project: " + config.input_path;
+				return false;
 			}
 			
 			// Apply crop if specified
@@ -281,7 +374,7 @@ int main(int argc, char *argv[]) {
 			
 			task.initFromProject(project);
 			
-		} else if (info.suffix().toLower() == "png" || info.suffix().toLower() == "jpg" || info.suffix().toLower() == "jpeg") {
+		} else if (normalmap_input) {
 			// Processing existing normal map - no initialization needed
 			
 		} else if (info.isDir()) {
@@ -315,8 +408,8 @@ int main(int argc, char *argv[]) {
 			
 			task.initFromFolder(config.input_path.toLocal8Bit().data(), dome, crop);
 		} else {
-			cerr << "Unknown input type: " << qPrintable(config.input_path) << endl;
-			return 1;
+			timing.error = "Unknown input type: " + config.input_path;
+			return false;
 		}
 		
 		// Apply scaling after initialization when we know the actual dimensions
@@ -324,37 +417,184 @@ int main(int argc, char *argv[]) {
 			task.parameters.surface_width = (int)(task.imageset.image_width / config.scale_down);
 			task.parameters.surface_height = (int)(task.imageset.image_height / config.scale_down);
 		}
+		timing.images = int(task.imageset.images.size());
+		timing.width = task.imageset.width;
+		timing.height = task.imageset.height;
+		timing.init = timer.elapsed()/1000.0;
 		
-		// Connect progress signal to show progress
-		QObject::connect(&task, &NormalsTask::progress, [](QString message, int percent) {
-			cout << "\r" << qPrintable(message) << " " << percent << "%" << endl;
-		});
+		if (verbose) {
+			// Connect progress signal to show progress
+			QObject::connect(&task, &NormalsTask::progress, [](QString message, int percent) {
+				cout << "\r" << qPrintable(message) << " " << percent << "%" << endl;
+			});
+			cout << "Starting normal processing..." << endl;
+		}
 		
 		// Run the task
-		cout << "Starting normal processing..." << endl;
 		task.run();
-		cout << endl;
+		timing.run = timer.elapsed()/1000.0 - timing.init;
+		timing.total = timer.elapsed()/1000.0;
 
-		if (task.status == Task::DONE) {
-			cout << "Output saved to: " << qPrintable(config.path) << endl;
-			
-			// Save additional outputs if requested
-			if (!config.output_normalmap.isEmpty() && config.output_normalmap != config.path) {
-				QFile::copy(config.path, config.output_normalmap);
+		if (task.status != Task::DONE) {
+			timing.error = "Processing failed: " + task.error;
+			return false;
+		}
+		
+		// Save additional outputs if requested
+		if (!config.output_normalmap.isEmpty() && config.output_normalmap != config.path) {
+			QFile::copy(config.path, config.output_normalmap);
+			if (verbose)
 				cout << "Normal map saved to: " << qPrintable(config.output_normalmap) << endl;
-			}
-			
-			return 0;
-		} else {
-			cerr << "Processing failed: " << qPrintable(task.error) << endl;
-			return 1;
 		}
+		timing.ok = true;
+		return true;
 		
 	} catch (const QString &e) {
-		cerr << "Error: " << qPrintable(e) << endl;
-		return 1;
+		timing.error = "Error: " + e;
 	} catch (...) {
-		cerr << "Unknown error occurred" << endl;
+		timing.error = "Unknown error occurred";
+	}
+	timing.total = timer.elapsed()/1000.0;
+	return false;
+}
+
+// One dataset per line: the options and input of a single run.
+bool readManifest(const QString &filename, std::vector<CLINormalsParameters> &jobs) {
+	QFile file(filename);
+	if (!file.open(QFile::ReadOnly)) {
+		cerr << "Could not open manifest: " << qPrintable(filename) << endl;
+		return false;
+	}
+	QTextStream stream(&file);
+	int n = 0;
+	while (!stream.atEnd()) {
+		QString line = stream.readLine().trimmed();
+		n++;
+		if (line.isEmpty() || line.startsWith('#'))
+			continue;
+
+		QStringList args = QProcess::splitCommand(line);
+		args.prepend("relight-normals");
+		//getopt permutes argv, it needs its own copy.
+		std::vector<QByteArray> storage;
+		for (const QString &arg: args)
+			storage.push_back(arg.toLocal8Bit());
+		std::vector<char *> argv;
+		for (QByteArray &arg: storage)
+			argv.push_back(arg.data());
+		argv.push_back(nullptr);
+
+		CLINormalsParameters config;
+		if (!parseArgs(int(args.size()), argv.data(), config) || config.input_path.isEmpty()) {
+			cerr << "Invalid manifest line " << n << ": " << qPrintable(line) << endl;
+			return false;
+		}
+		//batch options of a line would be silently ignored.
+		if (config.batch_options) {
+			cerr << "--batch, --jobs and --report are not allowed in the manifest, line " << n << endl;
+			return false;
+		}
+		jobs.push_back(config);
+	}
+	return true;
+}
+
+// Datasets are processed batch_jobs at a time, each one decoding its images in its own thread
+// while the rows of all of them are solved in a single pool: the reading of one dataset
+// overlaps the solving of the others and the threads are started only once.
+int runBatch(CLINormalsParameters &config) {
+	std::vector<CLINormalsParameters> jobs;
+	if (!readManifest(config.batch_manifest, jobs))
+		return 1;
+
+	QString report = config.batch_report;
+	if (report.isEmpty()) {
+		QFileInfo info(config.batch_manifest);
+		report = info.absolutePath() + "/" + info.completeBaseName() + "_report.json";
+	}
+
+	int nthreads = QThread::idealThreadCount();
+	int njobs = std::min(config.batch_jobs, std::max(1, int(jobs.size())));
+	cout << "Processing " << jobs.size() << " datasets, " << njobs << " at a time on " << nthreads << " threads" << endl;
+
+	RelightThreadPool pool;
+	pool.start(nthreads);
+
+	std::vector<JobTiming> timings(jobs.size());
+	std::atomic<size_t> next(0);
+	std::mutex output_mutex;
+	QElapsedTimer clock;
+	clock.start();
+
+	auto worker = [&]() {
+		for (size_t i = next++; i < jobs.size(); i = next++) {
+			JobTiming &timing = timings[i];
+			timing.start = clock.elapsed()/1000.0;
+			processInput(jobs[i], &pool, false, timing);
+
+			std::lock_guard<std::mutex> lock(output_mutex);
+			cout << "[" << (i + 1) << "/" << jobs.size() << "] " << qPrintable(timing.input);
+			if (timing.ok)
+				cout << " done in " << timing.total << "s" << endl;
+			else
+				cout << " failed: " << qPrintable(timing.error) << endl;
+		}
+	};
+	std::vector<std::thread> readers;
+	for (int k = 0; k < njobs; k++)
+		readers.emplace_back(worker);
+	for (std::thread &reader: readers)
+		reader.join();
+	pool.finish();
+
+	double total = clock.elapsed()/1000.0;
+	int failed = 0;
+	QJsonArray datasets;
+	for (const JobTiming &timing: timings) {
+		datasets.append(timing.toJson());
+		failed += timing.ok ? 0 : 1;
+	}
+	QJsonObject obj;
+	obj["manifest"] = config.batch_manifest;
+	obj["threads"] = nthreads;
+	obj["jobs"] = njobs;
+	obj["total"] = total;
+	obj["failed"] = failed;
+	obj["datasets"] = datasets;
+
+	QFile file(report);
+	if (!file.open(QFile::WriteOnly)) {
+		cerr << "Could not write report: " << qPrintable(report) << endl;
+		return 1;
+	}
+	file.write(QJsonDocument(obj).toJson());
+	cout << "Processed " << (jobs.size() - failed) << "/" << jobs.size() << " datasets in " << total << "s, report: "
+		 << qPrintable(report) << endl;
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	QCoreApplication app(argc, argv);
+	
+	if (argc == 1) {
+		help();
+		return 1;
+	}
+	
+	CLINormalsParameters config;
+	if (!parseArgs(argc, argv, config)) {
+		return 1;
+	}
+
+	if (!config.batch_manifest.isEmpty())
+		return runBatch(config);
+	
+	JobTiming timing;
+	if (!processInput(config, nullptr, true, timing)) {
+		cerr << qPrintable(timing.error) << endl;
 		return 1;
 	}
+	cout << endl;
+	cout << "Output saved to: " << qPrintable(config.path) << endl;
+	return 0;
 }
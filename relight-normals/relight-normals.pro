@@ -25,6 +25,7 @@ SOURCES += \
         ../src/image.cpp \
         ../src/jpeg_decoder.cpp \
         ../src/image_decoder.cpp \
+        ../src/image_encoder.cpp \
         ../src/tiff_decoder.cpp \
         ../src/png_decoder.cpp \
         ../src/exr_decoder.cpp \
@@ -70,6 +71,7 @@ HEADERS += \
     ../src/image.h \
     ../src/jpeg_decoder.h \
     ../src/image_decoder.h \
+    ../src/image_encoder.h \
     ../src/tiff_decoder.h \
     ../src/png_decoder.h \
     ../src/exr_decoder.h \
@@ -6,6 +6,7 @@
 #include "reflectionview.h"
 #include "../src/project.h"
 #include "../src/align.h"
+#include "../src/phasecorrelation.h"
 #include "processqueue.h"
 
 #include <QHBoxLayout>
@@ -36,6 +37,8 @@ void FindAlignment::run() {
 	img.load(cache_filename, "JPG");
 	if(!img.isNull()) {
 		align->readCacheThumbs(img);
+		if(update_positions && !estimateOffsets())
+			return;
 		progressed(QString("Done."), 100);
 		setStatus(DONE);
 		return;
@@ -57,10 +60,22 @@ void FindAlignment::run() {
 			return;
 	}
 	align->saveCacheThumbs(cache_filename);
+	if(update_positions && !estimateOffsets())
+		return;
 	progressed(QString("Done"), 100);
 	setStatus(DONE);
 }
 
+bool FindAlignment::estimateOffsets() {
+	std::function<bool(QString s, int d)> callback = [this](QString s, int n)->bool { return this->progressed(s, std::min(99, n)); };
+	try {
+		align->offsets = PhaseCorrelation::align(align->thumbs, 0, 256, &callback);
+	} catch(std::string e) {
+		return false;
+	}
+	return true;
+}
+
 
 AlignRow::AlignRow(Align *_align, QWidget *parent): QWidget(parent) {
 	align = _align;
@@ -22,6 +22,10 @@ public:
 	FindAlignment(Align *align, bool update = true);
 	virtual void run() override;
 
+private:
+	//subpixel offsets of the patches relative to the first image.
+	bool estimateOffsets();
+
 };
 
 class AlignRow: public QWidget {
@@ -0,0 +1,244 @@
+#include "imagecache.h"
+#include "../src/project.h"
+#include "../src/image_decoder.h"
+
+#include <QImageReader>
+#include <QFileInfo>
+#include <QPainter>
+#include <QMutexLocker>
+
+#include <climits>
+
+ImageCache::ImageCache() {
+	//decoding is mostly I/O and libjpeg, a couple of threads keep the views responsive.
+	pool.setMaxThreadCount(2);
+}
+
+void ImageCache::setBudget(size_t bytes) {
+	QMutexLocker locker(&mutex);
+	max_bytes = bytes;
+	evict();
+}
+
+void ImageCache::clear() {
+	QMutexLocker locker(&mutex);
+	tiles.clear();
+	lru.clear();
+	sources.clear();
+	used_bytes = 0;
+}
+
+void ImageCache::invalidate(const QString &path) {
+	QMutexLocker locker(&mutex);
+	drop(path);
+	sources.remove(path);
+}
+
+void ImageCache::drop(const QString &path) {
+	auto it = tiles.lower_bound(Key(path, INT_MIN, INT_MIN, INT_MIN));
+	while(it != tiles.end() && std::get<0>(it->first) == path) {
+		used_bytes -= it->second.tile.sizeInBytes();
+		lru.erase(it->second.lru);
+		it = tiles.erase(it);
+	}
+}
+
+QDateTime ImageCache::refresh(const QString &path) {
+	QFileInfo info(path);
+	QMutexLocker locker(&mutex);
+	Source &source = sources[path];
+	if(source.modified != info.lastModified() || source.bytes != info.size()) {
+		drop(path);
+		source = Source();
+		source.modified = info.lastModified();
+		source.bytes = info.size();
+	}
+	return source.modified;
+}
+
+int ImageCache::levels(QSize size) {
+	int n = 1;
+	int side = std::max(size.width(), size.height());
+	while((side >> (n-1)) > tile_size)
+		n++;
+	return n;
+}
+
+QSize ImageCache::levelSize(QSize size, int level) {
+	int d = 1<<level;
+	return QSize((size.width() + d - 1)/d, (size.height() + d - 1)/d);
+}
+
+QSize ImageCache::imageSize(const QString &path) {
+	QDateTime modified = refresh(path);
+	{
+		QMutexLocker locker(&mutex);
+		if(sources[path].size.isValid())
+			return sources[path].size;
+	}
+	QImageReader reader(path);
+	reader.setAutoTransform(false);
+	QSize size = reader.size();
+	if(!size.isValid()) {
+		ImageDecoder dec;
+		int w = 0, h = 0;
+		if(dec.init(path.toStdString().c_str(), w, h))
+			size = QSize(w, h);
+		dec.finish();
+	}
+	QMutexLocker locker(&mutex);
+	if(sources[path].modified == modified)
+		sources[path].size = size;
+	return size;
+}
+
+QImage ImageCache::tile(const QString &path, int level, int tx, int ty) {
+	QDateTime modified = refresh(path);
+	QMutexLocker locker(&mutex);
+	Key key(path, level, tx, ty);
+	auto it = tiles.find(key);
+	if(it != tiles.end()) {
+		lru.splice(lru.begin(), lru, it->second.lru);
+		return it->second.tile;
+	}
+	if(pending.count(key))
+		return QImage();
+	pending.insert(key);
+
+	pool.start([this, key, modified]() {
+		const QString &path = std::get<0>(key);
+		int level = std::get<1>(key);
+		QImage img = decodeTile(path, level, std::get<2>(key), std::get<3>(key));
+		{
+			QMutexLocker locker(&mutex);
+			pending.erase(key);
+			//the file changed while decoding.
+			if(img.isNull() || sources.value(path).modified != modified)
+				return;
+			insertTile(key, img);
+			evict();
+		}
+		emit tileReady(path, level);
+	});
+	return QImage();
+}
+
+QImage ImageCache::image(const QString &path, int level) {
+	QSize size = levelSize(imageSize(path), level);
+	if(size.isEmpty())
+		return QImage();
+	QDateTime modified = refresh(path);
+	{
+		QMutexLocker locker(&mutex);
+		int nx = (size.width() + tile_size - 1)/tile_size;
+		int ny = (size.height() + tile_size - 1)/tile_size;
+		std::vector<QImage> found;
+		for(int ty = 0; ty < ny; ty++) {
+			for(int tx = 0; tx < nx; tx++) {
+				auto it = tiles.find(Key(path, level, tx, ty));
+				if(it == tiles.end())
+					break;
+				lru.splice(lru.begin(), lru, it->second.lru);
+				found.push_back(it->second.tile);
+			}
+		}
+		if(found.size() == size_t(nx*ny)) {
+			QImage img(size, QImage::Format_RGB32);
+			QPainter painter(&img);
+			for(int ty = 0; ty < ny; ty++)
+				for(int tx = 0; tx < nx; tx++)
+					painter.drawImage(tx*tile_size, ty*tile_size, found[tx + ty*nx]);
+			return img;
+		}
+	}
+	QImage img = decode(path, level);
+	insert(path, level, img, modified);
+	return img;
+}
+
+QImage ImageCache::decode(const QString &path, int level) {
+	QSize target = levelSize(imageSize(path), level);
+
+	QImageReader reader(path);
+	reader.setAutoTransform(false);
+	//jpeg plugin uses libjpeg DCT scaling, no full resolution decode.
+	if(level > 0)
+		reader.setScaledSize(target);
+	QImage img = reader.read();
+	if(img.isNull()) {
+		img = Project::readImage(path);
+		if(img.isNull())
+			return img;
+		if(img.size() != target)
+			img = img.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+	}
+	return img.convertToFormat(QImage::Format_RGB32);
+}
+
+QImage ImageCache::decodeTile(const QString &path, int level, int tx, int ty) {
+	QSize target = levelSize(imageSize(path), level);
+	QRect rect = QRect(tx*tile_size, ty*tile_size, tile_size, tile_size).intersected(QRect(QPoint(0, 0), target));
+	if(rect.isEmpty())
+		return QImage();
+
+	QImageReader reader(path);
+	reader.setAutoTransform(false);
+	if(level > 0)
+		reader.setScaledSize(target);
+	//the jpeg plugin skips the rows above and stops after the clip.
+	reader.setScaledClipRect(rect);
+	QImage img = reader.read();
+	if(img.isNull()) {
+		//the full level has to be decoded anyway, keep all of it.
+		QDateTime modified = refresh(path);
+		QImage level_img = decode(path, level);
+		insert(path, level, level_img, modified);
+		if(level_img.isNull())
+			return level_img;
+		img = level_img.copy(rect);
+	}
+	return img.convertToFormat(QImage::Format_RGB32);
+}
+
+void ImageCache::insert(const QString &path, int level, const QImage &img, const QDateTime &modified) {
+	if(img.isNull())
+		return;
+	int nx = (img.width() + tile_size - 1)/tile_size;
+	int ny = (img.height() + tile_size - 1)/tile_size;
+
+	QMutexLocker locker(&mutex);
+	if(sources.value(path).modified != modified)
+		return;
+	for(int ty = 0; ty < ny; ty++) {
+		for(int tx = 0; tx < nx; tx++) {
+			insertTile(Key(path, level, tx, ty), img.copy(tx*tile_size, ty*tile_size,
+									  std::min(tile_size, img.width() - tx*tile_size),
+									  std::min(tile_size, img.height() - ty*tile_size)));
+		}
+	}
+	evict();
+}
+
+void ImageCache::insertTile(const Key &key, const QImage &tile) {
+	auto it = tiles.find(key);
+	if(it != tiles.end()) {
+		used_bytes -= it->second.tile.sizeInBytes();
+		lru.erase(it->second.lru);
+		tiles.erase(it);
+	}
+	Entry entry;
+	entry.tile = tile;
+	lru.push_front(key);
+	entry.lru = lru.begin();
+	used_bytes += entry.tile.sizeInBytes();
+	tiles[key] = entry;
+}
+
+void ImageCache::evict() {
+	while(used_bytes > max_bytes && !lru.empty()) {
+		auto it = tiles.find(lru.back());
+		used_bytes -= it->second.tile.sizeInBytes();
+		tiles.erase(it);
+		lru.pop_back();
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QObject>
+#include <QImage>
+#include <QMutex>
+#include <QMap>
+#include <QDateTime>
+#include <QThreadPool>
+
+#include <list>
+#include <map>
+#include <set>
+#include <tuple>
+
+/* Process wide cache of decoded image tiles.
+ * Each image is stored as a pyramid of levels (level 0 full resolution, level n 1/2^n),
+ * each level split in tile_size x tile_size tiles. Single tiles are decoded in the background
+ * (jpeg scaled and clipped decoding) and tiles are evicted least recently used first
+ * when the byte budget is exceeded.
+ * Files rewritten in place (e.g. rotated) are detected by date and size, and decoded again.
+ */
+
+class ImageCache: public QObject {
+	Q_OBJECT
+public:
+	static const int tile_size = 512;
+
+	static ImageCache &instance() {
+		static ImageCache single;
+		return single;
+	}
+
+	void setBudget(size_t bytes);
+	size_t budget() { return max_bytes; }
+	void clear();
+	//drop the tiles and size of a file that has been modified.
+	void invalidate(const QString &path);
+
+	//full resolution size, reads only the header.
+	QSize imageSize(const QString &path);
+	//coarsest level fits in a single tile.
+	static int levels(QSize size);
+	static QSize levelSize(QSize size, int level);
+
+	//returns a null image if not cached: decoding is scheduled and tileReady emitted when done.
+	QImage tile(const QString &path, int level, int tx, int ty);
+	//synchronous, assembled from the cached tiles or decoded on the spot.
+	QImage image(const QString &path, int level = 0);
+
+signals:
+	void tileReady(QString path, int level);
+
+private:
+	typedef std::tuple<QString, int, int, int> Key; //path, level, tx, ty
+	struct Entry {
+		QImage tile;
+		std::list<Key>::iterator lru;
+	};
+	//the version of the file the tiles were decoded from.
+	struct Source {
+		QDateTime modified;
+		qint64 bytes = -1;
+		QSize size;
+	};
+
+	QMutex mutex;
+	std::map<Key, Entry> tiles;
+	std::list<Key> lru; //front is most recently used
+	QMap<QString, Source> sources;
+	std::set<Key> pending;
+	size_t used_bytes = 0;
+	size_t max_bytes = size_t(1)<<30;
+	QThreadPool pool;
+
+	ImageCache();
+	//current version of the file, tiles of an older one are dropped.
+	QDateTime refresh(const QString &path);
+	void drop(const QString &path); //mutex must be locked
+	QImage decode(const QString &path, int level);
+	QImage decodeTile(const QString &path, int level, int tx, int ty);
+	void insert(const QString &path, int level, const QImage &img, const QDateTime &modified);
+	void insertTile(const Key &key, const QImage &tile);
+	void evict();
+};
+
+#endif // IMAGECACHE_H
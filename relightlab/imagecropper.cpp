@@ -61,6 +61,8 @@ QVariant BoundaryMarker::itemChange(GraphicsItemChange change, const QVariant &v
 }
 
 ImageCropper::ImageCropper(QWidget* parent):	ImageView(parent) {
+	//crop handles work on the full resolution pixmap.
+	tiled = false;
 	setMinimumSize(WIDGET_MINIMUM_SIZE);
 	setMouseTracking(true);
 
@@ -11,6 +11,7 @@
 #include "imageframe.h"
 //#include "canvas.h"
 #include "imageview.h"
+#include "imagecache.h"
 #include "imagelist.h"
 #include "imagegrid.h"
 #include "../src/sphere.h"
@@ -157,6 +158,7 @@ void ImageFrame::rotate(bool clockwise) {
 		Project &project = qRelightApp->project();
 		try {
 			project.rotateImage(project.images[id], clockwise);
+			ImageCache::instance().invalidate(project.images[id].filename);
 		} catch(QString error) {
 			QMessageBox::critical(this, "Cannot rotate", "Relightlab cannot rotate this image. " + error);
 			break;
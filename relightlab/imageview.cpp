@@ -1,4 +1,5 @@
 #include "imageview.h"
+#include "imagecache.h"
 #include "relightapp.h"
 #include "../src/project.h"
 
@@ -6,6 +7,9 @@
 #include <QVBoxLayout>
 #include <QMessageBox>
 #include <QToolBar>
+#include <QScrollBar>
+
+#include <cmath>
 
 
 ImageView::ImageView(QWidget *parent): Canvas(parent) {
@@ -14,6 +18,10 @@ ImageView::ImageView(QWidget *parent): Canvas(parent) {
 	imagePixmap->setZValue(-1);
 	scene.addItem(imagePixmap);
 
+	connect(&ImageCache::instance(), SIGNAL(tileReady(QString,int)), this, SLOT(tileReady(QString,int)));
+	connect(this, SIGNAL(zoomed()), this, SLOT(updateTiles()));
+	connect(horizontalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updateTiles()));
+	connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(updateTiles()));
 }
 
 void ImageView::clear() {
@@ -21,6 +29,16 @@ void ImageView::clear() {
 	//scene.clear();
 	QPixmap p;
 	imagePixmap->setPixmap(p);
+	clearTiles();
+	current_path = QString();
+}
+
+void ImageView::clearTiles() {
+	for(auto &t: tiles) {
+		scene.removeItem(t.second);
+		delete t.second;
+	}
+	tiles.clear();
 }
 
 void ImageView::showImage(int id) {
@@ -28,15 +46,88 @@ void ImageView::showImage(int id) {
 	if(project.images.size() <= size_t(id))
 		return;
 
-	QImage img = project.readImage(id);
+	ImageCache &cache = ImageCache::instance();
+	QString path = project.images[id].filename;
+	QSize size = cache.imageSize(path);
+	//the preview is the coarsest level, stretched to the full resolution size.
+	int level = tiled ? ImageCache::levels(size) - 1 : 0;
+	QImage img = cache.image(path, level);
 	if(img.isNull()) {
 		QMessageBox::critical(this, "Houston we have a problem!", "Could not load image " + project.images[id].filename);
 		return;
 	}
+	clearTiles();
+	current_path = path;
+	image_size = size;
 	imagePixmap->setPixmap(QPixmap::fromImage(img));
-	setSceneRect(scene.itemsBoundingRect());
+	if(tiled) {
+		imagePixmap->setTransform(QTransform::fromScale(size.width()/double(img.width()), size.height()/double(img.height())));
+		setSceneRect(QRectF(QPointF(0, 0), size));
+	} else {
+		setSceneRect(scene.itemsBoundingRect());
+	}
 
 	current_image = id;
+	updateTiles();
+}
+
+void ImageView::updateTiles() {
+	if(!tiled || current_path.isEmpty())
+		return;
+
+	ImageCache &cache = ImageCache::instance();
+	int nlevels = ImageCache::levels(image_size);
+	double scale = transform().m11();
+	int level = scale > 0 ? int(floor(log2(1.0/scale))) : nlevels - 1;
+	current_level = std::max(0, std::min(nlevels - 1, level));
+
+	//the preview is enough.
+	if(current_level == nlevels - 1) {
+		clearTiles();
+		return;
+	}
+
+	int side = ImageCache::tile_size << current_level; //tile side in full resolution pixels
+	QRectF visible = mapToScene(viewport()->rect()).boundingRect().intersected(QRectF(QPointF(0, 0), image_size));
+	int x0 = std::max(0, int(visible.left())/side);
+	int y0 = std::max(0, int(visible.top())/side);
+	int x1 = int(visible.right())/side;
+	int y1 = int(visible.bottom())/side;
+
+	std::map<std::tuple<int, int, int>, QGraphicsPixmapItem *> wanted;
+	for(int ty = y0; ty <= y1 && !visible.isEmpty(); ty++) {
+		for(int tx = x0; tx <= x1; tx++) {
+			auto key = std::make_tuple(current_level, tx, ty);
+			auto it = tiles.find(key);
+			if(it != tiles.end()) {
+				wanted[key] = it->second;
+				tiles.erase(it);
+				continue;
+			}
+			QImage tile = cache.tile(current_path, current_level, tx, ty);
+			if(tile.isNull()) //will come back on tileReady
+				continue;
+			QGraphicsPixmapItem *item = new QGraphicsPixmapItem(QPixmap::fromImage(tile));
+			item->setZValue(-0.5);
+			item->setPos(tx*side, ty*side);
+			item->setTransform(QTransform::fromScale(1 << current_level, 1 << current_level));
+			item->setTransformationMode(Qt::SmoothTransformation);
+			scene.addItem(item);
+			wanted[key] = item;
+		}
+	}
+	clearTiles(); //what is left is not visible or at a different level
+	tiles.swap(wanted);
+}
+
+void ImageView::tileReady(QString path, int level) {
+	if(path == current_path && level == current_level)
+		updateTiles();
+}
+
+void ImageView::resizeEvent(QResizeEvent *event) {
+	Canvas::resizeEvent(event);
+	updateTiles();
 }
 
 void ImageView::setSkipped(int image) {
@@ -50,12 +141,14 @@ void ImageView::fit() {
 	if(imagePixmap)
 		fitInView(scene.itemsBoundingRect(), Qt::KeepAspectRatio);
 				  //imagePixmap->boundingRect());
+	updateTiles();
 }
 
 void ImageView::one() {
 	double current_scale = transform().m11();
 	double s = 1/current_scale;
 	scale(s, s);
+	updateTiles();
 }
 
 void ImageView::next() {
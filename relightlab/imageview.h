@@ -4,6 +4,9 @@
 #include "canvas.h"
 #include <QGraphicsScene>
 
+#include <map>
+#include <tuple>
+
 class Canvas;
 class QGraphicsPixmapItem;
 
@@ -16,6 +19,10 @@ public:
 	QGraphicsScene scene;
 	int current_image = -1;
 
+	//when tiled only a coarse preview and the visible tiles at the current zoom are loaded (through ImageCache).
+	//Subclasses needing the full resolution pixmap (e.g. the cropper) disable it.
+	bool tiled = true;
+
 	ImageView(QWidget *parent = nullptr);
 	void clear();
 
@@ -29,11 +36,24 @@ public slots:
 	void next(); //show next image
 	void prev(); //show previous image
 
+	void updateTiles();
+
 signals:
 	void skipChanged(int image);
 
 protected:
 	QGraphicsPixmapItem *imagePixmap = nullptr;
+
+	QString current_path;
+	QSize image_size;
+	int current_level = 0;
+	std::map<std::tuple<int, int, int>, QGraphicsPixmapItem *> tiles; //level, tx, ty
+
+	void resizeEvent(QResizeEvent *event);
+	void clearTiles();
+
+protected slots:
+	void tileReady(QString path, int level);
 };
 
 class ImageViewer: public QFrame {
@@ -10,6 +10,7 @@
 #include <QImageReader>
 
 #include "../src/crop.h"
+#include <exiv2/exiv2.hpp>
 #include <iostream>
 #include <locale.h>
 using namespace std;
@@ -21,6 +22,9 @@ Project project;
 
 int main(int argc, char *argv[]) {
 
+	//the thumbnail loaders read the exif previews from several threads: the xmp toolkit has to be set up before.
+	Exiv2::XmpParser::initialize();
+
 	RelightApp app(argc, argv);
 
 	QApplication::setAttribute(Qt::AA_MacDontSwapCtrlAndMeta);
@@ -41,6 +45,8 @@ int main(int argc, char *argv[]) {
 
 	app.run();
 
-	return app.exec();
+	int ret = app.exec();
+	Exiv2::XmpParser::terminate();
+	return ret;
 }
 
@@ -31,8 +31,6 @@ NormalsFrame::NormalsFrame(QWidget *parent): QFrame(parent) {
 
 	connect(source_row, &NormalsSourceRow::sourceSizeChanged, surface_row, &NormalsSurfaceRow::updateDimensions);
 	connect(source_row, &NormalsSourceRow::pathSuggestion, export_row, [this](const QString &path){ export_row->setPath(path); });
-	connect(source_row, &NormalsSourceRow::normalmapSelected, zoom_view, &ZoomOverview::showNormalmap);
-
 
 	{
 		QHBoxLayout *save_row = new QHBoxLayout;
@@ -53,8 +51,16 @@ NormalsFrame::NormalsFrame(QWidget *parent): QFrame(parent) {
 
 				zoom_view = new ZoomOverview(qRelightApp->project().crop, 200);
 				buttons_layout->addWidget(zoom_view);
+				connect(source_row, &NormalsSourceRow::normalmapSelected, zoom_view, &ZoomOverview::showNormalmap);
 
 				buttons_layout->addStretch(1);
+				buttons_layout->addWidget(preview_status = new QLabel);
+				QPushButton *preview = new QPushButton("Preview", this);
+				preview->setProperty("class", "large");
+				preview->setToolTip("Quick low resolution run of the current settings, the result is shown on the left.");
+				connect(preview, &QPushButton::clicked, [this]() { this->preview(); });
+				buttons_layout->addWidget(preview);
+
 				QPushButton *save = new QPushButton("Export", this);
 				save->setIcon(QIcon::fromTheme("save"));
 				save->setProperty("class", "large");
@@ -71,12 +77,27 @@ NormalsFrame::NormalsFrame(QWidget *parent): QFrame(parent) {
 
 		content->addLayout(save_row);
 
+		QLabel *cache_note = new QLabel("Computed normals are cached in the project resources folder (12 bytes per pixel, only the latest run) "
+										"so that exports with other flattening or surface settings skip the solver.");
+		cache_note->setWordWrap(true);
+		cache_note->setAlignment(Qt::AlignHCenter);
+		content->addWidget(cache_note);
 	}
 
 
 	content->addStretch();
 }
 
+NormalsFrame::~NormalsFrame() {
+	//the threads would outlive the frame: stop them and wait.
+	for(NormalsTask *task: previews) {
+		disconnect(task, nullptr, this, nullptr);
+		task->stop();
+		task->wait();
+		delete task;
+	}
+}
+
 void NormalsFrame::init() {
 	export_row->suggestPath();
 	zoom_view->init();
@@ -156,6 +177,69 @@ void NormalsFrame::save() {
 	emit processStarted();
 }
 
+void NormalsFrame::preview(int scale) {
+	if(preview_task)
+		preview_task->stop(); //deleted when its thread finishes.
+	preview_task = nullptr;
+
+	Project &project = qRelightApp->project();
+	if(parameters.compute && project.dome.directions.size() == 0)
+		return;
+	if(!parameters.compute && parameters.input_path.isEmpty())
+		return;
+	if(parameters.flatMethod == FlatMethod::FLAT_PLANE && parameters.plane_points.size() < 4)
+		return;
+
+	NormalsParameters params = parameters;
+	params.preview_scale = scale;
+	params.normalmap_format = NORMALMAP_JPEG;
+	params.path = project.dir.filePath("resources/normals_preview");
+
+	NormalsTask *task = new NormalsTask();
+	task->owned = true;
+	task->visible = false;
+	try {
+		task->setParameters(params);
+		task->output = params.path;
+		if(params.compute)
+			task->initFromProject(project);
+	} catch(QString error) {
+		preview_status->setText(error);
+		delete task;
+		return;
+	}
+	connect(task, &NormalsTask::progress, this, [this, task, scale](QString msg, int percent) {
+		if(task == preview_task)
+			preview_status->setText(QString("1/%1: %2 %3%").arg(scale).arg(msg).arg(percent));
+	});
+	connect(task, &QThread::finished, this, [this, task]() { previewDone(task); });
+	preview_task = task;
+	previews.append(task);
+	task->start();
+}
+
+void NormalsFrame::previewDone(NormalsTask *task) {
+	previews.removeOne(task);
+	task->deleteLater();
+	if(task != preview_task)
+		return;
+	preview_task = nullptr;
+	if(task->status != Task::DONE) {
+		preview_status->setText(task->error);
+		return;
+	}
+	QDir dir(task->parameters.path);
+	bool surface = task->parameters.surface_integration == SURFACE_BNI || task->parameters.surface_integration == SURFACE_FFT;
+	QString image = surface ? dir.filePath("heightmap_normalized.tiff") :
+							  dir.filePath(task->parameters.normalsname + task->parameters.normalmapExtension());
+	zoom_view->showNormalmap(image);
+
+	int scale = task->parameters.preview_scale;
+	preview_status->setText(QString("Preview 1/%1").arg(scale));
+	if(scale > 4)
+		preview(scale/2);
+}
+
 void NormalsFrame::updateCrop(Crop crop) {
 	zoom_view->setCrop(crop);
 	source_row->updateSize();
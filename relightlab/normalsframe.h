@@ -8,6 +8,7 @@ class QCheckBox;
 class QRadioButton;
 class QSpinBox;
 class QDoubleSpinBox;
+class QLabel;
 
 class NormalsSourceRow;
 class NormalsFlattenRow;
@@ -20,10 +21,12 @@ class NormalsFrame: public QFrame {
 	Q_OBJECT
 public:
 	NormalsFrame(QWidget *parent = nullptr);
+	~NormalsFrame();
 	NormalsParameters parameters;
 
 public slots:
 	void save();
+	void preview(int scale = 8); //runs outside the queue, refines up to 1/4.
 	void init();
 	void clear();
 	void updateCrop(Crop crop);
@@ -48,6 +51,11 @@ private:
 	QSpinBox *fourier_radius = nullptr;
 
 	ZoomOverview *zoom_view =  nullptr;
+	QLabel *preview_status = nullptr;
+	NormalsTask *preview_task = nullptr; //owned, the latest preview.
+	QList<NormalsTask *> previews;       //owned, all the previews still running (stopped ones included).
+
+	void previewDone(NormalsTask *task);
 };
 
 #endif // NORMALSFRAME_H
@@ -55,6 +55,8 @@ NormalsSourceRow::NormalsSourceRow(NormalsParameters &_parameters, QFrame *paren
 
 		solver_combo->addItem("L2 (Least Squares)", QVariant(NORMALS_L2));
 		solver_combo->addItem("Robust",              QVariant(NORMALS_ROBUST));
+		solver_combo->addItem("Sparse Bayesian",     QVariant(NORMALS_SBL));
+		solver_combo->addItem("Robust PCA",          QVariant(NORMALS_RPCA));
 		compute_layout->addStretch(1);
 		planLayout->addWidget(compute_frame);
 
@@ -398,7 +400,11 @@ NormalsSurfaceRow::NormalsSurfaceRow(NormalsParameters &_parameters, QFrame *par
 		downsample_layout->addWidget(new QLabel("Height:"), 2, 0);
 		downsample_layout->addWidget(height = new QSpinBox(), 2, 1);
 		height->setRange(1, 64000);
-
+		downsample_layout->addWidget(new QLabel("Mesh simplification error (0: full grid):"), 3, 0);
+		downsample_layout->addWidget(mesh_error = new QDoubleSpinBox(), 3, 1);
+		mesh_error->setKeyboardTracking(false);
+		mesh_error->setRange(0, 100);
+		mesh_error->setValue(parameters.mesh_error);
 
 		planLayout->addWidget(downsample_frame);
 	}
@@ -427,6 +433,19 @@ NormalsSurfaceRow::NormalsSurfaceRow(NormalsParameters &_parameters, QFrame *par
 		assm_error->setRange(0.001, 100);
 		assm_error->setValue(parameters.assm_error);
 
+		assm_layout->addWidget(new QLabel("Max triangles (0: no limit):"), 1, 0);
+		assm_layout->addWidget(assm_max_faces = new QSpinBox, 1, 1);
+		assm_max_faces->setKeyboardTracking(false);
+		assm_max_faces->setRange(0, 100000000);
+		assm_max_faces->setSingleStep(10000);
+		assm_max_faces->setValue(parameters.assm_max_faces);
+
+		assm_layout->addWidget(new QLabel("Time limit in seconds (0: no limit):"), 2, 0);
+		assm_layout->addWidget(assm_max_seconds = new QDoubleSpinBox, 2, 1);
+		assm_max_seconds->setKeyboardTracking(false);
+		assm_max_seconds->setRange(0, 36000);
+		assm_max_seconds->setValue(parameters.assm_max_seconds);
+
 		planLayout->addWidget(assm_frame);
 	}
 
@@ -454,9 +473,15 @@ NormalsSurfaceRow::NormalsSurfaceRow(NormalsParameters &_parameters, QFrame *par
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
 	connect(bni_k, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this](double v) { parameters.bni_k = v; });
 	connect(assm_error, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this](double v) { parameters.assm_error = v; });
+	connect(assm_max_faces, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, [this](int v) { parameters.assm_max_faces = v; });
+	connect(assm_max_seconds, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this](double v) { parameters.assm_max_seconds = v; });
+	connect(mesh_error, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this](double v) { parameters.mesh_error = v; });
 #else
 	connect(bni_k, qOverload<double>(&QDoubleSpinBox::valueChanged), this, [this](double v) { parameters.bni_k = v; });
 	connect(assm_error, qOverload<double>(&QDoubleSpinBox::valueChanged), this, [this](double v) { parameters.assm_error = v; });
+	connect(assm_max_faces, qOverload<int>(&QSpinBox::valueChanged), this, [this](int v) { parameters.assm_max_faces = v; });
+	connect(assm_max_seconds, qOverload<double>(&QDoubleSpinBox::valueChanged), this, [this](double v) { parameters.assm_max_seconds = v; });
+	connect(mesh_error, qOverload<double>(&QDoubleSpinBox::valueChanged), this, [this](double v) { parameters.mesh_error = v; });
 #endif
 
 	QButtonGroup *group = new QButtonGroup(this);
@@ -513,6 +538,18 @@ NormalsExportRow::NormalsExportRow(NormalsParameters &parameters, QFrame *parent
 	QPushButton *path_button = new QPushButton("...");
 	buttons->addWidget(path_button);
 	connect(path_button, &QPushButton::clicked, this, &NormalsExportRow::selectOutput);
+
+	//16 bit and exr keep the full precision of the normals for later reloads.
+	format_combo = new QComboBox;
+	format_combo->addItem("JPEG (8 bit)",     QVariant(NORMALMAP_JPEG));
+	format_combo->addItem("PNG (16 bit)",     QVariant(NORMALMAP_PNG16));
+	format_combo->addItem("TIFF (16 bit)",    QVariant(NORMALMAP_TIFF16));
+	format_combo->addItem("EXR (half float)", QVariant(NORMALMAP_EXR));
+	format_combo->setCurrentIndex(format_combo->findData(QVariant(parameters.normalmap_format)));
+	buttons->addWidget(format_combo);
+	connect(format_combo, qOverload<int>(&QComboBox::currentIndexChanged), this, [this](int) {
+		this->parameters.normalmap_format = (NormalMapFormat)format_combo->currentData().toInt();
+	});
 }
 
 void NormalsExportRow::setPath(QString path, bool emitting) {
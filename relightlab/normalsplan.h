@@ -100,6 +100,9 @@ private:
 
 	QDoubleSpinBox *bni_k = nullptr;
 	QDoubleSpinBox *assm_error = nullptr;
+	QSpinBox *assm_max_faces = nullptr;
+	QDoubleSpinBox *assm_max_seconds = nullptr;
+	QDoubleSpinBox *mesh_error = nullptr;
 
 	QDoubleSpinBox *downsample = nullptr;
 	QSpinBox *width = nullptr;
@@ -125,5 +128,6 @@ public slots:
 
 private:
 	QLineEdit *path_edit;
+	QComboBox *format_combo = nullptr;
 };
 
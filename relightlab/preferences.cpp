@@ -1,6 +1,7 @@
 #include "preferences.h"
 #include "tabwidget.h"
 #include "relightapp.h"
+#include "imagecache.h"
 
 #include <QVBoxLayout>
 #include <QGridLayout>
@@ -79,6 +80,19 @@ QWidget *Preferences::buildPerformances() {
 	connect(threads, static_cast<void(QSpinBox::*)(int)>(&QSpinBox::valueChanged), [](int v) {
 		qRelightApp->setThreads(v); });
 
+	layout->addWidget(new QLabel("Image cache (MB):"), 2, 0);
+	QSpinBox *cache = new QSpinBox;
+	cache->setMinimum(64);
+	cache->setMaximum(65536);
+	cache->setSingleStep(256);
+	cache->setValue(qRelightApp->imageCacheMB());
+	layout->addWidget(cache, 2, 1);
+
+	connect(cache, static_cast<void(QSpinBox::*)(int)>(&QSpinBox::valueChanged), [](int v) {
+		qRelightApp->setImageCacheMB(v);
+		ImageCache::instance().setBudget(size_t(v)<<20);
+	});
+
 	return widget;
 }
 
@@ -192,6 +192,8 @@ void ZoomOverview::update() {
 
 void ZoomOverview::showNormalmap(const QString &path) {
 	QPixmap pix(path);
+	if(pix.isNull()) //float tiff and exr go through the image decoder.
+		pix = QPixmap::fromImage(Project::readImage(path));
 	if(pix.isNull()) return;
 	item->setVisible(false);
 	setImage(pix);
@@ -5,7 +5,9 @@
 #include "mainwindow.h"
 #include "preferences.h"
 #include "convertdialog.h"
+#include "imagecache.h"
 #include "../src/network/httpserver.h"
+#include "../src/exif.h"
 
 #include <QMessageBox>
 #include <QFileDialog>
@@ -20,8 +22,13 @@
 #include <QGuiApplication>
 #include <QStyleHints>
 #include <QPalette>
+#include <QImageReader>
+#include <QBuffer>
+#include <QThreadPool>
 
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
 using namespace std;
 
 
@@ -200,6 +207,8 @@ void RelightApp::run() {
 		QIcon::setThemeName("light");
 	}
 
+	ImageCache::instance().setBudget(size_t(imageCacheMB())<<20);
+
 	mainwindow = new MainWindow;
 	mainwindow->showMaximized();
 }
@@ -262,8 +271,10 @@ void RelightApp::newProject() {
 		}
 		if(canrotate) {
 			int answer = QMessageBox::question(mainwindow, "Some images are rotated.", "Do you wish to uniform image rotation?", QMessageBox::Yes, QMessageBox::No);
-			if(answer != QMessageBox::No)
+			if(answer != QMessageBox::No) {
 				project->rotateImages();
+				ImageCache::instance().clear();
+			}
 		} else
 			QMessageBox::critical(mainwindow, "Resolution problem", "Not all of the images in the folder have the same resolution,\nyou might need to fix this problem manually.");
 	}
@@ -435,7 +446,9 @@ void RelightApp::loadThumbnails() {
 		Image &image = m_project->images[i];
 		if(i == 0) {
 
-			QImage img = m_project->readImage(i);
+			QImage img = ThumbailLoader::loadThumbnail(image.filename);
+			if(img.isNull())
+				img = m_project->readImage(i);
 			if(img.isNull()) {
 				img = QImage(256, 256, QImage::Format_ARGB32);
 				img.fill(Qt::black);
@@ -564,26 +577,62 @@ QAction *RelightApp::addAction(const QString &id, const QString &label, const QS
 	return a;
 }
 
-ThumbailLoader::ThumbailLoader(QStringList &images) {
+ThumbailLoader::ThumbailLoader(QStringList &images, int _start): start(_start) {
 	QDir current = QDir::current();
 	for(QString filename: images)
 		paths.push_back(current.absoluteFilePath(filename));
 }
 
+QImage ThumbailLoader::loadThumbnail(const QString &path, int height) {
+	//orientation is never applied: thumbnails must match the pixels of the images.
+	QImageReader reader(path);
+	reader.setAutoTransform(false);
+	QSize size = reader.size();
+
+	QImage img;
+	QByteArray preview = Exif::preview(path, height);
+	if(!preview.isEmpty() && size.isValid()) {
+		QBuffer buffer(&preview);
+		QImageReader preview_reader(&buffer);
+		preview_reader.setAutoTransform(false);
+		img = preview_reader.read();
+		//camera previews can be letterboxed, or not rotated with the image.
+		if(!img.isNull() && std::abs(img.width()*size.height() - img.height()*size.width()) > std::max(size.width(), size.height()))
+			img = QImage();
+	}
+
+	if(img.isNull()) {
+		//the jpeg plugin picks the largest 1/2, 1/4, 1/8 DCT scaling above the requested size.
+		if(size.isValid() && size.height() > height)
+			reader.setScaledSize(size.scaled(size.width(), height, Qt::KeepAspectRatio));
+		img = reader.read();
+	}
+	if(img.isNull())
+		return img;
+	if(img.height() != height)
+		img = img.scaledToHeight(height, Qt::SmoothTransformation);
+	return img;
+}
+
 void ThumbailLoader::run() {
-	int count = 1;
-	for(QString path: paths) {
-		if(stop_request)
-			break;
-		QImage img;
-		img.load(path, "JPG");
-		if(img.isNull()) //TODO shoudl actually warn!
-			break;
-		{
-			QMutexLocker lock(&qRelightApp->thumbails_lock);
-			qRelightApp->thumbnails()[count] = img.scaledToHeight(256);;
-		}
-		emit update(count);
-		count++;
+	QThreadPool pool;
+	pool.setMaxThreadCount(QThread::idealThreadCount());
+
+	for(int i = 0; i < paths.size(); i++) {
+		QString path = paths[i];
+		int pos = start + i;
+		pool.start([this, path, pos]() {
+			if(stop_request)
+				return;
+			QImage img = loadThumbnail(path);
+			if(img.isNull()) //TODO should actually warn!
+				return;
+			{
+				QMutexLocker lock(&qRelightApp->thumbails_lock);
+				qRelightApp->thumbnails()[pos] = img;
+			}
+			emit update(pos);
+		});
 	}
+	pool.waitForDone();
 }
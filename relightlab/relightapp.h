@@ -13,6 +13,7 @@
 #include <QMutex>
 
 #include <set>
+#include <atomic>
 
 
 #define qRelightApp (static_cast<RelightApp *>(QCoreApplication::instance()))
@@ -38,8 +39,13 @@ public slots:
 class ThumbailLoader: public QThread {
 	Q_OBJECT
 public:
-	ThumbailLoader(QStringList &images);
+	//images[i] is published as thumbnail start + i
+	ThumbailLoader(QStringList &images, int start = 1);
 	void stop() { stop_request = true; }
+
+	//embedded preview if large enough, otherwise jpeg scaled (DCT domain) decoding.
+	static QImage loadThumbnail(const QString &path, int height = 256);
+
 signals:
 	void update(int); //something has been loaded.
 
@@ -47,7 +53,8 @@ protected:
 	virtual void run();
 
 	QStringList paths;
-	bool stop_request = false;
+	int start = 1;
+	std::atomic<bool> stop_request{false};
 };
 
 class RelightApp: public QApplication {
@@ -137,6 +144,13 @@ public:
 		QSettings().setValue("SamplingRam", mb);
 	}
 
+	int imageCacheMB() {
+		return QSettings().value("ImageCacheMB", 1024).toInt();
+	}
+	void setImageCacheMB(int mb) {
+		QSettings().setValue("ImageCacheMB", mb);
+	}
+
 	int castingPort() {
 		return QSettings().value("CastingPort", 8880).toInt();
 	}
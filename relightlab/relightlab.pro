@@ -69,6 +69,7 @@ SOURCES += main.cpp \
     ../src/rti/rtitask.cpp \
     ../src/crop.cpp \
     ../src/align.cpp \
+    ../src/phasecorrelation.cpp \
     ../src/dome.cpp \
     ../src/exif.cpp \
     ../src/lp.cpp \
@@ -77,6 +78,7 @@ SOURCES += main.cpp \
     ../src/colorprofile.cpp \
     ../src/jpeg_decoder.cpp \
     ../src/image_decoder.cpp \
+    ../src/image_encoder.cpp \
     ../src/tiff_decoder.cpp \
     ../src/png_decoder.cpp \
     ../src/exr_decoder.cpp \
@@ -101,6 +103,7 @@ SOURCES += main.cpp \
     canvas.cpp \
     domepanel.cpp \
     imageview.cpp \
+    imagecache.cpp \
     lightgeometry.cpp \
     mainwindow.cpp \
     markerdialog.cpp \
@@ -164,6 +167,7 @@ HEADERS += \
     imagecropper.h \
     processqueue.h \
     ../src/align.h \
+    ../src/phasecorrelation.h \
     ../src/dome.h \
     ../src/exif.h \
     ../src/image.h \
@@ -171,6 +175,7 @@ HEADERS += \
     ../src/colorprofile.h \
     ../src/jpeg_decoder.h \
     ../src/image_decoder.h \
+    ../src/image_encoder.h \
     ../src/tiff_decoder.h \
     ../src/png_decoder.h \
     ../src/exr_decoder.h \
@@ -188,6 +193,7 @@ HEADERS += \
     alignrow.h \
     canvas.h \
     imageview.h \
+    imagecache.h \
     lightgeometry.h \
     mainwindow.h \
     mainwindow.h \
@@ -1,5 +1,6 @@
 #include "verifydialog.h"
 #include "../src/sphere.h"
+#include "../src/phasecorrelation.h"
 #include "flowlayout.h"
 #include "relightapp.h"
 #include "verifyview.h"
@@ -32,12 +33,10 @@ VerifyDialog::VerifyDialog(std::vector<QImage> &_thumbs, std::vector<QPointF> &_
 		operations_layout->addWidget(reset);
 		connect(reset, SIGNAL(clicked()), this, SLOT(resetAligns()));
 
-#ifdef WITH_OPENCV
 		QPushButton *ecc = new QPushButton("Align");
 		operations_layout->addWidget(ecc);
 
 		connect(ecc, SIGNAL(clicked()), this, SLOT(alignSamples()));
-#endif
 	}
 	QScrollArea *area = new QScrollArea(this);
 	layout->addWidget(area);
@@ -83,13 +82,18 @@ cv::Mat qimg2mat(QImage img) {
 #endif
 
 void VerifyDialog::alignSamples() {
-	#ifdef WITH_OPENCV
 	if (positions.empty()) return;
 
+	positions = PhaseCorrelation::align(thumbs);
+
+#ifdef WITH_OPENCV
+	//refine starting from the phase correlation estimate.
 	cv::Mat ref = qimg2mat(thumbs[0]);
 
 	for (size_t i = 1; i < thumbs.size(); i++) {
 		cv::Mat warpMat = cv::Mat::eye(2, 3, CV_32F);
+		warpMat.at<float>(0, 2) = positions[i].x();
+		warpMat.at<float>(1, 2) = positions[i].y();
 
 		try {
 			cv::findTransformECC(ref, qimg2mat(thumbs[i]), warpMat, cv::MOTION_TRANSLATION);
@@ -97,11 +101,10 @@ void VerifyDialog::alignSamples() {
 			positions[i] = QPointF(warpMat.at<float>(0, 2), warpMat.at<float>(1, 2));
 		} catch(cv::Exception &e) {
 			cerr << e.msg << endl;
-			positions[i] = QPointF(0.0f, 0.0f);
 		}
 	}
-	update();
 #endif
+	update();
 }
 
 void VerifyDialog::update() {
@@ -292,3 +292,26 @@ void itarZoom(const QString& inputFolder, const QString& output, std::function<b
         delete file;
     }
 }
+
+PlanePyramids::PlanePyramids(QString output, int nplanes, int width, int height, uint32_t quality,
+                             uint32_t tileSize, uint32_t overlap, PyramidFormat format) {
+    for(int plane = 0; plane < nplanes; plane++) {
+        DeepZoom *dz = new DeepZoom;
+        planes.emplace_back(dz);
+        dz->quality = quality;
+        if(!dz->begin(QString("%1/plane_%2").arg(output).arg(plane), width, height, tileSize, overlap, format))
+            throw QString("Failed to create the pyramid for plane %1").arg(plane);
+    }
+}
+
+void PlanePyramids::addLine(uint32_t plane, std::vector<uint8_t> &row) {
+    planes[plane]->addLine(row);
+}
+
+void PlanePyramids::finish() {
+    for(size_t plane = 0; plane < planes.size(); plane++) {
+        if(!planes[plane]->end())
+            throw QString("Failed to build the pyramid for plane %1").arg(plane);
+    }
+    planes.clear();
+}
@@ -18,6 +18,8 @@
 #include <QRegularExpression>
 #include "../src/deepzoom.h"
 #include <deque>
+#include <memory>
+#include <vector>
 
 typedef struct _ZoomData
 {
@@ -97,4 +99,17 @@ void tarZoom(QString inputFolder, QString output, std::function<bool(QString s,
 
 void itarZoom(const QString& inputFolder, const QString& output, std::function<bool(QString s, int n)> progressed);
 
+// Builds the pyramids of the planes (output/plane_N) while the rows are produced top to bottom
+// (see RtiBuilder::plane_output): the plane jpegs are never written and read back.
+class PlanePyramids {
+public:
+    PlanePyramids(QString output, int nplanes, int width, int height, uint32_t quality,
+                  uint32_t tileSize, uint32_t overlap, PyramidFormat format);
+    void addLine(uint32_t plane, std::vector<uint8_t> &row);
+    void finish();
+
+private:
+    std::vector<std::unique_ptr<DeepZoom>> planes;
+};
+
 #endif // ZOOM_H
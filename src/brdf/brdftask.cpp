@@ -69,23 +69,22 @@ void BrdfTask::run() {
 
 		vector<uint8_t> albedomap(width * height * 3);
 		RelightThreadPool pool;
-		PixelArray line;
 		imageset.setCallback(nullptr);
 		pool.start(QThread::idealThreadCount());
 		for (int i = 0; i < imageset.height; i++) {
-			// Read a line
-			imageset.readLine(line);
+			// Only decode here, color conversion runs in the worker
+			std::vector<uint8_t> raw;
+			int y = imageset.readRawLine(raw);
 
 			// Create the normal task and get the run lambda
 			uint32_t idx = i * 3 * imageset.width;
 			uint8_t* data = &albedomap[idx];
 
-			AlbedoWorker *task = new AlbedoWorker(parameters, i, line,
-			                                      imageset.output_color_transform_float, data, imageset, lens);
-
-			std::function<void(void)> run = [this, task](void)->void {
-				task->run();
-				delete task;
+			std::function<void(void)> run = [this, raw = std::move(raw), y, i, data](void)->void {
+				PixelArray line;
+				imageset.convertLine(raw, y, line);
+				AlbedoWorker task(parameters, i, line, imageset.output_color_transform_float, data, imageset, lens);
+				task.run();
 			};
 
 			// Launch the task
@@ -42,6 +42,9 @@ public:
 	void run() {
 		int nth = (m_Row.nlights-1) * parameters.median_percentage / 100;
 		assert(nth >= 0 && nth < m_Row.nlights);
+		std::vector<float> row01;
+		if(output_color_transform_float)
+			row01.resize(m_Row.size()*3);
 		for(size_t i = 0; i < m_Row.size(); i++) {
 			Pixel &p = m_Row[i];
 			float rgb[3] = {0.0f, 0.0f, 0.0f};
@@ -62,17 +65,15 @@ public:
 			}
 
 			if(output_color_transform_float) {
-				float norm[3] = {
-					std::max(0.0f, std::min(1.0f, rgb[0] / 255.0f)),
-					std::max(0.0f, std::min(1.0f, rgb[1] / 255.0f)),
-					std::max(0.0f, std::min(1.0f, rgb[2] / 255.0f))
-				};
-				cmsDoTransform(output_color_transform_float, norm, &albedo_out[i*3], 1);
+				for(int k = 0; k < 3; k++)
+					row01[i*3 + k] = std::max(0.0f, std::min(1.0f, rgb[k] / 255.0f));
 			} else {
 				for(int k = 0; k < 3; k++)
 					albedo_out[i*3 + k] = (uint8_t)std::min(std::max(int(rgb[k]), 0), 255);
 			}
 		}
+		if(output_color_transform_float)
+			cmsDoTransform(output_color_transform_float, row01.data(), albedo_out, m_Row.size());
 	}
 
 private:
@@ -15,7 +15,8 @@ using namespace std;
 
 int convertRTI(const char *file, const char *output, int quality) {
 	LRti lrti;
-	if(!lrti.load(file)) {
+	//raw coefficients are not loaded in memory, they are streamed from the mapped file in encodeJPEGPlanes.
+	if(!lrti.open(file)) {
 		throw QString("Failed loading file %1: %2").arg(file).arg(lrti.error.c_str());
 	}
 
@@ -79,9 +80,11 @@ int convertRTI(const char *file, const char *output, int quality) {
 	}
 
 	rti.saveJSON(dir, quality, "");
-	for(uint32_t p = 0; p < rti.nplanes; p += 3) {
-		lrti.encodeJPEGtoFile(p, quality, dir.filePath("plane_%1.jpg").arg(p/3).toStdString().c_str());
-	}
+	std::vector<std::string> planes;
+	for(uint32_t p = 0; p < rti.nplanes; p += 3)
+		planes.push_back(dir.filePath("plane_%1.jpg").arg(p/3).toStdString());
+	if(!lrti.encodeJPEGPlanes(planes, quality))
+		throw QString("Failed converting file %1: %2").arg(file).arg(lrti.error.c_str());
 	return 0;
 }
 
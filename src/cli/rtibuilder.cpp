@@ -8,6 +8,10 @@
 
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QTemporaryDir>
 #include <QStringList>
 #include <QTextStream>
 #include <QImage>
@@ -18,11 +22,18 @@
 #include <QtConcurrent/QtConcurrent>
 #include <QFuture>
 #include <QRegularExpression>
+#include <QCryptographicHash>
 
 #include <Eigen/Core>
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <limits>
 #include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <iostream>
 
 #include <assert.h>
@@ -156,6 +167,9 @@ void RtiBuilder::savePixel(Color3f *p, int side, const QString &file) {
 }
 */
 
+//workers give up waiting for the base of the coordinator after this.
+static const int coordinator_timeout = 3600; //seconds
+
 bool RtiBuilder::init(std::function<bool(QString stage, int percent)> *_callback) {
 
 	if(imageset.lights1.size() != size_t(imageset.images.size()))
@@ -198,6 +212,32 @@ bool RtiBuilder::init(std::function<bool(QString stage, int percent)> *_callback
 	imageset.setCallback(callback);
 
 	try {
+		QString basis_file, key;
+		if(!checkpoint.empty()) {
+			QDir().mkpath(checkpoint.c_str());
+			basis_file = QDir(checkpoint.c_str()).filePath("basis.bin");
+			key = checkpointKey();
+			if(loadBasis(basis_file, key))
+				return true;
+			//workers use the base of the coordinator, which might still be sampling the images.
+			bool mismatch = false;
+			for(int wait = 0; role == WORKER; wait++) {
+				if(callback && !(*callback)("Waiting for the coordinator:", wait % 100))
+					throw QString("Cancelled.");
+				if(!mismatch && QFile::exists(basis_file)) {
+					mismatch = true;
+					cerr << "The base in " << qPrintable(basis_file) << " was fitted with other images or parameters, waiting for the coordinator." << endl;
+				}
+				if(wait*500 >= coordinator_timeout*1000) {
+					error = mismatch ? "The coordinator runs with different images or parameters."
+									 : "No base from the coordinator, is it running with -G and the same -K?";
+					return false;
+				}
+				QThread::msleep(500);
+				if(loadBasis(basis_file, key))
+					return true;
+			}
+		}
 		//we don't actually need to store the samples, we can just add to (resample) add to PCA, or use to compute material.
 		//collect a set of samples resampled
 		PixelArray resample;
@@ -205,6 +245,15 @@ bool RtiBuilder::init(std::function<bool(QString stage, int percent)> *_callback
 		nsamples = resample.npixels();
 
 		pickBases(resample);
+
+		if(!checkpoint.empty() && !saveBasis(basis_file, key))
+			cerr << "Could not write checkpoint: " << qPrintable(basis_file) << endl;
+	} catch(QString &e) { //cancelled
+		error = e.toStdString();
+		return false;
+	} catch(std::string &e) {
+		error = e;
+		return false;
 	} catch(std::exception &e) {
 		error = "Could not create a base.";
 		return false;
@@ -510,14 +559,37 @@ void RtiBuilder::pickBases(PixelArray &sample) {
 		} else {
 			materialbuilders.resize(resample_width * resample_height);
 
+			//cells are independent, fit them in parallel.
+			vector<QFuture<void>> futures;
 			for(int y = 0; y < resample_height; y++) {
 				for(int x = 0; x < resample_width; x++) {
-					int pixel_x = imageset.width*x/(resample_width-1);
-					int pixel_y = imageset.height*y/(resample_height-1);
-					auto relights = relativeNormalizedLights(pixel_x, pixel_y);
-					materialbuilders[x + y*resample_width] = pickBase(sample, relights);
+					futures.push_back(QtConcurrent::run([this, &sample, x, y]() {
+						int pixel_x = imageset.width*x/(resample_width-1);
+						int pixel_y = imageset.height*y/(resample_height-1);
+						auto relights = relativeNormalizedLights(pixel_x, pixel_y);
+						MaterialBuilder &mat = materialbuilders[x + y*resample_width];
+						mat = pickBase(sample, relights);
+
+						//rank deficient: store the pseudo inverse so that cells can be blended.
+						if(mat.useEigen && colorspace != LRGB) {
+							uint32_t dim = ndimensions*3;
+							Eigen::MatrixXf pinv = mat.svd.solve(Eigen::MatrixXf::Identity(dim, dim));
+							mat.proj.resize(nplanes*dim);
+							for(uint32_t p = 0; p < nplanes; p++)
+								for(uint32_t k = 0; k < dim; k++)
+									mat.proj[k + p*dim] = pinv(p, k);
+							mat.svd = Eigen::JacobiSVD<Eigen::MatrixXf>();
+							mat.useEigen = false;
+						}
+					}));
 				}
 			}
+			for(auto &future: futures)
+				future.waitForFinished();
+
+			blend_bases = true;
+			for(MaterialBuilder &mat: materialbuilders)
+				blend_bases &= !mat.useEigen;
 		}
 	}
 	
@@ -551,6 +623,18 @@ MaterialBuilder RtiBuilder::pickBase(PixelArray &sample, std::vector<Vector3f> &
 	return builder;
 }
 
+//splits [0, n) in one range per thread and runs f(start, end, thread) on each, in parallel.
+static void parallelRanges(size_t n, int nthreads, std::function<void(size_t start, size_t end, int thread)> f) {
+	vector<QFuture<void>> futures;
+	for(int t = 0; t < nthreads; t++) {
+		size_t start = n*t/nthreads;
+		size_t end = n*(t+1)/nthreads;
+		futures.push_back(QtConcurrent::run([&f, start, end, t]() { f(start, end, t); }));
+	}
+	for(auto &future: futures)
+		future.waitForFinished();
+}
+
 //PTM or HSH with bad light distribution can over (or under) estimate.
 //we cane work on the histogram.
 //actually we could also work in post production (it's the same!).
@@ -561,21 +645,29 @@ void RtiBuilder::normalizeHistogram(PixelArray &sample, double percentile) {
 	for(int i = 0; i < 3; i++)
 		histogram[i].resize(side*3, 0);
 
-	for(uint32_t i = 0; i < sample.npixels(); i++) {
-		if(callback && (i % 8000) == 0)
-			if(!(*callback)("Histogram normalization:", 100*i/sample.npixels()))
-				throw QString("Cancelled.");
+	if(callback && !(*callback)("Histogram normalization:", 0))
+		throw QString("Cancelled.");
 
-		vector<float> principal = toPrincipal(sample[i]);
+	int nthreads = std::max(1, QThread::idealThreadCount());
+	vector<vector<int>> partial(nthreads, vector<int>(side*3, 0));
+	parallelRanges(sample.npixels(), nthreads, [&](size_t start, size_t end, int t) {
+		vector<int> &h = partial[t];
+		vector<float> principal(nplanes), tmp(nplanes);
+		for(size_t i = start; i < end; i++) {
+			toPrincipal(sample[i], principal.data(), tmp.data());
 
-		//check for top light: [1, 0....0]
-		for(int c = 0; c < 3; c++) {
+			//check for top light: [1, 0....0]
 			float value = 1.0f*principal[0]/255.0f;
 			int bin = (int)round((value/step)) + side;
 			bin = max(0, min( side*3-1, bin));
-			histogram[c][bin]++;
+			h[bin]++;
 		}
-	}
+	});
+	for(int c = 0; c < 3; c++)
+		for(auto &h: partial)
+			for(int i = 0; i < side*3; i++)
+				histogram[c][i] += h[i];
+
 	//find top percentile value
 	int tot[3] = { 0, 0, 0 };
 	int top = 0;
@@ -628,61 +720,125 @@ void RtiBuilder::minmaxMaterial(PixelArray &sample) {
 		normalizeHistogram(sample, 0.95);
 	}
 
-	// Build histograms for each plane using quantile-based approach
-	// This clamps outliers and improves resolution for the vast majority of the image
-	std::vector<std::vector<float>> values(nplanes);
-	
-	// Reserve space upfront to avoid reallocations during push_back
-	for(uint32_t p = 0; p < nplanes; p++) {
-		values[p].reserve(sample.npixels());
-	}
-	
-	// Collect all coefficient values from sampled pixels
-	for(uint32_t i = 0; i < sample.npixels(); i++) {
-		if(callback && ((i % 8000) == 0)) {
-			if(!(*callback)("Computing histogram quantiles:", 50*i/sample.npixels()))
-				throw QString("Cancelled.");
-		}
-
-		vector<float> principal = toPrincipal(sample[i]);
+	// Quantile-based min/max for each plane, clamps outliers and improves resolution for the vast majority of the image.
+	// The samples are projected once (nplanes floats each, a fraction of the samples themselves) together with
+	// the exact range of each plane, then a histogram over it and a second one restricted to the bins holding
+	// the quantiles, so that a few outliers stretching the range do not squeeze all the data in a handful of bins.
+	int nthreads = std::max(1, QThread::idealThreadCount());
+	size_t n = sample.npixels();
+	if(n == 0)
+		return;
 
-		//collect values for each plane
+	vector<float> projected(n*nplanes);
+	vector<vector<float>> lows(nthreads, vector<float>(nplanes, std::numeric_limits<float>::max()));
+	vector<vector<float>> highs(nthreads, vector<float>(nplanes, -std::numeric_limits<float>::max()));
+	parallelRanges(n, nthreads, [&](size_t start, size_t end, int t) {
+		vector<float> &low = lows[t];
+		vector<float> &high = highs[t];
+		vector<float> tmp(nplanes);
+		for(size_t i = start; i < end; i++) {
+			float *principal = &projected[i*nplanes];
+			toPrincipal(sample[i], principal, tmp.data());
+			for(uint32_t p = 0; p < nplanes; p++) {
+				low[p] = std::min(low[p], principal[p]);
+				high[p] = std::max(high[p], principal[p]);
+			}
+		}
+	});
+	vector<float> low = lows[0], high = highs[0];
+	for(int t = 1; t < nthreads; t++) {
 		for(uint32_t p = 0; p < nplanes; p++) {
-			values[p].push_back(principal[p]);
+			low[p] = std::min(low[p], lows[t][p]);
+			high[p] = std::max(high[p], highs[t][p]);
 		}
 	}
 
-	// Compute quantile-based min/max for each plane
+	if(callback && !(*callback)("Computing histogram quantiles:", 30))
+		throw QString("Cancelled.");
+
+	// Bins of each plane: [0] below from, [1, nbins] the range [from, to), [nbins+1] above.
+	const int nbins = 1<<12;
+	const int stride = nbins + 2;
+	vector<float> from = low, to = high;
+	vector<float> binsize(nplanes);
+	vector<uint32_t> histogram;
+	auto fillHistogram = [&]() {
+		for(uint32_t p = 0; p < nplanes; p++)
+			binsize[p] = std::max(to[p] - from[p], 1e-6f)/nbins;
+		vector<vector<uint32_t>> histograms(nthreads, vector<uint32_t>(nplanes*stride, 0));
+		parallelRanges(n, nthreads, [&](size_t start, size_t end, int t) {
+			vector<uint32_t> &h = histograms[t];
+			for(size_t i = start; i < end; i++) {
+				const float *principal = &projected[i*nplanes];
+				for(uint32_t p = 0; p < nplanes; p++) {
+					float v = (principal[p] - from[p])/binsize[p];
+					int bin = v < 0.0f ? 0 : (v >= nbins ? (principal[p] > to[p] ? nbins + 1 : nbins) : int(v) + 1);
+					h[p*stride + bin]++;
+				}
+			}
+		});
+		histogram.swap(histograms[0]);
+		for(int t = 1; t < nthreads; t++)
+			for(size_t i = 0; i < histogram.size(); i++)
+				histogram[i] += histograms[t][i];
+	};
+	// Bin holding the k-th smallest sample, count is the number of samples before it.
+	auto locate = [&](uint32_t p, size_t k, size_t &count) -> int {
+		const uint32_t *h = &histogram[p*stride];
+		count = 0;
+		for(int b = 0; b < stride; b++) {
+			if(count + h[b] > k)
+				return b;
+			count += h[b];
+		}
+		return stride - 1;
+	};
+	// Value of the k-th smallest sample, interpolated inside its bin.
+	auto quantile = [&](uint32_t p, size_t k) -> float {
+		size_t count = 0;
+		int b = locate(p, k, count);
+		if(b == 0)
+			return from[p];
+		if(b == stride - 1)
+			return to[p];
+		return from[p] + binsize[p]*(b - 1 + (k - count + 0.5f)/histogram[p*stride + b]);
+	};
+
+	// Compute quantile indices
+	size_t lowIdx = (size_t)((1.0 - rangeQuantile) / 2.0 * n);
+	size_t highIdx = (size_t)((1.0 + rangeQuantile) / 2.0 * n);
+	lowIdx = std::min(lowIdx, n - 1);
+	highIdx = std::min(highIdx, n - 1);
+
+	fillHistogram();
 	for(uint32_t p = 0; p < nplanes; p++) {
-		if(callback && ((p % 3) == 0)) {
-			if(!(*callback)("Computing histogram quantiles:", 50 + 50*p/nplanes))
-				throw QString("Cancelled.");
-		}
+		size_t count = 0;
+		int first = std::max(1, locate(p, lowIdx, count));
+		int last = std::min(nbins, locate(p, highIdx, count));
+		float start = from[p] + binsize[p]*(first - 1);
+		to[p] = std::min(high[p], from[p] + binsize[p]*last);
+		from[p] = start;
+	}
+
+	if(callback && !(*callback)("Computing histogram quantiles:", 60))
+		throw QString("Cancelled.");
 
+	fillHistogram();
+	for(uint32_t p = 0; p < nplanes; p++) {
 		Material::Plane &plane = material.planes[p];
-		
-		size_t n = values[p].size();
-		if(n == 0)
-			continue;
-			
-		// Compute quantile indices
-		size_t lowIdx = (size_t)((1.0 - rangeQuantile) / 2.0 * n);
-		size_t highIdx = (size_t)((1.0 + rangeQuantile) / 2.0 * n);
-		lowIdx = std::min(lowIdx, n - 1);
-		highIdx = std::min(highIdx, n - 1);
-		
-		std::nth_element(values[p].begin(), values[p].begin() + lowIdx, values[p].end());
-		plane.min = values[p][lowIdx];
-		
-		std::nth_element(values[p].begin() + lowIdx, values[p].begin() + highIdx, values[p].end());
-		plane.max = values[p][highIdx];
-		
+
+		plane.min = std::max(low[p], quantile(p, lowIdx));
+		plane.max = std::min(high[p], quantile(p, highIdx));
+
 		// Ensure we have a valid range
 		if(plane.max <= plane.min) {
 			plane.max = plane.min + 1e-6f;
 		}
 	}
 
+	if(callback && !(*callback)("Computing histogram quantiles:", 100))
+		throw QString("Cancelled.");
+
 	//compute common min max for 3 colors
 	if(commonMinMax && colorspace == RGB) {
 		auto &planes = material.planes;
@@ -719,6 +875,159 @@ void RtiBuilder::finalizeMaterial() {
 }
 
 
+static const quint32 checkpoint_version = 1;
+
+QString RtiBuilder::checkpointKey() {
+	QString key;
+	QTextStream stream(&key);
+	stream << "type " << type << " colorspace " << colorspace << " planes " << nplanes
+		   << " ycc " << yccplanes[0] << " " << yccplanes[1] << " " << yccplanes[2]
+		   << " sigma " << sigma << " regularization " << regularization << " resolution " << resolution
+		   << " samplingram " << samplingram << " quantile " << rangeQuantile
+		   << " commonminmax " << commonMinMax << " histogramfix " << histogram_fix
+		   << " crop " << crop[0] << " " << crop[1] << " " << crop[2] << " " << crop[3]
+		   << " area " << imageset.left << " " << imageset.top << " " << imageset.width << " " << imageset.height << " " << imageset.angle
+		   << " light3d " << imageset.light3d << " profile " << colorProfileMode
+		   << " vignetting " << imageset.compensateVignettingEnabled << " intensity " << imageset.compensateIntensityEnabled
+		   << " icc " << QCryptographicHash::hash(QByteArray((const char *)imageset.icc_profile_data.data(), int(imageset.icc_profile_data.size())),
+												  QCryptographicHash::Sha1).toHex() << "\n";
+
+	//initImages sets the path: size and date detect rewritten images.
+	assert(!imageset.path.isEmpty());
+	QDir dir(imageset.path);
+	for(size_t i = 0; i < imageset.size(); i++) {
+		QFileInfo info(dir.filePath(imageset.images[int(i)]));
+		Vector3f &light = imageset.lights()[i];
+		stream << imageset.images[int(i)] << " " << info.size() << " " << info.lastModified().toSecsSinceEpoch()
+			   << " " << light[0] << " " << light[1] << " " << light[2];
+		if(i < imageset.offsets.size())
+			stream << " " << imageset.offsets[i].x() << " " << imageset.offsets[i].y();
+		if(i < imageset.subpixel.size())
+			stream << " " << imageset.subpixel[i].x() << " " << imageset.subpixel[i].y();
+		stream << "\n";
+	}
+	stream.flush();
+	return key;
+}
+
+static void writeFloats(QDataStream &stream, const std::vector<float> &v) {
+	stream << quint32(v.size());
+	for(float f: v)
+		stream << f;
+}
+
+static void readFloats(QDataStream &stream, std::vector<float> &v) {
+	quint32 n = 0;
+	stream >> n;
+	if(stream.status() != QDataStream::Ok)
+		return;
+	v.resize(n);
+	for(float &f: v)
+		stream >> f;
+}
+
+static void writeMaterialBuilder(QDataStream &stream, const MaterialBuilder &mat) {
+	stream << mat.useEigen;
+	if(mat.useEigen) {
+		//the decomposition can't be serialized, store the matrix and decompose it again.
+		Eigen::MatrixXf A = mat.svd.matrixU()*mat.svd.singularValues().asDiagonal()*mat.svd.matrixV().transpose();
+		stream << quint32(A.rows()) << quint32(A.cols());
+		for(Eigen::Index i = 0; i < A.size(); i++)
+			stream << A.data()[i];
+	}
+	writeFloats(stream, mat.proj);
+	writeFloats(stream, mat.mean);
+}
+
+static void readMaterialBuilder(QDataStream &stream, MaterialBuilder &mat) {
+	stream >> mat.useEigen;
+	if(mat.useEigen) {
+		quint32 rows = 0, cols = 0;
+		stream >> rows >> cols;
+		if(stream.status() != QDataStream::Ok)
+			return;
+		Eigen::MatrixXf A(rows, cols);
+		for(Eigen::Index i = 0; i < A.size(); i++)
+			stream >> A.data()[i];
+		mat.svd.compute(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
+	}
+	readFloats(stream, mat.proj);
+	readFloats(stream, mat.mean);
+}
+
+bool RtiBuilder::saveBasis(const QString &filename, const QString &key) {
+	//written aside and renamed: an interrupted write never leaves a truncated basis.
+	QFile file(filename + ".tmp");
+	if(!file.open(QFile::WriteOnly))
+		return false;
+
+	QDataStream stream(&file);
+	stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+	stream << checkpoint_version << key << quint32(nsamples) << blend_bases;
+	writeMaterialBuilder(stream, materialbuilder);
+	stream << quint32(materialbuilders.size());
+	for(MaterialBuilder &mat: materialbuilders)
+		writeMaterialBuilder(stream, mat);
+	stream << quint32(material.planes.size());
+	for(Material::Plane &plane: material.planes)
+		stream << plane.range << plane.min << plane.max << plane.scale << plane.bias;
+	file.close();
+
+	if(stream.status() != QDataStream::Ok || file.error() != QFile::NoError) {
+		file.remove();
+		return false;
+	}
+	QFile::remove(filename);
+	return QFile::rename(filename + ".tmp", filename);
+}
+
+bool RtiBuilder::loadBasis(const QString &filename, const QString &key) {
+	QFile file(filename);
+	if(!file.open(QFile::ReadOnly))
+		return false;
+
+	QDataStream stream(&file);
+	stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+	quint32 version = 0;
+	QString stored_key;
+	stream >> version;
+	if(version != checkpoint_version)
+		return false;
+	stream >> stored_key;
+	if(stored_key != key)
+		return false;
+
+	quint32 samples = 0, n = 0;
+	bool blend = false;
+	MaterialBuilder base;
+	std::vector<MaterialBuilder> bases;
+	Material mat;
+
+	stream >> samples >> blend;
+	readMaterialBuilder(stream, base);
+	stream >> n;
+	if(stream.status() != QDataStream::Ok)
+		return false;
+	bases.resize(n);
+	for(MaterialBuilder &b: bases)
+		readMaterialBuilder(stream, b);
+	stream >> n;
+	if(stream.status() != QDataStream::Ok || n != nplanes)
+		return false;
+	mat.planes.resize(n);
+	for(Material::Plane &plane: mat.planes)
+		stream >> plane.range >> plane.min >> plane.max >> plane.scale >> plane.bias;
+	if(stream.status() != QDataStream::Ok)
+		return false;
+
+	nsamples = samples;
+	blend_bases = blend;
+	materialbuilder = base;
+	materialbuilders = bases;
+	material = mat;
+	return true;
+}
+
 void RtiBuilder::estimateError(PixelArray &sample, std::vector<float> &weights) {
 	weights.clear();
 	weights.resize(sample.npixels(), 0.0f);
@@ -1009,6 +1318,9 @@ public:
 	vector<uchar> medians;
 	PixelArray sample;
 	PixelArray resample;
+	LineBuffers buffers;
+	std::vector<uint8_t> raw; //undecoded row of all images, color conversion happens in run()
+	int raw_line = 0;
 	
 	Worker(RtiBuilder &_builder): b(_builder) {
 		uint32_t njpegs = (b.nplanes-1)/3 + 1;
@@ -1023,12 +1335,404 @@ public:
 
 		//setAutodelete(false);
 	}
+	~Worker() { stop(); }
 
 	void run() {
-		b.processLine(sample, resample, line, normals, means, medians, output_color_transform_float);
-	}
+		b.imageset.convertLine(raw, raw_line, sample);
+		b.processLine(sample, resample, line, normals, means, medians, buffers, output_color_transform_float);
+	}
+
+	//ring mode: a thread of its own waits for rows, handing one over allocates nothing.
+	void start() {
+		thread = std::thread([this]() {
+			std::unique_lock<std::mutex> lock(mutex);
+			while(true) {
+				cond.wait(lock, [this]() { return busy || quit; });
+				if(!busy)
+					return;
+				lock.unlock();
+				run();
+				lock.lock();
+				busy = false;
+				cond.notify_all();
+			}
+		});
+	}
+	void submit() {
+		std::lock_guard<std::mutex> lock(mutex);
+		busy = true;
+		cond.notify_all();
+	}
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [this]() { return !busy; });
+	}
+	void stop() {
+		if(!thread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		cond.notify_all();
+		thread.join();
+	}
+
+private:
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool busy = false;
+	bool quit = false;
 };
 
+bool RtiBuilder::processRows(cmsHTRANSFORM output_color_transform_float, std::function<bool(uint32_t row, Worker &worker)> output, uint32_t start) {
+	if(!nworkers)
+		nworkers = QThread::idealThreadCount();
+
+	//ring of workers: row y is fitted by workers[y % ring], at most ring rows in flight.
+	uint32_t ring = std::max<uint32_t>(1, std::min<uint32_t>(nworkers, height));
+	vector<std::unique_ptr<Worker>> workers(ring);
+	for(auto &worker: workers) {
+		worker.reset(new Worker(*this));
+		worker->output_color_transform_float = output_color_transform_float;
+		worker->start();
+	}
+
+	bool completed = true;
+	//rows already done still need to be decoded, the jpegs are sequential.
+	for(uint32_t y = 0; y < start && completed; y++) {
+		imageset.readRawLine(workers[0]->raw);
+		if(callback && !(*callback)("Resuming:", 100*(y+1)/start))
+			completed = false;
+	}
+	for(uint32_t y = start; y < height + ring && completed; y++) {
+		if(callback && y > start) {
+			bool keep_going = (*callback)("Saving:", 100*(y)/(height + ring-1));
+			if(!keep_going) {
+				completed = false;
+				break;
+			}
+		}
+		Worker *worker = workers[y % ring].get();
+		if(y >= start + ring) {
+			worker->wait();
+			if(!output(y - ring, *worker)) {
+				completed = false;
+				break;
+			}
+		}
+
+		if(y < height) {
+			worker->raw_line = imageset.readRawLine(worker->raw);
+			worker->submit();
+		}
+	}
+	//the destructors wait for the rows still in flight.
+	workers.clear();
+	return completed;
+}
+
+//strip claims older than this belong to a process that died.
+static const int claim_timeout = 120; //seconds
+
+QString RtiBuilder::stripsKey() {
+	return checkpointKey() + QString("strips %1 %2 %3 %4 %5\n").arg(checkpoint_rows)
+			.arg(int(savenormals)).arg(int(savemeans)).arg(int(savemedians)).arg(int(imageset.output_color_transform_float != nullptr));
+}
+
+size_t RtiBuilder::stripRowSize() {
+	uint32_t njpegs = (nplanes-1)/3 + 1;
+	return size_t(width)*3*(njpegs + savenormals + savemeans + savemedians);
+}
+
+void RtiBuilder::storeRow(QFile &strip, Worker &worker) {
+	uint32_t row_bytes = width*3;
+	for(auto &p: worker.line)
+		strip.write((char *)p.data(), row_bytes);
+	if(savenormals) strip.write((char *)worker.normals.data(), row_bytes);
+	if(savemeans)   strip.write((char *)worker.means.data(), row_bytes);
+	if(savemedians) strip.write((char *)worker.medians.data(), row_bytes);
+}
+
+void RtiBuilder::prepareNormals() {
+	if (savenormals) {
+		//init matrix for light computation (bleargh, static in function)
+		vector<float> dummy(nplanes, 0.0f);
+		getNormalThreeLights(dummy);
+		if (colorspace != RGB && colorspace != MRGB) {
+			cerr << "NO NORMALS (unsupported colorspace: RGB and MRGB only supported!)" << endl;
+			savenormals = false;
+		}
+	}
+}
+
+uint32_t RtiBuilder::bandThreads(uint32_t band) {
+	if(!nworkers)
+		nworkers = QThread::idealThreadCount();
+	//the workers are split among the bands, the first ones take the remainder.
+	uint32_t threads = uint32_t(nworkers/nbands) + (band < nworkers % nbands ? 1 : 0);
+	return std::max<uint32_t>(1, threads);
+}
+
+bool RtiBuilder::fitStrips(QDir &folder, std::atomic<bool> &stop, std::atomic<uint32_t> &fitted, uint32_t threads) {
+	uint32_t nstrips = (height + checkpoint_rows - 1)/checkpoint_rows;
+	size_t strip_row = stripRowSize();
+	auto stripName = [&](uint32_t k) { return folder.filePath(QString("strip_%1.raw").arg(k)); };
+	auto claimName = [&](uint32_t k) { return folder.filePath(QString("strip_%1.claim").arg(k)); };
+	auto stripRows = [&](uint32_t k) { return std::min(checkpoint_rows, height - k*checkpoint_rows); };
+	auto isDone = [&](uint32_t k) { return QFileInfo(stripName(k)).size() == qint64(stripRows(k)*strip_row); };
+	auto isFree = [&](uint32_t k) { return !QFile::exists(claimName(k)) && !isDone(k); };
+
+	//the band decodes, a ring of workers fits its rows as in processRows.
+	uint32_t ring = std::max<uint32_t>(1, threads);
+	vector<std::unique_ptr<Worker>> workers(ring);
+	for(auto &worker: workers) {
+		worker.reset(new Worker(*this));
+		worker->output_color_transform_float = imageset.output_color_transform_float;
+		worker->start();
+	}
+
+	while(!stop) {
+		//start in the middle of the longest run of free strips (at its start if nobody is working before it),
+		//so that bands, also of other processes, spread over the image.
+		uint32_t best_start = 0, best_length = 0;
+		for(uint32_t k = 0; k < nstrips; ) {
+			if(!isFree(k)) {
+				k++;
+				continue;
+			}
+			uint32_t length = 0;
+			while(k + length < nstrips && isFree(k + length))
+				length++;
+			if(length > best_length) {
+				best_start = k;
+				best_length = length;
+			}
+			k += length;
+		}
+		if(best_length == 0)
+			return true;
+		uint32_t k = best_start;
+		if(best_start > 0 && QFile::exists(claimName(best_start-1)))
+			k += best_length/2;
+
+		//fit consecutive strips until one is taken by another band, the images are opened once the first is claimed.
+		ImageSet::Band band(imageset);
+		bool opened = false;
+		for(; k < nstrips && !stop; k++) {
+			QFile claim(claimName(k));
+			if(!isFree(k))
+				break;
+			if(!claim.open(QFile::WriteOnly | QFile::NewOnly)) {
+				if(!claim.exists()) //not taken by someone else: the folder is not writable.
+					return false;
+				break;
+			}
+			//completed since isFree.
+			if(isDone(k)) {
+				claim.close();
+				claim.remove();
+				break;
+			}
+			QFile strip(stripName(k) + ".tmp");
+			if((!opened && !band.open(k*checkpoint_rows)) || !strip.open(QFile::WriteOnly)) {
+				claim.close();
+				claim.remove();
+				return false;
+			}
+			opened = true;
+			band.skipLines(imageset.top + k*checkpoint_rows - band.line());
+
+			uint32_t rows = stripRows(k);
+			uint32_t submitted = 0;
+			for(uint32_t y = 0; y < rows + ring; y++) {
+				Worker *worker = workers[y % ring].get();
+				//rows in flight are collected also when stopping.
+				if(y >= ring && y - ring < submitted) {
+					worker->wait();
+					storeRow(strip, *worker);
+					fitted++;
+					//keeps the claim alive.
+					if((y - ring) % 16 == 0) {
+						claim.write(".");
+						claim.flush();
+					}
+				}
+				if(y < rows && !stop) {
+					worker->raw_line = band.readRawLine(worker->raw);
+					worker->submit();
+					submitted++;
+				}
+			}
+			strip.close();
+			claim.close();
+			if(stop) {
+				strip.remove();
+				claim.remove();
+				break;
+			}
+			QFile::remove(stripName(k));
+			bool ok = strip.error() == QFile::NoError && strip.rename(stripName(k));
+			claim.remove();
+			if(!ok)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool RtiBuilder::processBands(QDir &folder, std::function<void(QFile &strip, uint32_t start, uint32_t rows)> replay) {
+	uint32_t nstrips = (height + checkpoint_rows - 1)/checkpoint_rows;
+	size_t strip_row = stripRowSize();
+	auto stripName = [&](uint32_t k) { return folder.filePath(QString("strip_%1.raw").arg(k)); };
+	auto claimName = [&](uint32_t k) { return folder.filePath(QString("strip_%1.claim").arg(k)); };
+	auto stripRows = [&](uint32_t k) { return std::min(checkpoint_rows, height - k*checkpoint_rows); };
+	auto isReady = [&](uint32_t k) { return QFileInfo(stripName(k)).size() == qint64(stripRows(k)*strip_row); };
+
+	auto expireClaims = [&](int age) {
+		for(const QString &name: folder.entryList(QStringList() << "strip_*.claim", QDir::Files))
+			if(QFileInfo(folder.filePath(name)).lastModified().secsTo(QDateTime::currentDateTime()) >= age)
+				folder.remove(name);
+	};
+	//claims of an interrupted build are stale, unless worker processes are around.
+	expireClaims(role == COORDINATOR ? claim_timeout : 0);
+
+	uint32_t done_rows = 0;
+	for(uint32_t k = 0; k < nstrips; k++)
+		if(isReady(k))
+			done_rows += stripRows(k);
+
+	std::atomic<bool> stop(false);
+	std::atomic<uint32_t> fitted(0);
+	QThreadPool pool;
+	pool.setMaxThreadCount(nbands);
+	vector<QFuture<bool>> futures;
+	auto launch = [&]() {
+		futures.clear();
+		for(uint32_t b = 0; b < nbands; b++) {
+			uint32_t threads = bandThreads(b);
+			futures.push_back(QtConcurrent::run(&pool, [&, threads]() { return fitStrips(folder, stop, fitted, threads); }));
+		}
+	};
+	launch();
+
+	//strips are replayed in order as soon as they are ready, whoever fitted them.
+	bool failed = false;
+	uint32_t next = 0;
+	while(next < nstrips) {
+		if(isReady(next)) {
+			QFile strip(stripName(next));
+			if(!strip.open(QFile::ReadOnly)) {
+				failed = true;
+				break;
+			}
+			replay(strip, next*checkpoint_rows, stripRows(next));
+			strip.close();
+			if(checkpoint.empty()) {
+				//spooled strips are dropped once replayed, the claim (taken first) keeps the bands from fitting them again.
+				QFile claim(claimName(next));
+				if(!claim.open(QFile::WriteOnly | QFile::NewOnly) && !claim.exists()) {
+					failed = true;
+					break;
+				}
+				strip.remove();
+			}
+			next++;
+			continue;
+		}
+		bool running = false;
+		for(QFuture<bool> &future: futures) {
+			if(!future.isFinished())
+				running = true;
+			else if(!future.result())
+				failed = true;
+		}
+		if(failed)
+			break;
+		if(!running && !isReady(next)) {
+			QFileInfo claim(claimName(next));
+			if(!claim.exists()) {
+				//nobody is working on it: it should have been fitted.
+				failed = true;
+				break;
+			}
+			//a worker process died: take over its strips.
+			if(claim.lastModified().secsTo(QDateTime::currentDateTime()) >= claim_timeout) {
+				expireClaims(claim_timeout);
+				launch();
+			}
+		}
+		//strips of worker processes are counted when replayed.
+		uint32_t progress = std::min(height, std::max(next*checkpoint_rows, done_rows + fitted));
+		if(callback && !(*callback)("Saving:", 100*progress/height))
+			break;
+		QThread::msleep(20);
+	}
+	stop = true;
+	pool.waitForDone();
+
+	if(failed)
+		error = "Could not fit the bands.";
+	return next == nstrips;
+}
+
+bool RtiBuilder::work() {
+	if(checkpoint.empty()) {
+		error = "Workers need the checkpoint folder of the coordinator.";
+		return false;
+	}
+	prepareNormals();
+	QDir folder(checkpoint.c_str());
+	QString key = stripsKey();
+
+	//the coordinator writes the key once its strips can be fitted, and moves it to strips.done when finished.
+	//The base matched, so the coordinator is past init(): the key is due shortly.
+	for(int wait = 0; ; wait++) {
+		QFile key_file(folder.filePath("strips.key"));
+		bool found = key_file.open(QFile::ReadOnly);
+		if(found && QString::fromUtf8(key_file.readAll()) == key)
+			break;
+		QFile done_file(folder.filePath("strips.done"));
+		if(done_file.open(QFile::ReadOnly) && QString::fromUtf8(done_file.readAll()) == key)
+			return true;
+		if(wait*500 >= claim_timeout*1000) {
+			error = found ? "The strips of the coordinator differ: run it with the same -n, -m, -M options and output colorspace."
+						  : "The coordinator is not fitting strips, is it saving a relight or deepzoom output?";
+			return false;
+		}
+		if(callback && !(*callback)("Waiting for the coordinator:", wait % 100)) {
+			error = "Cancelled.";
+			return false;
+		}
+		QThread::msleep(500);
+	}
+
+	std::atomic<bool> stop(false);
+	std::atomic<uint32_t> fitted(0);
+	QThreadPool pool;
+	pool.setMaxThreadCount(nbands);
+	vector<QFuture<bool>> futures;
+	for(uint32_t b = 0; b < nbands; b++) {
+		uint32_t threads = bandThreads(b);
+		futures.push_back(QtConcurrent::run(&pool, [&, threads]() { return fitStrips(folder, stop, fitted, threads); }));
+	}
+
+	bool ok = true;
+	for(QFuture<bool> &future: futures) {
+		while(!future.isFinished()) {
+			if(callback && !(*callback)("Fitting strips:", 100*std::min(height, uint32_t(fitted))/height))
+				stop = true;
+			QThread::msleep(20);
+		}
+		ok &= future.result();
+	}
+	pool.waitForDone();
+	if(!ok)
+		error = "Could not fit the strips.";
+	return ok && !stop;
+}
+
 template <class C> std::ostringstream &join(std::vector<C> &v, std::ostringstream &stream, const char *separator = " ") {
 	for(size_t i = 0; i < v.size(); i++) {
 		stream << v[i];
@@ -1050,10 +1754,11 @@ size_t RtiBuilder::savePTM(const std::string &output) {
 		write_width = 8 * (width / 8);
 	}
 
-	FILE *file = fopen(output.c_str(), "wb");
-	if(!file) {
-		cerr << "Could not open file: " << output << endl;
-		return false;
+	//rgb rows are stored bottom up one color after the other, the file is written at the row offsets.
+	QFile file(output.c_str());
+	if(!file.open(QFile::WriteOnly)) {
+		error = "Could not open file: " + output;
+		return 0;
 	}
 
 	assert(this->type == RtiBuilder::PTM);
@@ -1104,118 +1809,122 @@ size_t RtiBuilder::savePTM(const std::string &output) {
 		// JPEG sizes will be written after encoding
 	}
 
-	fwrite(stream.str().data(), 1, stream.str().size(), file);
-
-
-	//second reading.
-	imageset.restart();
-
-	if(!nworkers)
-		nworkers = QThread::idealThreadCount();
-
-	vector<Worker *> workers(height, nullptr);
-	for(size_t i = 0; i < nworkers; i++) {
-		workers[i] = new Worker(*this);
-	}
-	vector<QFuture<void>> futures(height);
-
-	QThreadPool pool;
-	pool.setMaxThreadCount(nworkers);
-
-	// RGB: create buffer for direct writing
-	// LRGB: collect planes for JPEG encoding
-	vector<uint8_t> buffer;
-	vector<vector<uint8_t>> planes;
-	
-	if(colorspace == RGB) {
-		// RGB buffer: 3 color channels * width * height * 6 coefficients
-		buffer.resize(width * height * 6 * 3);
-	} else {
-		// LRGB: 9 planes (cropped width)
-		planes.resize(9);
-		for(auto &p: planes)
-			p.resize(write_width * height);
-	}
-
-	size_t component_size = width*height*6;
-	size_t line_size = width*6;
+	file.write(stream.str().data(), stream.str().size());
+	qint64 data_start = file.pos();
 
-	for(uint32_t y = 0; y < height + nworkers; y++) {
-		if(callback && y > 0) {
-			bool keep_going = (*callback)("Saving:", 100*(y)/(height + nworkers-1));
-			if(!keep_going) {
-				break;
+	//lrgb planes are jpeg encoded bottom up: rows are spooled to disk and encoded once all are available.
+	QTemporaryDir spool_dir;
+	vector<QFile *> spool;
+	if(colorspace == LRGB) {
+		if(!spool_dir.isValid()) {
+			error = "Could not create temporary folder.";
+			return 0;
+		}
+		for(int i = 0; i < 9; i++) {
+			spool.push_back(new QFile(spool_dir.filePath(QString("plane_%1.raw").arg(i))));
+			if(!spool.back()->open(QFile::ReadWrite)) {
+				error = "Could not create temporary file.";
+				for(QFile *f: spool)
+					delete f;
+				return 0;
 			}
 		}
-		if(y >= nworkers) {
-			futures[y - nworkers].waitForFinished();
-
-			Worker *doneworker = workers[y - nworkers];
-			uint32_t row = y - nworkers;
+	}
 
-			if(colorspace == RGB) {
-				int invorder[18] = { 5,11,17,  3,9,15,  4,10,16,  0,6,12,  2,8,14, 1,7,13 };
-				// RGB: write directly to buffer in correct order
-				// Data is organized: Red plane (all pixels, 6 coeff each), Green plane, Blue plane
+	//second reading.
+	imageset.restart();
 
-				int coeffRemap[6] = { 3, 5, 4, 1, 2, 0};
-				for(int c = 0; c < 3; c++) {
-					uint8_t *line = &buffer[component_size*c + line_size*(height - row-1)];
+	qint64 component_size = qint64(width)*height*6;
+	qint64 line_size = width*6;
+	vector<uint8_t> line(line_size);
+	vector<vector<uint8_t>> plane_lines(9, vector<uint8_t>(write_width));
 
-					for(uint32_t x = 0; x < width; x++) {
-						for(uint32_t j = 0; j < doneworker->line.size(); j++) { //these are 6 rgb
-							line[x*6 + j] = doneworker->line[coeffRemap[j]][x*3 + c];
-						}
-					}
-				}
-			} else {
-				int invorder[9] = {6,7,8, 5,3,4, 0,2,1};
-
-				// LRGB: 9 planes (RGB base + 6 luma coefficients) - crop to write_width
-				for(uint32_t x = 0; x < write_width; x++) {
-					uint32_t idx = x + (height - row - 1)*write_width;
-					// RGB base
-					for(int p = 0; p < 9; p++) {
-						int k = invorder[p];
-						int relight_jpeg = p/3;
-						int relight_component = p%3;
-						planes[k][idx] = doneworker->line[relight_jpeg][x*3 + relight_component];
+	bool completed = processRows(nullptr, [&](uint32_t row, Worker &doneworker) {
+		if(colorspace == RGB) {
+			// Data is organized: Red plane (all pixels, 6 coeff each), Green plane, Blue plane
+			int coeffRemap[6] = { 3, 5, 4, 1, 2, 0};
+			for(int c = 0; c < 3; c++) {
+				for(uint32_t x = 0; x < width; x++) {
+					for(uint32_t j = 0; j < doneworker.line.size(); j++) { //these are 6 rgb
+						line[x*6 + j] = doneworker.line[coeffRemap[j]][x*3 + c];
 					}
 				}
+				file.seek(data_start + component_size*c + line_size*(height - row - 1));
+				file.write((const char *)line.data(), line.size());
 			}
-
-			if(y < height)
-				workers[y] = doneworker;
-			else
-				delete doneworker;
-		}
-
-		if(y < height) {
-			Worker *worker = workers[y];
-			assert(worker != nullptr);
-			imageset.readLine(worker->sample);
-
-			futures[y] = QtConcurrent::run(&pool, [worker](){worker->run(); });
-		}
+		} else {
+			int invorder[9] = {6,7,8, 5,3,4, 0,2,1};
+
+			// LRGB: 9 planes (RGB base + 6 luma coefficients) - crop to write_width
+			for(int p = 0; p < 9; p++) {
+				int k = invorder[p];
+				int relight_jpeg = p/3;
+				int relight_component = p%3;
+				for(uint32_t x = 0; x < write_width; x++)
+					plane_lines[k][x] = doneworker.line[relight_jpeg][x*3 + relight_component];
+			}
+			for(int k = 0; k < 9; k++)
+				spool[k]->write((const char *)plane_lines[k].data(), write_width);
+		}
+		return true;
+	});
+	//a cancelled build would leave a truncated ptm with a valid header.
+	if(!completed) {
+		for(QFile *f: spool) {
+			f->remove();
+			delete f;
+		}
+		file.close();
+		file.remove();
+		error = "Cancelled.";
+		return 0;
 	}
 
-	// Write data to file
-	if(colorspace == RGB) {
-		// RGB: write buffer directly
-		fwrite(buffer.data(), 1, buffer.size(), file);
-	} else {
-		// LRGB: encode as JPEG - 9 grayscale images (using cropped width)
+	if(colorspace == LRGB) {
+		// LRGB: encode as JPEG - 9 grayscale images (using cropped width), one thread per plane
 		int quality = 95;
-		vector<uint8_t*> buffers(9, nullptr);
-		vector<int> sizes(9, 0);
-
-		// Encode each plane as a grayscale JPEG
+		vector<size_t> sizes(9, 0);
+		vector<QFuture<void>> encoded;
 		for(int i = 0; i < 9; i++) {
-			JpegEncoder enc;
-			enc.setQuality(quality);
-			enc.setColorSpace(JCS_GRAYSCALE, 1);
-			enc.setJpegColorSpace(JCS_GRAYSCALE);
-			enc.encode(planes[i].data(), write_width, height, buffers[i], sizes[i]);
+			encoded.push_back(QtConcurrent::run([&, i]() {
+				QFile *raw = spool[i];
+				raw->flush();
+				JpegEncoder enc;
+				enc.setQuality(quality);
+				enc.setColorSpace(JCS_GRAYSCALE, 1);
+				enc.setJpegColorSpace(JCS_GRAYSCALE);
+				if(!enc.init(spool_dir.filePath(QString("plane_%1.jpg").arg(i)).toStdString().c_str(), write_width, height))
+					return;
+
+				//the jpeg is flipped: rows are read back from the bottom, a band at a time.
+				const uint32_t band = 64;
+				vector<uint8_t> rows(band*write_width);
+				for(uint32_t end = height; end > 0; ) {
+					uint32_t start = end > band ? end - band : 0;
+					qint64 bytes = qint64(end - start)*write_width;
+					if(!raw->seek(qint64(start)*write_width) || raw->read((char *)rows.data(), bytes) != bytes) {
+						enc.abort();
+						return;
+					}
+					for(uint32_t r = end; r > start; r--)
+						enc.writeRows(rows.data() + (r - 1 - start)*write_width, 1);
+					end = start;
+				}
+				sizes[i] = enc.finish();
+				raw->remove();
+			}));
+		}
+		for(auto &f: encoded)
+			f.waitForFinished();
+		for(QFile *f: spool)
+			delete f;
+
+		//a plane that could not be encoded has size 0.
+		if(std::find(sizes.begin(), sizes.end(), size_t(0)) != sizes.end()) {
+			file.close();
+			file.remove();
+			error = "Could not encode the PTM planes.";
+			return 0;
 		}
 
 		// Write JPEG sizes to header
@@ -1223,16 +1932,33 @@ size_t RtiBuilder::savePTM(const std::string &output) {
 		for(int i = 0; i < 9; i++)
 			size_stream << sizes[i] << (i < 8 ? " " : "\n");
 		size_stream << "0 0 0 0 0 0 0 0 0\n";  // motion vector residuals
-		fwrite(size_stream.str().data(), 1, size_stream.str().size(), file);
-
-		// Write JPEG data
-		for(int i = 0; i < 9; i++) {
-			fwrite(buffers[i], 1, sizes[i], file);
-			delete[] buffers[i];
+		std::string sizes_line = size_stream.str();
+		bool ok = file.write(sizes_line.data(), sizes_line.size()) == qint64(sizes_line.size());
+
+		// Splice the JPEG segments
+		for(int i = 0; i < 9 && ok; i++) {
+			QFile segment(spool_dir.filePath(QString("plane_%1.jpg").arg(i)));
+			if(!segment.open(QFile::ReadOnly)) {
+				error = "Could not read temporary file.";
+				ok = false;
+				break;
+			}
+			while(ok && !segment.atEnd()) {
+				QByteArray chunk = segment.read(1<<20);
+				ok = !chunk.isEmpty() && file.write(chunk) == chunk.size();
+			}
+		}
+		//a truncated ptm would look valid.
+		if(!ok) {
+			file.close();
+			file.remove();
+			if(error.empty())
+				error = "Could not write file: " + output;
+			return 0;
 		}
 	}
-	int64_t total = ftell(file);
-	fclose(file);
+	int64_t total = file.size();
+	file.close();
 	return total;
 }
 
@@ -1282,58 +2008,27 @@ size_t RtiBuilder::saveUniversal(const std::string &output) {
 	//second reading.
 	imageset.restart();
 
-	if(!nworkers)
-		nworkers = QThread::idealThreadCount();
-
-	vector<Worker *> workers(height, nullptr);
-	for(size_t i = 0; i < nworkers; i++) {
-		workers[i] = new Worker(*this);
-	}
-	vector<QFuture<void>> futures(height);
-
-	QThreadPool pool;
-	pool.setMaxThreadCount(nworkers);
-
 	vector<uint8_t> line(width*nplanes);
 
-	for(uint32_t y = 0; y < height + nworkers; y++) {
-		if(callback && y > 0) {
-			bool keep_going = (*callback)("Saving:", 100*(y)/(height + nworkers-1));
-			if(!keep_going) {
-				cout << "TODO: clean up directory, we are already saving!" << endl;
-				break;
-			}
-		}
-		if(y >= nworkers) {
-			futures[y - nworkers].waitForFinished();
-
-			Worker *doneworker = workers[y - nworkers];
-
-			//worker line is organized for jpeg saving (so plane 1, 2, 3 in line[0] as data rgbrgbrgb etc.
-			for(size_t j = 0; j < doneworker->line.size(); j++) {
-				for(uint32_t x = 0; x < width; x++) {
-					line[x*nplanes + j + 0*nplanes/3] = doneworker->line[j][x*3+0];
-					line[x*nplanes + j + 1*nplanes/3] = doneworker->line[j][x*3+1];
-					line[x*nplanes + j + 2*nplanes/3] = doneworker->line[j][x*3+2];
-				}
+	bool completed = processRows(nullptr, [&](uint32_t /*row*/, Worker &doneworker) {
+		//worker line is organized for jpeg saving (so plane 1, 2, 3 in line[0] as data rgbrgbrgb etc.
+		for(size_t j = 0; j < doneworker.line.size(); j++) {
+			for(uint32_t x = 0; x < width; x++) {
+				line[x*nplanes + j + 0*nplanes/3] = doneworker.line[j][x*3+0];
+				line[x*nplanes + j + 1*nplanes/3] = doneworker.line[j][x*3+1];
+				line[x*nplanes + j + 2*nplanes/3] = doneworker.line[j][x*3+2];
 			}
-			fwrite(line.data(), 1, line.size(), file);
-			if(y < height)
-				workers[y] = doneworker;
-			else
-				delete doneworker;
 		}
-
-		if(y < height) {
-			Worker *worker = workers[y];
-			assert(worker != nullptr);
-			imageset.readLine(worker->sample);
-
-			futures[y] = QtConcurrent::run(&pool, [worker](){worker->run(); });
-		}
-	}
+		fwrite(line.data(), 1, line.size(), file);
+		return true;
+	});
 	int64_t total = ftell(file);
 	fclose(file);
+	if(!completed) {
+		QFile::remove(output.c_str());
+		error = "Cancelled.";
+		return 0;
+	}
 	return total;
 }
 
@@ -1468,7 +2163,7 @@ size_t RtiBuilder::save(const string &output, int quality) {
 	for(auto &p: line)
 		p.resize(width*3, 0);
 
-	vector<JpegEncoder *> encoders(njpegs);
+	vector<JpegEncoder *> encoders(plane_output ? 0 : njpegs);
 	
 	for(uint32_t i = 0; i < encoders.size(); i++) {
 		encoders[i] = new JpegEncoder();
@@ -1507,10 +2202,14 @@ size_t RtiBuilder::save(const string &output, int quality) {
 	//second reading.
 	imageset.restart();
 
-	//TODO
-	QImage normals(width, height, QImage::Format_RGB32);
-	QImage means  (width, height, QImage::Format_RGB32);
-	QImage medians(width, height, QImage::Format_RGB32);
+	//worker rows are copied straight into the scanlines.
+	QImage normals, means, medians;
+	if(savenormals)
+		normals = QImage(width, height, QImage::Format_RGB888);
+	if(savemeans)
+		means = QImage(width, height, QImage::Format_RGB888);
+	if(savemedians)
+		medians = QImage(width, height, QImage::Format_RGB888);
 
 	// Set spatial resolution if known. Convert to pixels/m as RtiBuilder stores this in mm/pixel
 	if (imageset.pixel_size > 0) {
@@ -1524,74 +2223,154 @@ size_t RtiBuilder::save(const string &output, int quality) {
 	}
 
 	//colorspace check
-	if (savenormals) {
-		//init matrix for light computation (bleargh, static in function)
-		vector<float> dummy(nplanes, 0.0f);
-		getNormalThreeLights(dummy);
-		if (colorspace != RGB && colorspace != MRGB) {
-			cerr << "NO NORMALS (unsupported colorspace: RGB and MRGB only supported!)" << endl;
-			savenormals = false;
-		}
-	}
+	prepareNormals();
 
-	if(!nworkers)
-		nworkers = QThread::idealThreadCount();
+	uint32_t row_bytes = width*3;
+	auto writeRow = [&](uint32_t row, vector<vector<uint8_t>> &planes, vector<uchar> &normal, vector<uchar> &mean, vector<uchar> &median) {
+		if(savenormals)
+			memcpy(normals.scanLine(row), normal.data(), row_bytes);
+		if(savemeans)
+			memcpy(means.scanLine(row), mean.data(), row_bytes);
+		if(savemedians)
+			memcpy(medians.scanLine(row), median.data(), row_bytes);
 
-	vector<Worker *> workers(height, nullptr);
-	for(size_t i = 0; i < nworkers; i++) {
-		workers[i] = new Worker(*this);
-		workers[i]->output_color_transform_float = imageset.output_color_transform_float;
-	}
-	vector<QFuture<void>> futures(height);
+		if(plane_output) {
+			for(uint32_t j = 0; j < njpegs; j++)
+				(*plane_output)(j, planes[j]);
+		}
+		for(size_t j = 0; j < encoders.size(); j++) {
+			encoders[j]->writeRows(planes[j].data(), 1);
+		}
+	};
 
-	QThreadPool pool;
-	pool.setMaxThreadCount(nworkers);
+	//strips: strip_K.raw holds the rows [K*checkpoint_rows, (K+1)*checkpoint_rows) as saved, the planes followed
+	//by normals, means and medians. In the checkpoint folder they let an interrupted save resume,
+	//a banded save spools all the rows through them, worker processes return them to the coordinator.
+	bool banded = nbands > 1 || role == COORDINATOR;
+	bool completed = true;
+	QDir strips(checkpoint.c_str());
+	std::unique_ptr<QTemporaryDir> spool;
+	if(checkpoint.empty() && banded) {
+		spool.reset(new QTemporaryDir);
+		strips.setPath(spool->path());
+		if(!spool->isValid()) {
+			error = "Could not create a temporary folder.";
+			completed = false;
+		}
+	}
+	size_t strip_row = stripRowSize();
+	auto stripName = [&](uint32_t row) { return strips.filePath(QString("strip_%1.raw").arg(row/checkpoint_rows)); };
+	auto replayStrip = [&](QFile &file, uint32_t start, uint32_t rows) {
+		vector<uchar> normal(row_bytes), mean(row_bytes), median(row_bytes);
+		for(uint32_t y = 0; y < rows; y++) {
+			for(auto &p: line)
+				file.read((char *)p.data(), row_bytes);
+			if(savenormals) file.read((char *)normal.data(), row_bytes);
+			if(savemeans)   file.read((char *)mean.data(), row_bytes);
+			if(savemedians) file.read((char *)median.data(), row_bytes);
+			writeRow(start + y, line, normal, mean, median);
+		}
+	};
 
-	for(uint32_t y = 0; y < height + nworkers; y++) {
-		if(callback && y > 0) {
-			bool keep_going = (*callback)("Saving:", 100*(y)/(height + nworkers-1));
-			if(!keep_going) {
-				cout << "TODO: clean up directory, we are already saving!" << endl;
-				break;
+	if(!checkpoint.empty()) {
+		QString key = stripsKey();
+		strips.remove("strips.done");
+
+		QFile key_file(strips.filePath("strips.key"));
+		bool valid = key_file.open(QFile::ReadOnly) && QString::fromUtf8(key_file.readAll()) == key;
+		key_file.close();
+		if(!valid) {
+			for(const QString &name: strips.entryList(QStringList() << "strip_*", QDir::Files))
+				strips.remove(name);
+			if(!key_file.open(QFile::WriteOnly) || key_file.write(key.toUtf8()) < 0) {
+				error = "Could not write checkpoint.";
+				completed = false;
 			}
+			key_file.close();
 		}
-		if(y >= nworkers) {
-			futures[y - nworkers].waitForFinished();
+	}
 
-			Worker *doneworker = workers[y - nworkers];
+	QFile strip;
+	if(!completed) {
+		//nothing to do, clean up below.
 
-			for(uint32_t x = 0; x < width; x++) {
-				if (savenormals)
-					normals.setPixel(x, y- nworkers, qRgb(doneworker->normals[x*3], doneworker->normals[x*3+1], doneworker->normals[x*3+2]));
-				if(savemeans)
-					means.setPixel(x, y- nworkers, qRgb(doneworker->means[x*3], doneworker->means[x*3+1], doneworker->means[x*3+2]));
-				if(savemedians)
-					medians.setPixel(x, y- nworkers, qRgb(doneworker->medians[x*3], doneworker->medians[x*3+1], doneworker->medians[x*3+2]));
+	} else if(banded) {
+		completed = processBands(strips, replayStrip);
+
+	} else {
+		//complete strips are replayed and their rows skipped.
+		uint32_t start = 0;
+		while(!checkpoint.empty() && start < height) {
+			uint32_t rows = std::min(checkpoint_rows, height - start);
+			QFile file(stripName(start));
+			if(file.size() != qint64(rows*strip_row) || !file.open(QFile::ReadOnly))
+				break;
+			replayStrip(file, start, rows);
+			start += rows;
+		}
+		if(start > 0)
+			cout << "Resuming from row " << start << endl;
+
+		completed = processRows(imageset.output_color_transform_float, [&](uint32_t row, Worker &doneworker) {
+			writeRow(row, doneworker.line, doneworker.normals, doneworker.means, doneworker.medians);
+			if(checkpoint.empty())
+				return true;
+
+			//strips are written aside and renamed once complete.
+			if(row % checkpoint_rows == 0) {
+				strip.setFileName(stripName(row) + ".tmp");
+				if(!strip.open(QFile::WriteOnly)) {
+					error = "Could not write checkpoint: " + strip.fileName().toStdString();
+					return false;
+				}
 			}
-			for(size_t j = 0; j < encoders.size(); j++) {
-				encoders[j]->writeRows(doneworker->line[j].data(), 1);
+			storeRow(strip, doneworker);
+			if(row + 1 == height || (row + 1) % checkpoint_rows == 0) {
+				strip.close();
+				QFile::remove(stripName(row));
+				if(strip.error() != QFile::NoError || !strip.rename(stripName(row))) {
+					error = "Could not write checkpoint: " + stripName(row).toStdString();
+					strip.remove();
+					return false;
+				}
 			}
-			if(y < height)
-				workers[y] = doneworker;
-			else
-				delete doneworker;
-		}
-
-		if(y < height) {
-			Worker *worker = workers[y];
-			assert(worker != nullptr);
-			imageset.readLine(worker->sample);
+			return true;
+		}, start);
+	}
 
-			futures[y] = QtConcurrent::run(&pool, [worker](){worker->run(); });
+	if(!completed) {
+		//partial planes are useless: a checkpointed build resumes from the strips.
+		if(strip.isOpen()) {
+			strip.close();
+			strip.remove();
+		}
+		for(size_t p = 0; p < encoders.size(); p++) {
+			encoders[p]->abort();
+			delete encoders[p];
+			dir.remove(QString("plane_%1.jpg").arg(p));
 		}
+		dir.remove("info.json");
+		dir.remove("materials.png");
+		if(error.empty())
+			error = "Cancelled.";
+		return 0;
 	}
 
 	size_t total = 0;
 	for(size_t p = 0; p < encoders.size(); p++) {
 		size_t s = encoders[p]->finish();
+		delete encoders[p];
 		total += s;
 	}
 
+	//the base is kept for parameter sweeps, the strips are not needed anymore.
+	if(!checkpoint.empty()) {
+		for(const QString &name: strips.entryList(QStringList() << "strip_*", QDir::Files))
+			strips.remove(name);
+		//late workers find out there is nothing left to do.
+		strips.rename("strips.key", "strips.done");
+	}
+
 	if(savenormals)
 		normals.save(dir.filePath("normals.png"));
 
@@ -1609,29 +2388,28 @@ size_t RtiBuilder::save(const string &output, int quality) {
 
 void RtiBuilder::processLine(PixelArray &sample, PixelArray &resample, std::vector<std::vector<uint8_t>> &line,
 							 std::vector<uchar> &normals, std::vector<uchar> &means, std::vector<uchar> &medians,
-							 cmsHTRANSFORM output_color_transform_float) {
+							 LineBuffers &buffers, cmsHTRANSFORM output_color_transform_float) {
 
 	for(uint32_t x = 0; x < width; x++)
 		resamplePixel(sample[x], resample[x]);
 
 
 	if (savenormals) {
-		Eigen::MatrixXf A(sample.nlights, 1);
-		Eigen::MatrixXf b(sample.nlights, 3);
-
+		//least squares of the lights against the pixel means, a single unknown: no matrices needed.
+		std::vector<Eigen::Vector3f> &lights = imageset.lights();
 		for(uint32_t x = 0; x < width; x++) {
-			for(uint32_t y = 0; y < sample.nlights; y++)
-				A(y, 0) = sample[x][y].mean();
-
-			for(uint32_t y = 0; y < imageset.lights().size(); y++) {
-				Eigen::Vector3f &l = imageset.lights()[y];
-				b(y, 0) = l[0];
-				b(y, 1) = l[1];
-				b(y, 2) = l[2];
+			float aa = 0.0f;
+			float ab[3] = { 0.0f, 0.0f, 0.0f };
+			for(uint32_t y = 0; y < sample.nlights; y++) {
+				float a = sample[x][y].mean();
+				aa += a*a;
+				for(int k = 0; k < 3; k++)
+					ab[k] += a*lights[y][k];
 			}
-
-			Eigen::MatrixXf r = (A.transpose() * A).ldlt().solve(A.transpose() * b);
-			Vector3f c(r(0, 0), r(0, 1), r(0, 2));
+			if(aa > 0.0f)
+				for(int k = 0; k < 3; k++)
+					ab[k] /= aa;
+			Vector3f c(ab[0], ab[1], ab[2]);
 			c.normalize();
 			for(uint32_t k = 0; k < 3; k++)
 				normals[x*3+k] = floor(255*(c[k] + 1.0f)/2.0f);
@@ -1639,8 +2417,25 @@ void RtiBuilder::processLine(PixelArray &sample, PixelArray &resample, std::vect
 	}
 
 
+	if(output_color_transform_float)
+		buffers.rgb01.resize(size_t(nplanes/3)*width*3);
+	buffers.pri.resize(nplanes);
+	buffers.tmp.resize(nplanes);
+	float *pri = buffers.pri.data();
+
+	//3d lights: one blended base every blend_step pixels instead of 4 projections per pixel.
+	MaterialBuilder &blended = buffers.blended;
+	const uint32_t blend_step = 8;
+
 	for(uint32_t x = 0; x < width; x++) {
-		vector<float> pri = toPrincipal(resample[x]);
+		if(blend_bases) {
+			if(x % blend_step == 0) {
+				Pixel &center = resample[std::min(x + blend_step/2, width - 1)];
+				interpolateBase(center.x, center.y, blended);
+			}
+			toPrincipal(resample[x], blended, pri);
+		} else
+			toPrincipal(resample[x], pri, buffers.tmp.data());
 
 		if(savemeans) {
 			Vector3f n = extractMean(sample[x]);
@@ -1656,49 +2451,31 @@ void RtiBuilder::processLine(PixelArray &sample, PixelArray &resample, std::vect
 			medians[x*3+2] = std::min(255, std::max(0, (int)round(n[2])));
 		}
 
-		if(colorspace == LRGB){
-			for(uint32_t j = 0; j < nplanes/3; j++) {
-				if(output_color_transform_float) {
-					float rgb[3];
-					for(uint32_t c = 0; c < 3; c++) {
-						uint32_t p = j*3 + c;
-						Material::Plane &plane = material.planes[p];
-
-						float norm = pri[p] / (255.0f * plane.scale) + plane.bias;
-						rgb[c] = std::max(0.0f, std::min(1.0f, norm));
-					}
-					cmsDoTransform(output_color_transform_float, rgb, &line[j][x*3], 1);
-				} else {
-					for(uint32_t c = 0; c < 3; c++) {
-						uint32_t p = j*3 + c;
-						if(j >= 1)
-							pri[p] = material.planes[p].quantize(pri[p]);
-						line[j][x*3 + c] = pri[p];
-					}
+		for(uint32_t j = 0; j < nplanes/3; j++) {
+			if(output_color_transform_float) {
+				float *rgb = &buffers.rgb01[(j*width + x)*3];
+				for(uint32_t c = 0; c < 3; c++) {
+					uint32_t p = j*3 + c;
+					Material::Plane &plane = material.planes[p];
+					float norm = pri[p] / (255.0f * plane.scale) + plane.bias;
+					rgb[c] = std::max(0.0f, std::min(1.0f, norm));
 				}
-			}
-
-		} else {
-
-			for(uint32_t j = 0; j < nplanes/3; j++) {
-				if(output_color_transform_float) {
-					float rgb[3];
-					for(uint32_t c = 0; c < 3; c++) {
-						uint32_t p = j*3 + c;
-						Material::Plane &plane = material.planes[p];
-						float norm = pri[p] / (255.0f * plane.scale) + plane.bias;
-						rgb[c] = std::max(0.0f, std::min(1.0f, norm));
-					}
-					cmsDoTransform(output_color_transform_float, rgb, &line[j][x*3], 1);
-				} else {
-					for(uint32_t c = 0; c < 3; c++) {
-						uint32_t p = j*3 + c;
-						line[j][x*3 + c] = material.planes[p].quantize(pri[p]);
-					}
+			} else {
+				for(uint32_t c = 0; c < 3; c++) {
+					uint32_t p = j*3 + c;
+					//LRGB base image is not quantized
+					if(colorspace != LRGB || j >= 1)
+						pri[p] = material.planes[p].quantize(pri[p]);
+					line[j][x*3 + c] = pri[p];
 				}
 			}
 		}
 	}
+	//one call per plane row instead of one per pixel.
+	if(output_color_transform_float) {
+		for(uint32_t j = 0; j < nplanes/3; j++)
+			cmsDoTransform(output_color_transform_float, &buffers.rgb01[j*width*3], line[j].data(), width);
+	}
 }
 
 /*
@@ -1779,15 +2556,75 @@ PixelArray RtiBuilder::resamplePixels(PixelArray &sample) {
 	return pixels;
 }*/
 
-void RtiBuilder::remapPixel(Pixel  &sample, Pixel &pixel, Resamplemap &resamplemap, float weight) {
-	if(weight == 0) return;
-	for(uint32_t i = 0; i < ndimensions; i++) {
-		for(auto &w: resamplemap[i]) {
-			pixel[i].r += sample[w.first].r*w.second * weight;
-			pixel[i].g += sample[w.first].g*w.second * weight;
-			pixel[i].b += sample[w.first].b*w.second * weight;
+void Resamplemap::apply(const Pixel &sample, Pixel &pixel) const {
+	const Color3f *in = sample.data();
+	Color3f *out = pixel.data();
+	for(size_t i = 0; i + 1 < rows.size(); i++) {
+		float r = 0.0f, g = 0.0f, b = 0.0f;
+		for(uint32_t k = rows[i]; k < rows[i+1]; k++) {
+			const Color3f &c = in[columns[k]];
+			float w = weights[k];
+			r += c.r*w;
+			g += c.g*w;
+			b += c.b*w;
+		}
+		out[i].r = r;
+		out[i].g = g;
+		out[i].b = b;
+	}
+}
+
+void Resamplemap::apply(const Pixel &sample, Pixel &pixel, const float corner_weights[4]) const {
+	assert(corners == 4);
+	const Color3f *in = sample.data();
+	Color3f *out = pixel.data();
+	for(size_t i = 0; i + 1 < rows.size(); i++) {
+		float r = 0.0f, g = 0.0f, b = 0.0f;
+		for(uint32_t k = rows[i]; k < rows[i+1]; k++) {
+			const Color3f &c = in[columns[k]];
+			const float *w4 = &weights[k*4];
+			float w = w4[0]*corner_weights[0] + w4[1]*corner_weights[1] + w4[2]*corner_weights[2] + w4[3]*corner_weights[3];
+			r += c.r*w;
+			g += c.g*w;
+			b += c.b*w;
+		}
+		out[i].r = r;
+		out[i].g = g;
+		out[i].b = b;
+	}
+}
+
+Resamplemap Resamplemap::merge(const Resamplemap *corner[4]) {
+	Resamplemap merged;
+	merged.corners = 4;
+	merged.rows.push_back(0);
+	size_t nrows = corner[0]->rows.size();
+	for(size_t i = 0; i + 1 < nrows; i++) {
+		//columns are sorted in each map: merge the 4 lists.
+		uint32_t k[4], end[4];
+		for(int c = 0; c < 4; c++) {
+			k[c] = corner[c]->rows[i];
+			end[c] = corner[c]->rows[i+1];
+		}
+		while(true) {
+			uint32_t column = UINT32_MAX;
+			for(int c = 0; c < 4; c++)
+				if(k[c] < end[c])
+					column = std::min(column, corner[c]->columns[k[c]]);
+			if(column == UINT32_MAX)
+				break;
+
+			merged.columns.push_back(column);
+			for(int c = 0; c < 4; c++) {
+				float w = 0.0f;
+				if(k[c] < end[c] && corner[c]->columns[k[c]] == column)
+					w = corner[c]->weights[k[c]++];
+				merged.weights.push_back(w);
+			}
 		}
+		merged.rows.push_back(merged.columns.size());
 	}
+	return merged;
 }
 
 void RtiBuilder::resamplePixel(Pixel &sample, Pixel &pixel) { //pos in pixels.
@@ -1796,43 +2633,18 @@ void RtiBuilder::resamplePixel(Pixel &sample, Pixel &pixel) { //pos in pixels.
 	pixel.y = sample.y;
 	if(type == BILINEAR) {
 		if(imageset.light3d) {
-			//TODO move this somewhere else
 			float X = (resample_width-1)*sample.x/float(imageset.image_width);
 			float Y = (resample_height-1)*sample.y/float(imageset.image_height);
 
-			for(uint32_t i = 0; i < ndimensions; i++)
-				pixel[i].r = pixel[i].g = pixel[i].b = 0.0f;
-
-			//find 4 resamplemaps and coefficients
+			//the cell map blends its 4 corners.
 			float ix, iy;
 			float dx = modff(X, &ix);
 			float dy = modff(Y, &iy);
-			Resamplemap &A = resamplemaps[int(ix) + int(iy)*resample_width];
-			float wA = (1 - dx)*(1 - dy);
-			remapPixel(sample, pixel, A, wA);
-
-			Resamplemap &B = resamplemaps[int(ix+1) + int(iy)*resample_width];
-			float wB = dx*(1 - dy);
-			remapPixel(sample, pixel, B, wB);
-
-			Resamplemap &C = resamplemaps[int(ix) + int(iy+1)*resample_width];
-			float wC = (1 - dx)*dy;
-			remapPixel(sample, pixel, C, wC);
-
-			Resamplemap &D = resamplemaps[int(ix+1) + int(iy+1)*resample_width];
-			float wD = dx*dy;
-			remapPixel(sample, pixel, D, wD);
+			float weights[4] = { (1 - dx)*(1 - dy), dx*(1 - dy), (1 - dx)*dy, dx*dy };
+			resamplecells[int(ix) + int(iy)*(resample_width-1)].apply(sample, pixel, weights);
 
 		} else {
-
-			for(uint32_t i = 0; i < ndimensions; i++) {
-				pixel[i].r = pixel[i].g = pixel[i].b = 0.0f;
-				for(auto &w: resamplemap[i]) {
-					pixel[i].r += sample[w.first].r*w.second;
-					pixel[i].g += sample[w.first].g*w.second;
-					pixel[i].b += sample[w.first].b*w.second;
-				}
-			}
+			resamplemap.apply(sample, pixel);
 		}
 
 	} else { //NOT BILINEAR
@@ -1878,10 +2690,20 @@ void RtiBuilder::buildResampleMaps() {
 			buildResampleMap(relights, resamplemap);
 		}
 	}
+
+	resamplecells.resize((resample_height-1)*(resample_width-1));
+	for(int y = 0; y < resample_height-1; y++) {
+		for(int x = 0; x < resample_width-1; x++) {
+			const Resamplemap *corners[4] = {
+				&resamplemaps[x + y*resample_width], &resamplemaps[x+1 + y*resample_width],
+				&resamplemaps[x + (y+1)*resample_width], &resamplemaps[x+1 + (y+1)*resample_width] };
+			resamplecells[x + y*(resample_width-1)] = Resamplemap::merge(corners);
+		}
+	}
 }
 
 
-void RtiBuilder::buildResampleMap(std::vector<Vector3f> &lights, std::vector<std::vector<std::pair<int, float>>> &remap) {
+void RtiBuilder::buildResampleMap(std::vector<Vector3f> &lights, Resamplemap &remap) {
 	/* every light is linear combination of 4 nearby points (x)
 	b = w00x00 + w01x01
 	solution is closed form matrix
@@ -1912,7 +2734,7 @@ void RtiBuilder::buildResampleMap(std::vector<Vector3f> &lights, std::vector<std
 	float radius = 1/(sigma*sigma);
 	Eigen::MatrixXd B = Eigen::MatrixXd::Zero(ndimensions, lights.size());
 
-	remap.resize(ndimensions);
+	vector<pair<int, float>> weights;
 	for(uint32_t y = 0; y < resolution; y++) {
 		if(callback) {
 			bool keep_going = (*callback)("Resampling light directions", 100*y/resolution);
@@ -1925,7 +2747,6 @@ void RtiBuilder::buildResampleMap(std::vector<Vector3f> &lights, std::vector<std
 			Vector3f n = fromOcta(x, y, resolution);
 
 			//compute rbf weights
-			auto &weights = remap[x + y*resolution];
 			weights.resize(lights.size());
 			float totw = 0.0f;
 			for(size_t i = 0; i < lights.size(); i++) {
@@ -1998,27 +2819,60 @@ void RtiBuilder::buildResampleMap(std::vector<Vector3f> &lights, std::vector<std
 	Eigen::MatrixXd tI = Eigen::MatrixXd::Identity(lights.size(), lights.size());
 	Eigen::MatrixXd iA = B + iAtA*(A.transpose() * (tI - A*B));
 
-	remap.clear();
-	remap.resize(ndimensions);
+	remap = Resamplemap();
+	remap.rows.push_back(0);
 	//rows
 	for(uint32_t i = 0; i < ndimensions; i++) {
-		auto &weights = remap[i];
-
 		//cols
 		for(uint32_t c = 0; c < lights.size(); c++) {
 			double w = iA(i, c);
-			if(fabs(w) > 0.005)
-				weights.push_back(std::make_pair(c, w));
-
+			if(fabs(w) > 0.005) {
+				remap.columns.push_back(c);
+				remap.weights.push_back(w);
+			}
 		}
+		remap.rows.push_back(remap.columns.size());
 	}
 
 	return;
 }
 
+void RtiBuilder::interpolateBase(float px, float py, MaterialBuilder &base) {
+	float ix = (resample_width-1)*px/float(imageset.image_width);
+	float iy = (resample_height-1)*py/float(imageset.image_height);
+
+	float X, Y;
+	float dx = modff(ix, &X);
+	float dy = modff(iy, &Y);
+	MaterialBuilder *corners[4] = {
+		&materialbuilders[int(X) + int(Y)*resample_width],
+		&materialbuilders[int(X+1) + int(Y)*resample_width],
+		&materialbuilders[int(X) + int(Y+1)*resample_width],
+		&materialbuilders[int(X+1) + int(Y+1)*resample_width] };
+	float weights[4] = { (1 - dx)*(1 - dy), dx*(1 - dy), (1 - dx)*dy, dx*dy };
+
+	//projection is linear (and mean is zero for PTM and HSH): blending the matrices is the same as blending the results.
+	base.mean = corners[0]->mean;
+	base.proj.assign(corners[0]->proj.size(), 0.0f);
+	for(int c = 0; c < 4; c++) {
+		const std::vector<float> &proj = corners[c]->proj;
+		float w = weights[c];
+		for(size_t i = 0; i < proj.size(); i++)
+			base.proj[i] += w*proj[i];
+	}
+}
+
 std::vector<float> RtiBuilder::toPrincipal(Pixel &pixel) {
-	if(!imageset.light3d || type == RBF || type == BILINEAR)
-		return toPrincipal(pixel, materialbuilder);
+	vector<float> res(nplanes), tmp(nplanes);
+	toPrincipal(pixel, res.data(), tmp.data());
+	return res;
+}
+
+void RtiBuilder::toPrincipal(Pixel &pixel, float *res, float *tmp) {
+	if(!imageset.light3d || type == RBF || type == BILINEAR) {
+		toPrincipal(pixel, materialbuilder, res);
+		return;
+	}
 
 	float ix = (resample_width-1)*pixel.x/float(imageset.image_width);
 	float iy = (resample_height-1)*pixel.y/float(imageset.image_height);
@@ -2030,35 +2884,40 @@ std::vector<float> RtiBuilder::toPrincipal(Pixel &pixel) {
 	float dy = modff(iy, &Y);
 	MaterialBuilder &A = materialbuilders[int(X) + int(Y)*resample_width];
 	float wA = (1 - dx)*(1 - dy);
-	vector<float> res = toPrincipal(pixel, A);
+	toPrincipal(pixel, A, res);
 
 
 	MaterialBuilder &B = materialbuilders[int(X+1) + int(Y)*resample_width];
 	float wB = dx*(1 - dy);
-	vector<float> tmp = toPrincipal(pixel, B);
-	for(size_t i = 0; i < res.size(); i++)
+	toPrincipal(pixel, B, tmp);
+	for(size_t i = 0; i < nplanes; i++)
 		res[i] = res[i]*wA + tmp[i]*wB;
 
 	MaterialBuilder &C = materialbuilders[int(X) + int(Y+1)*resample_width];
 	float wC = (1 - dx)*dy;
-	tmp = toPrincipal(pixel, C);
-	for(size_t i = 0; i < res.size(); i++)
+	toPrincipal(pixel, C, tmp);
+	for(size_t i = 0; i < nplanes; i++)
 		res[i] += tmp[i]*wC;
 
 	MaterialBuilder &D = materialbuilders[int(X+1) + int(Y+1)*resample_width];
 	float wD = dx*dy;
-	tmp = toPrincipal(pixel, D);
-	for(size_t i = 0; i < res.size(); i++)
+	toPrincipal(pixel, D, tmp);
+	for(size_t i = 0; i < nplanes; i++)
 		res[i] += tmp[i]*wD;
-	return res;
 }
 
 
 std::vector<float> RtiBuilder::toPrincipal(Pixel &pixel, MaterialBuilder &materialbuilder) {
+	vector<float> res(nplanes);
+	toPrincipal(pixel, materialbuilder, res.data());
+	return res;
+}
+
+void RtiBuilder::toPrincipal(Pixel &pixel, MaterialBuilder &materialbuilder, float *res) {
 	float *v = (float *)pixel.data();
 	uint32_t dim = ndimensions*3;
 
-	vector<float> res(nplanes, 0.0f);
+	std::fill(res, res + nplanes, 0.0f);
 
 	if(colorspace == LRGB) {
 
@@ -2084,7 +2943,7 @@ std::vector<float> RtiBuilder::toPrincipal(Pixel &pixel, MaterialBuilder &materi
 					res[p] += ((v[k*3] + v[k*3+1] + v[k*3+2])/luma)* materialbuilder.proj[k + (p-3)*ndimensions];
 		} else {
 			Eigen::Map<Eigen::VectorXf> ev(v, ndimensions);
-			Eigen::Map<Eigen::VectorXf> eres(&*res.begin() + 3, nplanes);
+			Eigen::Map<Eigen::VectorXf> eres(res + 3, nplanes - 3);
 
 			eres = materialbuilder.svd.solve(ev);
 		}
@@ -2096,19 +2955,17 @@ std::vector<float> RtiBuilder::toPrincipal(Pixel &pixel, MaterialBuilder &materi
 
 	} else { //RGB, YCC
 		if(!materialbuilder.useEigen) { //not rank deficient.
-			vector<float> col(dim);
-
-			for(size_t k = 0; k < dim; k++)
-				col[k] = v[k] - materialbuilder.mean[k];
-
+			const float *mean = materialbuilder.mean.data();
 			for(size_t p = 0; p < nplanes; p++) {
-				for(size_t k = 0; k < dim; k++) {
-					res[p] += col[k] * materialbuilder.proj[k + p*dim];
-				}
+				const float *proj = &materialbuilder.proj[p*dim];
+				float sum = 0.0f;
+				for(size_t k = 0; k < dim; k++)
+					sum += (v[k] - mean[k]) * proj[k];
+				res[p] = sum;
 			}
 		} else {
 			Eigen::Map<Eigen::VectorXf> ev(v, ndimensions*3);
-			Eigen::Map<Eigen::VectorXf> eres(&*res.begin(), nplanes);
+			Eigen::Map<Eigen::VectorXf> eres(res, nplanes);
 
 			eres = materialbuilder.svd.solve(ev);
 		}
@@ -2132,6 +2989,5 @@ std::vector<float> RtiBuilder::toPrincipal(Pixel &pixel, MaterialBuilder &materi
 			res[2] = 255.0f * cr/count;
 		}
 	}
-	return res;
 }
 
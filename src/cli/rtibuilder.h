@@ -12,11 +12,32 @@
 #include <Eigen/Core>
 
 #include <functional>
+#include <atomic>
 class QDir;
+class QFile;
 class Dome;
+class Worker;
+
+//sparse matrix from the lights to the resampled light directions (compressed rows: direction i uses entries rows[i] to rows[i+1]).
+//The maps of the 4 corners of a 3d lights grid cell are merged in a single one with 4 weights per entry.
+struct Resamplemap {
+	std::vector<uint32_t> rows;
+	std::vector<uint32_t> columns;
+	std::vector<float> weights;
+	uint32_t corners = 1;
+
+	void apply(const Pixel &sample, Pixel &pixel) const;
+	void apply(const Pixel &sample, Pixel &pixel, const float corner_weights[4]) const;
+	static Resamplemap merge(const Resamplemap *corner[4]);
+};
 
-//store pair light, coefficients for each resampled light direction.
-typedef std::vector<std::vector<std::pair<int, float>>> Resamplemap;
+//scratch of processLine, kept by each worker and reused across rows.
+struct LineBuffers {
+	std::vector<float> pri;
+	std::vector<float> tmp;
+	std::vector<float> rgb01;
+	MaterialBuilder blended;
+};
 
 class RtiBuilder: public Rti {
 public:
@@ -35,9 +56,22 @@ public:
 	bool savemedians = false;
 	int crop[4] = { 0, 0, 0, 0 }; //left, top, width, height
 	size_t nworkers = 0; //autodetect optimal number
+	uint32_t nbands = 1; //more than 1: horizontal bands of the crop are decoded and fitted in parallel, each with its own decoders and nworkers/nbands workers
 	ColorProfileMode colorProfileMode = COLOR_PROFILE_LINEAR_RGB;
 
+	//folder for resumable builds, empty disables: init() reuses the base fitted with the same images and parameters,
+	//save() keeps the completed strips of checkpoint_rows rows and an interrupted save restarts from the last one.
+	std::string checkpoint;
+	uint32_t checkpoint_rows = 256;
+
+	//distributed builds share the checkpoint folder: the coordinator (save()) fits, collects and encodes the strips,
+	//workers started with the same images and parameters call work() instead of save() and fit strips too.
+	enum Role { STANDALONE, COORDINATOR, WORKER };
+	Role role = STANDALONE;
+
 	std::function<bool(QString stage, int percent)> *callback = nullptr;
+	//if set save() hands each quantized row of the planes (top to bottom) to this function instead of writing plane_N.jpg.
+	std::function<void(uint32_t plane, std::vector<uint8_t> &row)> *plane_output = nullptr;
 
 	RtiBuilder();
 	~RtiBuilder();
@@ -46,10 +80,18 @@ public:
 	bool init(std::function<bool(QString stage, int percent)> *_callback = nullptr);
 
 	size_t save(const std::string &output, int quality = 95);
+	//worker role: fits the strips nobody claimed yet, returns when all are taken.
+	bool work();
 	size_t savePTM(const std::string &output);
 	size_t saveUniversal(const std::string &output);
 	bool saveJSON(QDir &dir, int quality, QString color_profile);
 
+	//fits all the rows on a ring of nworkers workers, output receives them in order (on the calling thread).
+	//Rows before start are read and skipped. Returns false if cancelled or if output returns false.
+	bool processRows(cmsHTRANSFORM output_color_transform_float, std::function<bool(uint32_t row, Worker &worker)> output, uint32_t start = 0);
+	//fits the missing strips of checkpoint_rows rows in nbands parallel bands, each with its own decoders and share of the nworkers, into folder.
+	//replay receives all the strips in order on the calling thread. Returns false if cancelled or failed (error is set).
+	bool processBands(QDir &folder, std::function<void(QFile &strip, uint32_t start, uint32_t rows)> replay);
 	void processLine(PixelArray &sample, PixelArray &resample, std::vector<std::vector<uint8_t>> &line,
 					 std::vector<uchar> &normal, std::vector<uchar> &mean, std::vector<uchar> &median,
 					 cmsHTRANSFORM output_color_transform_float = nullptr);
@@ -63,7 +105,9 @@ protected:
 	//grid of resamplemaps to be interpolated.
 	int resample_width = 15, resample_height = 15;
 	std::vector<Resamplemap> resamplemaps;  //for per pixel direction light interpolation
+	std::vector<Resamplemap> resamplecells; //(resample_width-1)*(resample_height-1) merged corners
 	std::vector<MaterialBuilder> materialbuilders;
+	bool blend_bases = false; //all the materialbuilders are plain projections and can be interpolated.
 
 	//TODO this should go inimageset!
 	//compute the 3d lights relative to the pixel x, y
@@ -71,9 +115,8 @@ protected:
 
 	void resamplePixel(Pixel &sample, Pixel &pixel);
 
-	void buildResampleMap(std::vector<Eigen::Vector3f> &lights, std::vector<std::vector<std::pair<int, float> > > &remap);
+	void buildResampleMap(std::vector<Eigen::Vector3f> &lights, Resamplemap &remap);
 	void buildResampleMaps();
-	void remapPixel(Pixel &sample, Pixel &pixel, Resamplemap &resamplemap, float weight);
 
 
 
@@ -87,6 +130,19 @@ protected:
 	void minmaxMaterial(PixelArray &sample);
 	void finalizeMaterial();
 
+	//images, lights and parameters the base depends on: a checkpoint is used only if the key matches.
+	QString checkpointKey();
+	QString stripsKey();
+	size_t stripRowSize();
+	void storeRow(QFile &strip, Worker &worker);
+	void prepareNormals();
+	//nworkers spread over nbands: number of fitting threads of a band.
+	uint32_t bandThreads(uint32_t band);
+	//fits free strips on threads workers until all are claimed, claims are strip_N.claim files created exclusively.
+	bool fitStrips(QDir &folder, std::atomic<bool> &stop, std::atomic<uint32_t> &fitted, uint32_t threads);
+	bool saveBasis(const QString &filename, const QString &key);
+	bool loadBasis(const QString &filename, const QString &key);
+
 
 
 	void estimateError(PixelArray &sample, std::vector<float> &weights);
@@ -107,6 +163,11 @@ protected:
 
 	std::vector<float> toPrincipal(Pixel &pixel, MaterialBuilder &materialbuilder);
 	std::vector<float> toPrincipal(Pixel &pixel);
+	//same as above writing nplanes values in res, tmp is scratch of nplanes values.
+	void toPrincipal(Pixel &pixel, MaterialBuilder &materialbuilder, float *res);
+	void toPrincipal(Pixel &pixel, float *res, float *tmp);
+	//bilinear blend of the projections of the 4 grid cells around px, py.
+	void interpolateBase(float px, float py, MaterialBuilder &base);
 
 };
 
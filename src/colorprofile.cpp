@@ -2,9 +2,31 @@
 #include "icc_profiles.h"
 
 #include <lcms2.h>
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
 
 namespace {
 
+//colorants as columns: rgb -> XYZ (D50 adapted, as stored in the profile).
+bool readMatrixShaper(cmsHPROFILE profile, Eigen::Matrix3d &rgb2xyz, cmsToneCurve *curves[3]) {
+	if(cmsGetColorSpace(profile) != cmsSigRgbData || !cmsIsMatrixShaper(profile))
+		return false;
+	cmsTagSignature colorants[3] = { cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag };
+	cmsTagSignature trcs[3] = { cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag };
+	for(int c = 0; c < 3; c++) {
+		cmsCIEXYZ *xyz = (cmsCIEXYZ *)cmsReadTag(profile, colorants[c]);
+		curves[c] = (cmsToneCurve *)cmsReadTag(profile, trcs[c]);
+		if(!xyz || !curves[c])
+			return false;
+		rgb2xyz(0, c) = xyz->X;
+		rgb2xyz(1, c) = xyz->Y;
+		rgb2xyz(2, c) = xyz->Z;
+	}
+	return true;
+}
+
 QString describeProfile(const std::vector<uint8_t> &profile_data, bool *is_rgb_out) {
 	if(profile_data.empty())
 		return "";
@@ -81,3 +103,87 @@ cmsHPROFILE ColorProfile::createOutputProfile(ColorProfileMode mode) {
 		return ICCProfiles::openLinearRGBProfile();
 	}
 }
+
+void ColorLut::clear() {
+	valid = false;
+	identity = false;
+	separable = true;
+	encoding.clear();
+}
+
+bool ColorLut::build(const std::vector<uint8_t> &profile_data, ColorProfileMode mode) {
+	clear();
+
+	cmsHPROFILE input = profile_data.empty() ? cmsCreate_sRGBProfile() : cmsOpenProfileFromMem(profile_data.data(), profile_data.size());
+	if(!input)
+		return false;
+	cmsHPROFILE output = ColorProfile::createOutputProfile(mode);
+	if(!output) {
+		cmsCloseProfile(input);
+		return false;
+	}
+
+	Eigen::Matrix3d in_matrix, out_matrix;
+	cmsToneCurve *in_curves[3], *out_curves[3];
+	//curves are owned by the profiles, must be used before closing them.
+	bool ok = readMatrixShaper(input, in_matrix, in_curves) && readMatrixShaper(output, out_matrix, out_curves);
+	if(ok) {
+		for(int c = 0; c < 3; c++)
+			for(int v = 0; v < 256; v++)
+				table[c][v] = cmsEvalToneCurveFloat(in_curves[c], v/255.0f);
+
+		//all 3 output curves are the same for the working spaces we support.
+		if(!cmsIsToneCurveLinear(out_curves[0])) {
+			cmsToneCurve *reverse = cmsReverseToneCurve(out_curves[0]);
+			if(!reverse) {
+				ok = false;
+			} else {
+				encoding.resize(4097);
+				for(size_t i = 0; i < encoding.size(); i++)
+					encoding[i] = 255.0f*cmsEvalToneCurveFloat(reverse, i/float(encoding.size() - 1));
+				cmsFreeToneCurve(reverse);
+			}
+		}
+	}
+	cmsCloseProfile(input);
+	cmsCloseProfile(output);
+	if(!ok) {
+		clear();
+		return false;
+	}
+
+	Eigen::Matrix3d m = out_matrix.inverse()*in_matrix;
+	separable = m.isDiagonal(1e-4) && (m.diagonal() - Eigen::Vector3d::Ones()).cwiseAbs().maxCoeff() < 1e-3;
+	if(separable) {
+		//fold the output encoding in the table
+		for(int c = 0; c < 3; c++)
+			for(int v = 0; v < 256; v++)
+				table[c][v] = encode(std::max(0.0f, std::min(1.0f, table[c][v])));
+	} else {
+		for(int r = 0; r < 3; r++)
+			for(int c = 0; c < 3; c++)
+				matrix[r*3 + c] = float(m(r, c));
+	}
+
+	//separable tables act on each channel independently: checking the grays is enough.
+	identity = separable;
+	float out[3];
+	for(int v = 0; v < 256 && identity; v++) {
+		uint8_t gray[3] = { uint8_t(v), uint8_t(v), uint8_t(v) };
+		apply(gray, out);
+		for(int c = 0; c < 3; c++)
+			if(fabs(out[c] - v) >= 0.5f)
+				identity = false;
+	}
+	valid = true;
+	return true;
+}
+
+void ColorLut::apply(uint8_t *data, size_t pixel_count) const {
+	float out[3];
+	for(size_t i = 0; i < pixel_count; i++, data += 3) {
+		apply(data, out);
+		for(int c = 0; c < 3; c++)
+			data[c] = uint8_t(std::max(0.0f, std::min(255.0f, out[c] + 0.5f)));
+	}
+}
@@ -28,4 +28,56 @@ public:
 	static cmsHPROFILE createOutputProfile(ColorProfileMode mode);
 };
 
+// Precomputed read path for matrix/shaper RGB profiles (sRGB, linear RGB, Display P3 and
+// most camera profiles): per channel 8 bit -> float tables, an optional 3x3 matrix and
+// an output encoding table. Stateless once built, so it can be used from many threads.
+class ColorLut {
+public:
+	// Returns false (and leaves the lut invalid) if either profile is not a matrix/shaper.
+	bool build(const std::vector<uint8_t> &profile_data, ColorProfileMode mode);
+	void clear();
+
+	bool isValid() const { return valid; }
+	// The transform does not change any 8 bit value: callers should skip it altogether.
+	bool isIdentity() const { return identity; }
+
+	// rgb: 8 bit input pixel; out: 3 floats in [0, 255], not quantized.
+	inline void apply(const uint8_t *rgb, float *out) const {
+		if(separable) {
+			out[0] = table[0][rgb[0]];
+			out[1] = table[1][rgb[1]];
+			out[2] = table[2][rgb[2]];
+			return;
+		}
+		float r = table[0][rgb[0]];
+		float g = table[1][rgb[1]];
+		float b = table[2][rgb[2]];
+		for(int k = 0; k < 3; k++) {
+			float v = matrix[k*3 + 0]*r + matrix[k*3 + 1]*g + matrix[k*3 + 2]*b;
+			out[k] = encode(v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v));
+		}
+	}
+	// In place, rounded back to 8 bit.
+	void apply(uint8_t *data, size_t pixel_count) const;
+
+private:
+	bool valid = false;
+	bool identity = false;
+	bool separable = true;      // no matrix: table maps directly to the output encoding.
+	float table[3][256];        // separable: 8 bit -> [0, 255] output; otherwise 8 bit -> linear [0, 1]
+	float matrix[9];
+	std::vector<float> encoding; // linear [0, 1] -> [0, 255] output, empty if the target is linear.
+
+	inline float encode(float v) const {
+		if(encoding.empty())
+			return v*255.0f;
+		float f = v*(encoding.size() - 1);
+		size_t i = size_t(f);
+		if(i >= encoding.size() - 1)
+			return encoding.back();
+		float d = f - i;
+		return encoding[i]*(1.0f - d) + encoding[i + 1]*d;
+	}
+};
+
 #endif // COLORPROFILE_H
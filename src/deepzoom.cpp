@@ -57,9 +57,7 @@ std::vector<uint8_t> downsampleGaussian(const std::vector<uint8_t> &src, int wid
 	return out;
 }
 
-bool writeTiffLevel(TIFF *tif, const std::vector<uint8_t> &data, int width, int height, int tileside, int levelIndex, int levelCount, int quality) {
-	if(!tif)
-		return false;
+void setTiffFields(TIFF *tif, int width, int height, int tileside, int levelIndex, int levelCount, int quality) {
 	TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, static_cast<uint32_t>(width));
 	TIFFSetField(tif, TIFFTAG_IMAGELENGTH, static_cast<uint32_t>(height));
 	TIFFSetField(tif, TIFFTAG_TILEWIDTH, tileside);
@@ -73,25 +71,38 @@ bool writeTiffLevel(TIFF *tif, const std::vector<uint8_t> &data, int width, int
 	TIFFSetField(tif, TIFFTAG_SUBFILETYPE, levelIndex == 0 ? 0 : FILETYPE_REDUCEDIMAGE);
 	TIFFSetField(tif, TIFFTAG_PAGENUMBER, levelIndex, levelCount);
 	TIFFSetField(tif, TIFFTAG_SOFTWARE, "relight");
+}
 
+//one row of tiles (ty) from a band of rows (at most tileside) of the image.
+bool writeTiffTiles(TIFF *tif, const uint8_t *band, int width, int rows, int tileside, int ty) {
 	int tilesX = (width + tileside - 1) / tileside;
-	int tilesY = (height + tileside - 1) / tileside;
 	size_t tileSize = static_cast<size_t>(tileside) * static_cast<size_t>(tileside) * 3;
 	std::vector<uint8_t> tileBuf(tileSize, 0);
-	for(int ty = 0; ty < tilesY; ++ty) {
-		for(int tx = 0; tx < tilesX; ++tx) {
-			std::fill(tileBuf.begin(), tileBuf.end(), 0);
-			int copyH = std::min(tileside, height - ty*tileside);
-			int copyW = std::min(tileside, width - tx*tileside);
-			for(int row = 0; row < copyH; ++row) {
-				const uint8_t *src = &data[((ty*tileside + row) * width + tx*tileside)*3];
-				uint8_t *dst = &tileBuf[row * tileside * 3];
-				std::memcpy(dst, src, static_cast<size_t>(copyW) * 3);
-			}
-			tsize_t tIndex = TIFFComputeTile(tif, tx*tileside, ty*tileside, 0, 0);
-			if(TIFFWriteEncodedTile(tif, tIndex, tileBuf.data(), tileBuf.size()) == -1)
-				return false;
+	for(int tx = 0; tx < tilesX; ++tx) {
+		std::fill(tileBuf.begin(), tileBuf.end(), 0);
+		int copyW = std::min(tileside, width - tx*tileside);
+		for(int row = 0; row < rows; ++row) {
+			const uint8_t *src = band + (static_cast<size_t>(row) * width + tx*tileside)*3;
+			uint8_t *dst = &tileBuf[row * tileside * 3];
+			std::memcpy(dst, src, static_cast<size_t>(copyW) * 3);
 		}
+		tsize_t tIndex = TIFFComputeTile(tif, tx*tileside, ty*tileside, 0, 0);
+		if(TIFFWriteEncodedTile(tif, tIndex, tileBuf.data(), tileBuf.size()) == -1)
+			return false;
+	}
+	return true;
+}
+
+bool writeTiffLevel(TIFF *tif, const std::vector<uint8_t> &data, int width, int height, int tileside, int levelIndex, int levelCount, int quality) {
+	if(!tif)
+		return false;
+	setTiffFields(tif, width, height, tileside, levelIndex, levelCount, quality);
+
+	int tilesY = (height + tileside - 1) / tileside;
+	for(int ty = 0; ty < tilesY; ++ty) {
+		int rows = std::min(tileside, height - ty*tileside);
+		if(!writeTiffTiles(tif, &data[static_cast<size_t>(ty)*tileside*width*3], width, rows, tileside, ty))
+			return false;
 	}
 	TIFFWriteDirectory(tif);
 	return true;
@@ -280,11 +291,18 @@ void TileRow::nextRow() {
 	end_tile = std::min(height, (current_row+1)*tileside + overlap);
 	int h = end_tile - start_tile;
 
+	//tiled tiff tiles are written by DeepZoom, only the scaled lines are needed.
+	if(layout.format == PyramidFormat::TiledTiff)
+		return;
+
+	//the memory encoder keeps a pointer to jpeg_data: tiles must not move once initialized.
+	reserve(width/tileside + 2);
 	int col = 0;
 	int start = 0;
 	do {
 		int end = std::min((col+1)*tileside + overlap, width);
-		Tile tile;
+		push_back(Tile());
+		Tile &tile = back();
 		tile.width = end - start;
 		tile.encoder = new JpegEncoder();
 		tile.encoder->setQuality(quality);
@@ -297,7 +315,6 @@ void TileRow::nextRow() {
 			QDir().mkpath(info.path());
 			tile.encoder->init(filepath.toStdString().c_str(), tile.width, h);
 		}
-		push_back(tile);
 
 		col++;
 		start = std::max(0, col*tileside - overlap);
@@ -310,28 +327,69 @@ void TileRow::nextRow() {
 	overlapping.clear();
 }
 
+DeepZoom::~DeepZoom() {
+	if(tif)
+		TIFFClose(tif);
+}
+
 bool DeepZoom::build(QString input, QString _output, int tile_size, int _overlap, PyramidFormat format) {
+	JpegDecoder decoder;
+	int w = 0, h = 0;
+	if(!decoder.init(input.toStdString().c_str(), w, h))
+		return false;
+
+	if(!begin(_output, w, h, tile_size, _overlap, format))
+		return false;
+
+	std::vector<uint8_t> line(w * 3);
+	for(int y = 0; y < h; ++y) {
+		decoder.readRows(1, line.data());
+		addLine(line);
+	}
+	return end();
+}
+
+bool DeepZoom::begin(QString _output, int _width, int _height, int tile_size, int _overlap, PyramidFormat format) {
 	output = _output;
+	width = _width;
+	height = _height;
 	tileside = tile_size;
 	overlap = _overlap;
 	layoutFormat = format;
 	tileSuffix = ".jpg";
-
-	// Ensure tile size is multiple of 16 for JPEG compression
-	if(format == PyramidFormat::TiledTiff && (tileside % 16) != 0) {
-		tileside = ((tileside + 15) / 16) * 16;
-	}
+	inputLine = 0;
 
 	if(format == PyramidFormat::TiledTiff) {
-		return buildTiledTiff(input);
-	}
-	return buildTiledImages(input);
-}
+		// Ensure tile size is multiple of 16 for JPEG compression
+		if((tileside % 16) != 0)
+			tileside = ((tileside + 15) / 16) * 16;
+
+		tiffLevels = 1;
+		int w = width;
+		int h = height;
+		while((w > tileside || h > tileside) && w >= 2 && h >= 2) {
+			w >>= 1;
+			h >>= 1;
+			tiffLevels++;
+		}
 
-bool DeepZoom::buildTiledImages(QString input) {
-	JpegDecoder decoder;
-	if(!decoder.init(input.toStdString().c_str(), width, height))
-		return false;
+		QString path = output + ".tif";
+		tif = TIFFOpen(path.toStdString().c_str(), "w8");
+		if(!tif)
+			return false;
+		tiffFailed = false;
+		setTiffFields(tif, width, height, tileside, 0, tiffLevels, quality);
+		tiffBand.assign(static_cast<size_t>(tileside) * width * 3, 0);
+		tiffReduced.clear();
+
+		rows.clear();
+		if(tiffLevels > 1) {
+			TileRowConfig config;
+			config.format = PyramidFormat::TiledTiff;
+			rows.emplace_back(tileside, 0, config, width, height, quality);
+		}
+		return true;
+	}
 
 	switch(layoutFormat) {
 	case PyramidFormat::DeepZoom:
@@ -353,23 +411,40 @@ bool DeepZoom::buildTiledImages(QString input) {
 		QDir().mkpath(layoutRoot);
 
 	initRows();
+	return true;
+}
 
-	std::vector<uint8_t> line(width * 3);
-	std::vector<uint8_t> carry;
+void DeepZoom::addLine(const std::vector<uint8_t> &line) {
+	if(layoutFormat == PyramidFormat::TiledTiff) {
+		int row = inputLine % tileside;
+		std::memcpy(tiffBand.data() + static_cast<size_t>(row) * width * 3, line.data(), static_cast<size_t>(width) * 3);
+		if(row == tileside - 1 || inputLine == height - 1)
+			tiffFailed |= !writeTiffTiles(tif, tiffBand.data(), width, row + 1, tileside, inputLine / tileside);
 
-	for(int y = 0; y < height; ++y) {
-		decoder.readRows(1, line.data());
-		const std::vector<uint8_t> *current = &line;
-		carry.clear();
-		for(size_t level = 0; level < rows.size(); ++level) {
-			std::vector<uint8_t> next = rows[level].addLine(*current);
-			if(next.empty())
-				break;
-			carry = std::move(next);
-			current = &carry;
+		if(rows.size()) {
+			std::vector<uint8_t> scaled = rows[0].addLine(line);
+			tiffReduced.insert(tiffReduced.end(), scaled.begin(), scaled.end());
 		}
+		inputLine++;
+		return;
 	}
 
+	const std::vector<uint8_t> *current = &line;
+	std::vector<uint8_t> carry;
+	for(size_t level = 0; level < rows.size(); ++level) {
+		std::vector<uint8_t> next = rows[level].addLine(*current);
+		if(next.empty())
+			break;
+		carry = std::move(next);
+		current = &carry;
+	}
+	inputLine++;
+}
+
+bool DeepZoom::end() {
+	if(layoutFormat == PyramidFormat::TiledTiff)
+		return finishTiledTiff();
+
 	flushLevels();
 	finalizeMetadata();
 	return true;
@@ -396,6 +471,7 @@ void DeepZoom::initRows() {
 	zoomifyOffsets.clear();
 
 	int levels = nLevels();
+	rows.reserve(levels); //tiles hold pointers to their buffers, rows must not be relocated.
 	tilesX.resize(levels);
 	tilesY.resize(levels);
 	zoomifyOffsets.resize(levels);
@@ -533,54 +609,36 @@ void DeepZoom::finalizeMetadata() {
 	}
 }
 
-bool DeepZoom::buildTiledTiff(QString input) {
-	JpegDecoder decoder;
-	if(!decoder.init(input.toStdString().c_str(), width, height))
-		return false;
-
-	std::vector<uint8_t> levelData(static_cast<size_t>(width) * static_cast<size_t>(height) * 3);
-	for(int y = 0; y < height; ++y) {
-		decoder.readRows(1, levelData.data() + static_cast<size_t>(y) * width * 3);
-	}
-
-	std::vector<std::vector<uint8_t>> pyramid;
-	std::vector<int> widthsCascade;
-	std::vector<int> heightsCascade;
-	pyramid.push_back(std::move(levelData));
-	widthsCascade.push_back(width);
-	heightsCascade.push_back(height);
-
-	int currentW = width;
-	int currentH = height;
-	while(currentW > tileside || currentH > tileside) {
-		if(currentW < 2 || currentH < 2)
-			break;
-		const std::vector<uint8_t> &src = pyramid.back();
-		std::vector<uint8_t> down = downsampleGaussian(src, currentW, currentH);
-		currentW = std::max(1, currentW >> 1);
-		currentH = std::max(1, currentH >> 1);
-		if(down.empty())
-			break;
-		pyramid.push_back(std::move(down));
-		widthsCascade.push_back(currentW);
-		heightsCascade.push_back(currentH);
-	}
+bool DeepZoom::finishTiledTiff() {
+	bool ok = !tiffFailed;
+	TIFFWriteDirectory(tif);
 
-	QString path = output + ".tif";
-	TIFF *tif = TIFFOpen(path.toStdString().c_str(), "w8");
-	if(!tif)
-		return false;
-	bool ok = true;
-	for(size_t level = 0; level < pyramid.size() && ok; ++level) {
-		ok = writeTiffLevel(tif,
-			pyramid[level],
-			widthsCascade[level],
-			heightsCascade[level],
-			tileside,
-			static_cast<int>(level),
-			static_cast<int>(pyramid.size()),
-			quality);
+	if(rows.size()) {
+		rows[0].finalizeInput();
+		while(true) {
+			std::vector<uint8_t> pending = rows[0].drainScaledLine();
+			if(pending.empty())
+				break;
+			tiffReduced.insert(tiffReduced.end(), pending.begin(), pending.end());
+		}
+		rows.clear();
+	}
+
+	//reduced levels are small enough to be kept in memory.
+	std::vector<uint8_t> level = std::move(tiffReduced);
+	int currentW = std::max(1, width >> 1);
+	int currentH = std::max(1, height >> 1);
+	for(int l = 1; l < tiffLevels && ok; ++l) {
+		ok = writeTiffLevel(tif, level, currentW, currentH, tileside, l, tiffLevels, quality);
+		if(l + 1 < tiffLevels) {
+			level = downsampleGaussian(level, currentW, currentH);
+			currentW = std::max(1, currentW >> 1);
+			currentH = std::max(1, currentH >> 1);
+		}
 	}
 	TIFFClose(tif);
+	tif = nullptr;
+	std::vector<uint8_t>().swap(tiffBand);
+	tiffReduced.clear();
 	return ok;
 }
@@ -9,6 +9,7 @@
 #include <QString>
 
 class JpegEncoder;
+typedef struct tiff TIFF;
 
 enum class PyramidFormat {
 	DeepZoom,
@@ -98,8 +99,15 @@ public:
 	int width, height;
 	int quality; //0 100 jpeg quality
 	QString output;
+	~DeepZoom();
 	bool build(QString filename, QString basename, int tile_size = 254, int overlap = 1, PyramidFormat format = PyramidFormat::DeepZoom);
 
+	//streaming input: begin, addLine for each row top to bottom, end. Only a few rows per level are kept in memory
+	//(tiled tiff keeps the reduced levels, 1/3 of the full image, as the directories are written one after the other).
+	bool begin(QString basename, int width, int height, int tile_size = 254, int overlap = 1, PyramidFormat format = PyramidFormat::DeepZoom);
+	void addLine(const std::vector<uint8_t> &line);
+	bool end();
+
 private:
 	std::vector<TileRow> rows;      //one row per level
 	std::vector<int> heights;
@@ -113,12 +121,20 @@ private:
 	std::vector<size_t> tzbOffsets; //position of the tile in the file for tzb
 	std::vector<std::vector<uint8_t>> tzbTiles; //buffered encoded tiles for tzb
 
+	//tiled tiff: level 0 tiles are written every tileside rows, TileRow only provides the scaled lines.
+	TIFF *tif = nullptr;
+	int tiffLevels = 0;
+	int inputLine = 0;
+	bool tiffFailed = false;
+	std::vector<uint8_t> tiffBand;
+	std::vector<uint8_t> tiffReduced; //level 1
+
 	int nLevels();
 	void initRows();
-	bool buildTiledImages(QString input);
-	bool buildTiledTiff(QString input);
 	void finalizeMetadata();
 	void flushLevels();
+	bool writeTiffBand(int ty, int rows);
+	bool finishTiledTiff();
 };
 
 #endif // DEEPZOOM_H
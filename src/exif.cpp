@@ -364,6 +364,28 @@ bool Exif::patchOrientation(QByteArray &payload, quint16 newOrientation) {
 	return false;
 }
 
+QByteArray Exif::preview(const QString &filename, int min_height) {
+	try {
+		auto image = Exiv2::ImageFactory::open(filename.toStdString());
+		if (!image.get())
+			return QByteArray();
+		image->readMetadata();
+
+		Exiv2::PreviewManager manager(*image);
+		//sorted by increasing size
+		for(auto &props: manager.getPreviewProperties()) {
+			if(int(props.height_) < min_height)
+				continue;
+			Exiv2::PreviewImage preview = manager.getPreviewImage(props);
+			return QByteArray((const char *)preview.pData(), int(preview.size()));
+		}
+	} catch (const Exiv2::Error &e) {
+		(void)e;
+	} catch (...) {
+	}
+	return QByteArray();
+}
+
 bool Exif::patchOrientationFile(const QString &filename, quint16 newOrientation) {
 	try {
 		auto image = Exiv2::ImageFactory::open(filename.toStdString());
@@ -375,6 +397,9 @@ bool Exif::patchOrientationFile(const QString &filename, quint16 newOrientation)
 
 		// Set the Orientation tag. Exiv2 accepts integer assignment for this tag.
 		ed["Exif.Image.Orientation"] = static_cast<int>(newOrientation);
+		// The pixels have been rotated, the embedded thumbnail has not.
+		Exiv2::ExifThumb thumb(ed);
+		thumb.erase();
 
 		image->setExifData(ed);
 		image->writeMetadata();
@@ -291,6 +291,8 @@ public:
 	} */
 
 	void parse(const QString &filename);
+	//smallest embedded preview (exif thumbnail or camera preview) at least min_height tall, null if none.
+	static QByteArray preview(const QString &filename, int min_height);
 
 	static quint16 rotateOrientation(quint16 orientation, bool clockwise);
 	static bool extractApp1Payload(const QString &filename, QByteArray &payload);
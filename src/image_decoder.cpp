@@ -84,6 +84,14 @@ size_t ImageDecoderImpl::readRows(int rows, float* buffer) {
 	return read;
 }
 
+size_t ImageDecoderImpl::skipRows(int rows) {
+	std::vector<uint8_t> tmp(rowSize());
+	size_t skipped = 0;
+	while (int(skipped) < rows && readRows(1, tmp.data()) == 1)
+		++skipped;
+	return skipped;
+}
+
 // ══════════════════════════════════════════════════════════════════════════════
 // JpegDecoderImpl — wraps the existing JpegDecoder
 // ══════════════════════════════════════════════════════════════════════════════
@@ -106,6 +114,10 @@ struct JpegDecoderImpl : ImageDecoderImpl {
 	}
 	// float readRows: inherits the default uint8→float conversion from ImageDecoderImpl
 
+	size_t skipRows(int rows) override {
+		return dec.skipRows(rows);
+	}
+
 	bool finish()  override { return dec.finish();  }
 	bool restart() override { return dec.restart(); }
 
@@ -276,6 +288,10 @@ size_t ImageDecoder::readRows(int rows, float* buf) {
 	return impl ? impl->readRows(rows, buf) : 0;
 }
 
+size_t ImageDecoder::skipRows(int rows) {
+	return impl ? impl->skipRows(rows) : 0;
+}
+
 bool ImageDecoder::finish()  { return impl ? impl->finish()  : false; }
 bool ImageDecoder::restart() { return impl ? impl->restart() : false; }
 
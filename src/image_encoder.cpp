@@ -1,11 +1,47 @@
 #include "image_encoder.h"
 #include "image_decoder.h"
 #include "jpeg_encoder.h"
+#include "tinyexr.h"
 #include <tiffio.h>
+#include <png.h>
 
 #include <cstring>
+#include <cstdio>
 #include <algorithm>
 
+size_t ImageEncoderImpl::writeRows(int /*rows*/, const float* /*buffer*/) {
+    return 0;
+}
+
+// Native host byte order check for 16-bit samples.
+static bool littleEndian() {
+    const uint16_t probe = 0x0100u;
+    return reinterpret_cast<const uint8_t*>(&probe)[0] == 0x01u;
+}
+
+static size_t sampleBytes(PixelType type) {
+    switch(type) {
+        case PixelType::UINT16:  return 2;
+        case PixelType::FLOAT16: return 2;
+        case PixelType::FLOAT32: return 4;
+        default:                 return 1;
+    }
+}
+
+// Convert normalised floats to raw samples of the given type (FLOAT16 is not handled here).
+static void floatToSamples(PixelType type, const float* src, size_t n, uint8_t* dst) {
+    if(type == PixelType::FLOAT32) {
+        memcpy(dst, src, n * sizeof(float));
+    } else if(type == PixelType::UINT16) {
+        uint16_t* out = reinterpret_cast<uint16_t*>(dst);
+        for(size_t i = 0; i < n; ++i)
+            out[i] = uint16_t(std::clamp(int(src[i] * 65535.0f + 0.5f), 0, 65535));
+    } else {
+        for(size_t i = 0; i < n; ++i)
+            dst[i] = uint8_t(std::clamp(int(src[i] * 255.0f + 0.5f), 0, 255));
+    }
+}
+
 // Simple JPEG-backed implementation of ImageEncoderImpl
 class JpegImpl : public ImageEncoderImpl {
 public:
@@ -147,7 +183,8 @@ public:
         TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32_t)width);
         TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)height);
         TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)channels);
-        TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)8);
+        TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)(8 * sampleBytes(type)));
+        TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, type == PixelType::FLOAT32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
         TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
         TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
         TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)height);
@@ -160,7 +197,7 @@ public:
     }
 
     size_t rowSize() const override {
-        return size_t(width) * size_t(channels);
+        return size_t(width) * size_t(channels) * sampleBytes(type);
     }
 
     size_t writeRows(int rows, const uint8_t* buffer) override {
@@ -178,9 +215,18 @@ public:
         return written;
     }
 
-    size_t writeRows(int rows, const float* /*buffer*/) override {
-        // Not implemented for float data
-        return 0;
+    size_t writeRows(int rows, const float* buffer) override {
+        if(!tif) return 0;
+        size_t n = size_t(width) * size_t(channels);
+        std::vector<uint8_t> row(rowSize());
+        int written = 0;
+        for(int r = 0; r < rows; ++r) {
+            floatToSamples(type, buffer + size_t(r) * n, n, row.data());
+            if(writeRows(1, row.data()) != 1)
+                break;
+            ++written;
+        }
+        return written;
     }
 
     bool finish() override {
@@ -192,18 +238,214 @@ public:
     }
 
     int numChannels() const override { return channels; }
-    PixelType pixelType() const override { return PixelType::UINT8; }
+    PixelType pixelType() const override { return type; }
 
     bool setICCProfile(const std::vector<uint8_t>& /*profile*/) override { return false; }
 
+    bool setPixelType(PixelType t) override {
+        if(t == PixelType::FLOAT16) return false;
+        type = t;
+        return true;
+    }
+
 private:
     TIFF* tif = nullptr;
+    PixelType type = PixelType::UINT8;
     int width = 0;
     int height = 0;
     int channels = 3;
     int current_row = 0;
 };
 
+// libpng backed implementation of ImageEncoderImpl, 8 or 16 bit.
+class PngImpl : public ImageEncoderImpl {
+public:
+    PngImpl() {}
+    ~PngImpl() { finish(); }
+
+    bool open(const char* path, int width, int height, int numChannels) override {
+        this->width = width;
+        this->height = height;
+        this->channels = numChannels;
+
+        int color_type;
+        switch(numChannels) {
+            case 1: color_type = PNG_COLOR_TYPE_GRAY; break;
+            case 2: color_type = PNG_COLOR_TYPE_GRAY_ALPHA; break;
+            case 3: color_type = PNG_COLOR_TYPE_RGB; break;
+            case 4: color_type = PNG_COLOR_TYPE_RGB_ALPHA; break;
+            default: return false;
+        }
+
+        file = fopen(path, "wb");
+        if(!file) return false;
+
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        if(png)
+            info = png_create_info_struct(png);
+        if(!png || !info) {
+            cleanup();
+            return false;
+        }
+        if(setjmp(png_jmpbuf(png))) {
+            cleanup();
+            return false;
+        }
+        png_init_io(png, file);
+        png_set_IHDR(png, info, width, height, int(8 * sampleBytes(type)), color_type,
+                     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, info);
+        // PNG stores 16-bit samples big-endian, buffers are in native order.
+        if(type == PixelType::UINT16 && littleEndian())
+            png_set_swap(png);
+        current_row = 0;
+        return true;
+    }
+
+    size_t rowSize() const override {
+        return size_t(width) * size_t(channels) * sampleBytes(type);
+    }
+
+    size_t writeRows(int rows, const uint8_t* buffer) override {
+        if(!png) return 0;
+        if(setjmp(png_jmpbuf(png)))
+            return 0;
+        size_t rsize = rowSize();
+        int written = 0;
+        for(int r = 0; r < rows && current_row < height; ++r) {
+            png_write_row(png, const_cast<png_bytep>(buffer + size_t(r) * rsize));
+            ++current_row;
+            ++written;
+        }
+        return written;
+    }
+
+    size_t writeRows(int rows, const float* buffer) override {
+        if(!png) return 0;
+        size_t n = size_t(width) * size_t(channels);
+        std::vector<uint8_t> row(rowSize());
+        int written = 0;
+        for(int r = 0; r < rows; ++r) {
+            floatToSamples(type, buffer + size_t(r) * n, n, row.data());
+            if(writeRows(1, row.data()) != 1)
+                break;
+            ++written;
+        }
+        return written;
+    }
+
+    bool finish() override {
+        if(!png) return true;
+        bool complete = current_row == height;
+        if(complete) {
+            if(setjmp(png_jmpbuf(png))) {
+                cleanup();
+                return false;
+            }
+            png_write_end(png, info);
+        }
+        cleanup();
+        return complete;
+    }
+
+    int numChannels() const override { return channels; }
+    PixelType pixelType() const override { return type; }
+
+    bool setPixelType(PixelType t) override {
+        if(t != PixelType::UINT8 && t != PixelType::UINT16) return false;
+        type = t;
+        return true;
+    }
+
+private:
+    void cleanup() {
+        if(png)
+            png_destroy_write_struct(&png, info ? &info : nullptr);
+        png = nullptr;
+        info = nullptr;
+        if(file) { fclose(file); file = nullptr; }
+    }
+
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+    FILE* file = nullptr;
+    PixelType type = PixelType::UINT8;
+    int width = 0;
+    int height = 0;
+    int channels = 3;
+    int current_row = 0;
+};
+
+// tinyexr backed implementation of ImageEncoderImpl.
+// tinyexr has no streaming writer: rows are collected and saved on finish().
+class ExrImpl : public ImageEncoderImpl {
+public:
+    ExrImpl() {}
+    ~ExrImpl() { finish(); }
+
+    bool open(const char* path, int width, int height, int numChannels) override {
+        if(numChannels != 1 && numChannels != 3 && numChannels != 4) return false;
+        this->path = path;
+        this->width = width;
+        this->height = height;
+        this->channels = numChannels;
+        data.clear();
+        data.reserve(size_t(width) * height * numChannels);
+        pending = true;
+        return true;
+    }
+
+    // uint8_t buffers hold raw floats.
+    size_t rowSize() const override {
+        return size_t(width) * size_t(channels) * sizeof(float);
+    }
+
+    size_t writeRows(int rows, const uint8_t* buffer) override {
+        size_t n = size_t(width) * size_t(channels);
+        rows = std::min(rows, height - int(data.size() / n));
+        if(!pending || rows <= 0) return 0;
+        size_t offset = data.size();
+        data.resize(offset + n * rows);
+        memcpy(data.data() + offset, buffer, n * rows * sizeof(float));
+        return rows;
+    }
+
+    size_t writeRows(int rows, const float* buffer) override {
+        return writeRows(rows, reinterpret_cast<const uint8_t*>(buffer));
+    }
+
+    bool finish() override {
+        if(!pending) return true;
+        pending = false;
+        if(data.size() != size_t(width) * height * channels)
+            return false;
+        const char* err = nullptr;
+        int ret = SaveEXR(data.data(), width, height, channels, type == PixelType::FLOAT16 ? 1 : 0, path.c_str(), &err);
+        if(err)
+            FreeEXRErrorMessage(err);
+        data = std::vector<float>();
+        return ret == TINYEXR_SUCCESS;
+    }
+
+    int numChannels() const override { return channels; }
+    PixelType pixelType() const override { return type; }
+
+    bool setPixelType(PixelType t) override {
+        if(t != PixelType::FLOAT16 && t != PixelType::FLOAT32) return false;
+        type = t;
+        return true;
+    }
+
+private:
+    std::string path;
+    std::vector<float> data;
+    PixelType type = PixelType::FLOAT16;
+    bool pending = false;
+    int width = 0;
+    int height = 0;
+    int channels = 3;
+};
+
 // ---------------------------------------------------------------------------
 // ImageEncoder implementation
 // ---------------------------------------------------------------------------
@@ -221,11 +463,9 @@ bool ImageEncoder::encode(const char* path, const uint8_t* img, int width, int h
 
     if(!impl->open(path, width, height, numChannels)) return false;
 
-    size_t rowBytes = size_t(width) * size_t(numChannels);
     // write all rows at once if backend supports it
-    impl->writeRows(height, img);
-    impl->finish();
-    return true;
+    bool ok = impl->writeRows(height, img) == size_t(height);
+    return impl->finish() && ok;
 }
 
 bool ImageEncoder::encodeToMemory(std::vector<uint8_t>& output, const uint8_t* img, int width, int height, int numChannels) {
@@ -276,9 +516,9 @@ size_t ImageEncoder::writeRows(int rows, const float* buffer) {
 
 bool ImageEncoder::finish() {
     if(!impl) return true;
-    impl->finish();
+    bool ok = impl->finish();
     impl.reset();
-    return true;
+    return ok;
 }
 
 int ImageEncoder::numChannels() const {
@@ -342,19 +582,17 @@ bool ImageEncoder::createImpl(const char* path) {
         }
     }
 
-    // JPEG and TIFF implemented
-    if(fmt == ImageFormat::JPEG) {
-        impl.reset(new JpegImpl());
-        format = ImageFormat::JPEG;
-        return true;
+    switch(fmt) {
+        case ImageFormat::JPEG: impl.reset(new JpegImpl()); break;
+        case ImageFormat::TIFF: impl.reset(new TiffImpl()); break;
+        case ImageFormat::PNG:  impl.reset(new PngImpl());  break;
+        case ImageFormat::EXR:  impl.reset(new ExrImpl());  break;
+        default: return false;  // other formats not implemented yet
     }
-
-    if(fmt == ImageFormat::TIFF) {
-        impl.reset(new TiffImpl());
-        format = ImageFormat::TIFF;
-        return true;
+    format = fmt;
+    if(!impl->setPixelType(requested_type)) {
+        impl.reset();
+        return false;
     }
-
-    // other formats not implemented yet
-    return false;
+    return true;
 }
@@ -39,6 +39,9 @@ struct ImageEncoderImpl {
 
     // Optional: embed ICC profile. Returns false when unsupported.
     virtual bool setICCProfile(const std::vector<uint8_t>& profile) { return false; }
+
+    // Sample type written to file, called before open(). Returns false when unsupported.
+    virtual bool setPixelType(PixelType type) { return type == PixelType::UINT8; }
 };
 
 // ──────────────────────────────────────────────────────────────────────────────
@@ -57,6 +60,12 @@ public:
     void        setFormat(ImageFormat fmt);
     ImageFormat getFormat() const { return format; }
 
+    // Sample type written to file (default UINT8). Call before init() or encode().
+    // PNG: UINT8/UINT16, TIFF: UINT8/UINT16/FLOAT32, EXR: FLOAT16/FLOAT32.
+    // uint8_t buffers are raw native samples (rowSize() bytes per row),
+    // float buffers are normalised to [0,1] for integer types and written as is otherwise.
+    void        setPixelType(PixelType type) { requested_type = type; }
+
     // Full-image encode (uint8_t buffer). Returns true on success.
     // `img` is expected to be interleaved RGB/RGBA/Gray, row-major.
     bool encode(const char* path, const uint8_t* img, int width, int height, int numChannels);
@@ -89,6 +98,7 @@ private:
     bool createImpl(const char* path);
 
     ImageFormat format = ImageFormat::UNKNOWN;
+    PixelType requested_type = PixelType::UINT8;
     int img_width  = 0;
     int img_height = 0;
     std::unique_ptr<ImageEncoderImpl> impl;
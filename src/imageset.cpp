@@ -5,6 +5,7 @@
 #include "colorprofile.h"
 #include "icc_profiles.h"
 #include "exif.h"
+#include "relight_threadpool.h"
 
 #include <QDir>
 #include <QFile>
@@ -14,9 +15,13 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QVariant>
+#include <QThread>
 
 #include <string>
+#include <cstring>
+#include <cmath>
 #include <set>
+#include <random>
 #include <iostream>
 
 
@@ -232,6 +237,7 @@ bool ImageSet::initImages(const char *_path,  Project::ForcedInputColorspace for
 #endif
 
 	QDir dir(_path);
+	path = dir.absolutePath();
 	icc_profile_data.clear();
 	bool first = true;
 	bool has_profile = false;
@@ -392,83 +398,208 @@ Vector3f ImageSet::relativeLight(const Vector3f &light3d, int x, int y){
 	return l;
 }
 void ImageSet::compensateVignetting(PixelArray &pixels) {
+	for(Pixel &pixel: pixels)
+		compensateVignetting(pixel);
+}
+
+void ImageSet::compensateVignetting(Pixel &pixel) {
     if(!compensateVignettingEnabled)
         return;
 	if(!lens.focalLength) //this should not really happens.
 		return;
-	for(Pixel &pixel: pixels) {
-		float angle = lens.viewAngle(pixel.x, pixel.y);
-		float f = 1/pow(cos(angle), 4);
-		for(size_t i = 0; i < pixel.size(); i++) {
-			pixel[i].r *= f;
-			pixel[i].g *= f;
-			pixel[i].b *= f;
-		}
+	float angle = lens.viewAngle(pixel.x, pixel.y);
+	float f = 1/pow(cos(angle), 4);
+	for(size_t i = 0; i < pixel.size(); i++) {
+		pixel[i].r *= f;
+		pixel[i].g *= f;
+		pixel[i].b *= f;
 	}
 }
 
 void ImageSet::compensateIntensity(PixelArray &pixels) {
+	assert(compensateIntensityEnabled == false || pixels.nlights == lights1.size());
+	for(Pixel &pixel: pixels)
+		compensateIntensity(pixel);
+}
+
+void ImageSet::compensateIntensity(Pixel &pixel) {
 	if(!compensateIntensityEnabled)
 		return;
 	assert(pixel_size != 0.0f);
 	assert(lights1.size() == size_t(images.size()));
-	assert(lights1.size() == pixels.nlights);
-	for(Pixel &pixel: pixels) {
-		for(size_t i = 0; i < pixel.size(); i++) {
-			Vector3f l = relativeLight(lights1[i], pixel.x, pixel.y);
-			float f = l.squaredNorm() / idealLightDistance2;
-			pixel[i].r *= f;
-			pixel[i].g *= f;
-			pixel[i].b *= f;
-		}
+	for(size_t i = 0; i < pixel.size(); i++) {
+		Vector3f l = relativeLight(lights1[i], pixel.x, pixel.y);
+		float f = l.squaredNorm() / idealLightDistance2;
+		pixel[i].r *= f;
+		pixel[i].g *= f;
+		pixel[i].b *= f;
 	}
 }
 
 void ImageSet::readLine(PixelArray &pixels) {
+	//TODO: no need to allocate EVERY time.
+	std::vector<uint8_t> raw;
+	int line = readRawLine(raw);
+	convertLine(raw, line, pixels);
+}
+
+int ImageSet::readRawLine(std::vector<uint8_t> &raw) {
 	if(current_line == 0)
 		skipToTop();
-	pixels.resize(width, images.size());
-	for(uint32_t x = 0; x < pixels.size(); x++) {
-		Pixel &pixel = pixels[x];
-		pixel.x = x + left;
-		pixel.y = image_height - 1 - current_line;
+
+	size_t row_size = size_t(image_width)*3;
+	raw.resize(raw_rows*row_size*decoders.size());
+	for(size_t i = 0; i < decoders.size(); i++)
+		readRawRow(i, raw.data() + i*raw_rows*row_size);
+	return current_line++;
+}
+
+void ImageSet::readRawRow(size_t i, uint8_t *dst) {
+	readRawRow(decoders[i], i, next_rows.data() + i*size_t(image_width)*3, dst);
+}
+
+void ImageSet::readRawRow(ImageDecoder *dec, size_t i, uint8_t *next, uint8_t *dst) const {
+	size_t row_size = size_t(image_width)*3;
+	if(raw_rows == 2 && subpixel[i].y() > 0) {
+		//bilinear needs the next row too: keep it for the following line.
+		memcpy(dst, next, row_size);
+		dec->readRows(1, dst + row_size);
+		memcpy(next, dst + row_size, row_size);
+	} else
+		dec->readRows(1, dst);
+}
+
+ImageSet::Band::~Band() {
+	for(ImageDecoder *dec: decoders)
+		delete dec;
+}
+
+bool ImageSet::Band::open(int start) {
+	QDir dir(set.path);
+	size_t row_size = size_t(set.image_width)*3;
+	if(set.raw_rows == 2)
+		next_rows.resize(row_size*set.images.size());
+
+	for(int i = 0; i < set.images.size(); i++) {
+		ImageDecoder *dec = new ImageDecoder;
+		decoders.push_back(dec);
+		int w, h;
+		if(!dec->init(dir.filePath(set.images[i]).toStdString().c_str(), w, h) || w != set.image_width || h != set.image_height)
+			return false;
+
+		int y_offset = set.offsets.size() ? set.offsets[i].y() : 0;
+		dec->skipRows(set.top + y_offset + start);
+		if(set.raw_rows == 2 && set.subpixel[i].y() > 0)
+			dec->readRows(1, next_rows.data() + i*row_size);
 	}
+	current_line = set.top + start;
+	return true;
+}
 
-	//TODO: no need to allocate EVERY time.
-	std::vector<uint8_t> row(image_width*3);
+int ImageSet::Band::readRawLine(std::vector<uint8_t> &raw) {
+	size_t row_size = size_t(set.image_width)*3;
+	raw.resize(set.raw_rows*row_size*decoders.size());
+	for(size_t i = 0; i < decoders.size(); i++)
+		set.readRawRow(decoders[i], i, next_rows.data() + i*row_size, raw.data() + i*set.raw_rows*row_size);
+	return current_line++;
+}
 
+void ImageSet::Band::skipLines(int n) {
+	if(n <= 0)
+		return;
+	size_t row_size = size_t(set.image_width)*3;
 	for(size_t i = 0; i < decoders.size(); i++) {
-		decoders[i]->readRows(1, row.data());
+		if(set.raw_rows == 2 && set.subpixel[i].y() > 0) {
+			//the row below the last skipped one is needed.
+			decoders[i]->skipRows(n - 1);
+			decoders[i]->readRows(1, next_rows.data() + i*row_size);
+		} else
+			decoders[i]->skipRows(n);
+	}
+	current_line += n;
+}
+
+const uint8_t *ImageSet::alignedRow(const std::vector<uint8_t> &raw, size_t i, std::vector<uint8_t> &buffer) const {
+	size_t row_size = size_t(image_width)*3;
+	return alignedRow(raw.data() + i*raw_rows*row_size, i, buffer);
+}
 
-		int x_offset = offsets.size() ? offsets[i].x() : 0;
-		applyColorTransform(row.data() + (left + x_offset)*3, width);
+const uint8_t *ImageSet::alignedRow(const uint8_t *rows, size_t i, std::vector<uint8_t> &buffer) const {
+	size_t row_size = size_t(image_width)*3;
+	int x_offset = offsets.size() ? offsets[i].x() : 0;
+	const uint8_t *row = rows + (left + x_offset)*3;
+	if(subpixel.empty() || subpixel[i].isNull())
+		return row;
+
+	float fx = subpixel[i].x();
+	float fy = subpixel[i].y();
+	float w00 = (1 - fx)*(1 - fy), w01 = fx*(1 - fy);
+	float w10 = (1 - fx)*fy,       w11 = fx*fy;
+	int dx = fx > 0 ? 3 : 0;
+	const uint8_t *next = fy > 0 ? row + row_size : row;
+
+	buffer.resize(width*3);
+	for(int k = 0; k < width*3; k++)
+		buffer[k] = uint8_t(w00*row[k] + w01*row[k + dx] + w10*next[k] + w11*next[k + dx] + 0.5f);
+	return buffer.data();
+}
+
+void ImageSet::convertLine(const std::vector<uint8_t> &raw, int line, PixelArray &pixels, int step) {
+	int n = (width + step - 1)/step;
+	pixels.resize(n, images.size());
+	for(int x = 0; x < n; x++) {
+		Pixel &pixel = pixels[x];
+		pixel.x = x*step + left;
+		pixel.y = image_height - 1 - line;
+	}
+
+	std::vector<uint8_t> transformed, aligned, decimated;
+	if(!color_lut.isValid() && color_transform)
+		transformed.resize(n*3);
 
-		for(int x = left; x < right; x++) {
-			pixels[x - left][i].r = row[(x + x_offset)*3 + 0];
-			pixels[x - left][i].g = row[(x + x_offset)*3 + 1];
-			pixels[x - left][i].b = row[(x + x_offset)*3 + 2];
+	for(size_t i = 0; i < decoders.size(); i++) {
+		const uint8_t *row = alignedRow(raw, i, aligned);
+		if(step > 1) {
+			//previews convert only the columns they keep.
+			decimated.resize(n*3);
+			for(int x = 0; x < n; x++)
+				memcpy(&decimated[x*3], row + x*step*3, 3);
+			row = decimated.data();
+		}
+
+		if(color_lut.isValid()) {
+			for(int x = 0; x < n; x++)
+				color_lut.apply(row + x*3, &pixels[x][i].r);
+			continue;
+		}
+		if(color_transform) {
+			//transforms do not keep state, they can be shared among threads.
+			cmsDoTransform(color_transform, row, transformed.data(), n);
+			row = transformed.data();
+		}
+		for(int x = 0; x < n; x++) {
+			pixels[x][i].r = row[x*3 + 0];
+			pixels[x][i].g = row[x*3 + 1];
+			pixels[x][i].b = row[x*3 + 2];
 		}
 	}
 	compensateVignetting(pixels);
 	if(light3d) {
 		compensateIntensity(pixels);
 	}
-	current_line++;
 }
 
-//return a subset of k integers from 0 to n-1;
-class StupidSampler {
-public:
-	set<uint32_t> res;
-	StupidSampler() { srand(0); }
-	set<uint32_t> &result(uint32_t k, uint32_t n) {
-		res.clear();
-		//res.insert(0);
-		while (res.size() < k)
-			res.insert(rand()%n);
-		return res;
+//stratified sampling: one column in each of the k strata of the row, jittered with a per row seed
+//(reproducible whatever the order the rows are processed).
+static void stratifiedColumns(uint32_t k, uint32_t n, uint32_t row, std::vector<uint32_t> &columns) {
+	std::mt19937 rng(row*2654435761u + 1);
+	columns.resize(k);
+	for(uint32_t s = 0; s < k; s++) {
+		uint32_t start = uint64_t(n)*s/k;
+		uint32_t end = uint64_t(n)*(s + 1)/k;
+		columns[s] = start + rng() % (end - start);
 	}
-};
+}
 
 uint32_t ImageSet::sample(PixelArray &resample, uint32_t ndimensions, std::function<void(Pixel &, Pixel &)> resampler, uint32_t samplingram) {
 	if(current_line == 0)
@@ -483,54 +614,89 @@ uint32_t ImageSet::sample(PixelArray &resample, uint32_t ndimensions, std::funct
 	uint32_t samplexrow = std::min((int)(nsamples/height), (int)(width/4));
 	nsamples = samplexrow*height;
 	resample.resize(nsamples, ndimensions);
-
-	StupidSampler sampler;
-	PixelArray sample(samplexrow, images.size());
-
-	uint32_t offset = 0;
-	vector<uint8_t> row(image_width*3);
-	for(int y = top; y < bottom; y++) {
-		if(callback && !(*callback)("Sampling images:", 100*(y-top)/(height-1)))
+	if(samplexrow == 0)
+		return 0;
+
+	//rows are processed in bands: each image is decoded on its own thread, then the band is resampled in parallel.
+	const int band = 16;
+	int nthreads = std::max(1, QThread::idealThreadCount());
+	RelightThreadPool pool;
+	pool.start(nthreads);
+
+	size_t row_size = size_t(image_width)*3;
+	PixelArray sample(samplexrow*band, images.size());
+	vector<vector<uint32_t>> columns(band);
+
+	for(int y0 = top; y0 < bottom; y0 += band) {
+		if(callback && !(*callback)("Sampling images:", 100*(y0-top)/(height-1))) {
+			pool.abort();
 			throw std::string("Cancelled");
+		}
 
-		//read one row per image at a time
-		auto &selection = sampler.result(samplexrow, width);
-
-		for(uint32_t i = 0; i < decoders.size(); i++) {
-			ImageDecoder *dec = decoders[i];
-			dec->readRows(1, row.data());
-
-			applyColorTransform(row.data() + left*3, width);
-			uint32_t x = 0;
-			for(int k: selection) {
-				Color3f &pixel = sample[x][i];
-
-				pixel.r = row[(k+left)*3 + 0];
-				pixel.g = row[(k+left)*3 + 1];
-				pixel.b = row[(k+left)*3 + 2];
-
-				x++;
-			}
+		int rows = std::min(band, bottom - y0);
+		for(int r = 0; r < rows; r++)
+			stratifiedColumns(samplexrow, width, y0 + r, columns[r]);
+
+		vector<std::future<void>> decoded;
+		for(size_t i = 0; i < decoders.size(); i++) {
+			decoded.push_back(pool.queue([&, i]() {
+				vector<uint8_t> raw(raw_rows*row_size), aligned, selected(samplexrow*3);
+				for(int r = 0; r < rows; r++) {
+					readRawRow(i, raw.data());
+					const uint8_t *row = alignedRow(raw.data(), i, aligned);
+
+					//only the selected pixels need the color transform.
+					for(uint32_t x = 0; x < samplexrow; x++)
+						memcpy(selected.data() + x*3, row + columns[r][x]*3, 3);
+					if(!color_lut.isValid())
+						applyColorTransform(selected.data(), samplexrow);
+
+					for(uint32_t x = 0; x < samplexrow; x++) {
+						Color3f &pixel = sample[r*samplexrow + x][i];
+						const uint8_t *rgb = selected.data() + x*3;
+						if(color_lut.isValid()) {
+							color_lut.apply(rgb, &pixel.r);
+						} else {
+							pixel.r = rgb[0];
+							pixel.g = rgb[1];
+							pixel.b = rgb[2];
+						}
+					}
+				}
+			}));
 		}
-		{
-			uint32_t x = 0;
-			for(int k: selection) {
-				sample[x].x = k + left;
-				sample[x].y = image_height - 1 - y;
-				x++;
+		for(auto &f: decoded)
+			f.wait();
+		current_line += rows;
+
+		for(int r = 0; r < rows; r++) {
+			for(uint32_t x = 0; x < samplexrow; x++) {
+				Pixel &pixel = sample[r*samplexrow + x];
+				pixel.x = columns[r][x] + left;
+				pixel.y = image_height - 1 - (y0 + r);
 			}
 		}
-		compensateVignetting(sample);
 
-		if(light3d) {
-			compensateIntensity(sample);
+		uint32_t count = rows*samplexrow;
+		size_t offset = size_t(y0 - top)*samplexrow;
+		vector<std::future<void>> resampled;
+		for(int t = 0; t < nthreads; t++) {
+			uint32_t start = uint64_t(count)*t/nthreads;
+			uint32_t end = uint64_t(count)*(t + 1)/nthreads;
+			resampled.push_back(pool.queue([&, start, end]() {
+				for(uint32_t k = start; k < end; k++) {
+					Pixel &pixel = sample[k];
+					compensateVignetting(pixel);
+					if(light3d)
+						compensateIntensity(pixel);
+					resampler(pixel, resample[offset + k]);
+				}
+			}));
 		}
-
-		for(uint32_t x = 0; x < selection.size(); x++)
-			resampler(sample[x], resample[offset + x]);
-
-		offset += samplexrow;
+		for(auto &f: resampled)
+			f.wait();
 	}
+	pool.finish();
 	return nsamples;
 }
 
@@ -539,6 +705,7 @@ void ImageSet::createColorTransform() {
 		cmsDeleteTransform(color_transform);
 		color_transform = nullptr;
 	}
+	color_lut.clear();
 
 	// Detect identity transforms (input == target) and skip.
 	if(color_profile_mode == COLOR_PROFILE_LINEAR_RGB && icc_profile_data == ICCProfiles::linearRGBData()) {
@@ -558,12 +725,25 @@ void ImageSet::createColorTransform() {
 		src = ColorProfile::getProfileDescription(icc_profile_data).toStdString();
 		if(src.empty()) src = "embedded ICC";
 	}
-	std::cout << "Color transform: " << src << " -> " << modeNames[color_profile_mode] << std::endl;
+	std::cout << "Color transform: " << src << " -> " << modeNames[color_profile_mode];
+
+	if(color_lut.build(icc_profile_data, color_profile_mode)) {
+		if(color_lut.isIdentity()) {
+			std::cout << " (no-op)" << std::endl;
+			color_lut.clear();
+		} else {
+			std::cout << " (lookup table)" << std::endl;
+		}
+		return;
+	}
+	std::cout << std::endl;
 	color_transform = ColorProfile::createColorTransform(icc_profile_data, color_profile_mode);
 }
 
 void ImageSet::applyColorTransform(uint8_t *data, size_t pixel_count) {
-	if(color_transform)
+	if(color_lut.isValid())
+		color_lut.apply(data, pixel_count);
+	else if(color_transform)
 		cmsDoTransform(color_transform, data, data, pixel_count);
 }
 
@@ -639,20 +819,36 @@ void ImageSet::setCrop(const Crop &_crop) {
 void ImageSet::setCrop(Crop &_crop, const std::vector<QPointF> &_offsets) {
 	QRect c = _crop.boundingRect(imageSize());
 
+	//integer part is applied skipping rows and columns, the fractional part with bilinear resampling.
 	std::vector<QPoint> int_offsets;
-	for(const QPointF &p: _offsets)
-		int_offsets.push_back(p.toPoint());
+	std::vector<QPointF> fractions;
+	bool fractional = false;
+	for(const QPointF &p: _offsets) {
+		QPoint o(int(floor(p.x())), int(floor(p.y())));
+		QPointF f = p - QPointF(o);
+		//below 1/64 of a pixel is not worth the resampling
+		if(f.x() < 1.0/64) f.setX(0);
+		if(f.x() > 1 - 1.0/64) { f.setX(0); o.rx()++; }
+		if(f.y() < 1.0/64) f.setY(0);
+		if(f.y() > 1 - 1.0/64) { f.setY(0); o.ry()++; }
+		fractional |= !f.isNull();
+		int_offsets.push_back(o);
+		fractions.push_back(f);
+	}
 
 	//find min and max of offsets to adjust the maxCrop;
 	int l = 0;
 	int r = image_width;;
 	int t = 0;
 	int b = image_height;
-	for(QPoint &o: int_offsets) {
+	for(size_t i = 0; i < int_offsets.size(); i++) {
+		QPoint &o = int_offsets[i];
+		int dx = fractions[i].x() > 0 ? 1 : 0; //bilinear reads one more column and row
+		int dy = fractions[i].y() > 0 ? 1 : 0;
 		l = std::max(l, -o.x());
-		r = std::min(r, image_width-o.x());
+		r = std::min(r, image_width - o.x() - dx);
 		t = std::max(t, -o.y());
-		b = std::min(b, image_height-o.y());
+		b = std::min(b, image_height - o.y() - dy);
 	}
 	//TODO check +1 problem
 	QRect max_crop(l, t, r - l, b - t);
@@ -663,6 +859,14 @@ void ImageSet::setCrop(Crop &_crop, const std::vector<QPointF> &_offsets) {
 
 	setCrop(c.left(), c.top(), c.width(), c.height());
 	offsets = int_offsets;
+	subpixel.clear();
+	raw_rows = 1;
+	if(fractional) {
+		subpixel = fractions;
+		for(QPointF &f: subpixel)
+			if(f.y() > 0)
+				raw_rows = 2;
+	}
 
 	rotateLights(-_crop.angle);
 	crop = _crop;
@@ -685,10 +889,14 @@ void ImageSet::rotateLights(float a) {
 void ImageSet::skipToTop() {
 	std::vector<uint8_t> row(image_width*3);
 
+	if(raw_rows == 2)
+		next_rows.resize(row.size()*decoders.size());
+
 	for(uint32_t i = 0; i < decoders.size(); i++) {
 		int y_offset = offsets.size() ? offsets[i].y() : 0;
-		for(int y = 0; y < top + y_offset; y++)
-			decoders[i]->readRows(1, row.data());
+		decoders[i]->skipRows(top + y_offset);
+		if(raw_rows == 2 && subpixel[i].y() > 0)
+			decoders[i]->readRows(1, next_rows.data() + i*row.size());
 		
 		if(callback && !(*callback)("Skipping cropped lines...", 100*i/(decoders.size()-1)))
 			throw std::string("Cancelled");
@@ -17,6 +17,7 @@
 #include <Eigen/Core>
 #include <QStringList>
 #include <QPoint>
+#include <QPointF>
 #include <QSize>
 
 class QJsonObject;
@@ -55,9 +56,11 @@ public:
 
 	int current_line = 0;
 	std::vector<QPoint> offsets; //align offsets
+	std::vector<QPointF> subpixel; //fractional part of the align offsets in [0, 1), empty if all offsets are integer
 
 	ColorProfileMode color_profile_mode = COLOR_PROFILE_LINEAR_RGB;
 	std::vector<uint8_t> icc_profile_data;
+	ColorLut color_lut;                                    // read path, matrix/shaper profiles: replaces color_transform
 	cmsHTRANSFORM color_transform = nullptr;               // read path: input ICC → color_profile_mode (working space)
 	cmsHTRANSFORM output_color_transform = nullptr;       // write path: working space (uint8) → alternate output (uint8)
 	cmsHTRANSFORM output_color_transform_float = nullptr; // write path: working space (float [0,1]) → alternate output (uint8)
@@ -105,7 +108,9 @@ public:
 
 	// Build the input transform (input ICC → color_profile_mode working space).
 	// Call after initImages/initFromProject and setColorProfileMode.
-	// Identity transforms (e.g. sRGB→sRGB) are detected and result in a null transform (no-op).
+	// Identity transforms (e.g. sRGB→sRGB, also when the embedded profile is only equivalent
+	// to the working space) are detected and result in a null transform (no-op).
+	// Matrix/shaper profiles use the precomputed color_lut instead of LittleCMS.
 	void createColorTransform();
 
 	// Build the output transform (working space → target). If target is the same as
@@ -141,21 +146,55 @@ public:
 
 	void decode(size_t img, unsigned char *buffer);
 	void readLine(PixelArray &line);
+	//readLine split in two: readRawLine only decodes (reader thread) and returns the line number,
+	//convertLine applies color transform and compensations and is safe to call from the workers,
+	//step > 1 converts only one column every step.
+	int readRawLine(std::vector<uint8_t> &raw);
+	void convertLine(const std::vector<uint8_t> &raw, int line, PixelArray &pixels, int step = 1);
 	uint32_t sample(PixelArray &sample, uint32_t ndimensions, std::function<void(Pixel &, Pixel &)> resampler, uint32_t samplingrate);
 	void restart();
 	void skipToTop();
 
 	Eigen::Vector3f relativeLight(const Eigen::Vector3f &light, int x, int y);
 
+	//independent reader of the crop starting at row start: each band opens its own decoders,
+	//so that different parts of the crop can be decoded in parallel. Lines are numbered as in readRawLine.
+	class Band {
+	public:
+		Band(ImageSet &_set): set(_set) {}
+		~Band();
+		bool open(int start);
+		int readRawLine(std::vector<uint8_t> &raw);
+		void skipLines(int n);
+		int line() const { return current_line; }
+
+	private:
+		ImageSet &set;
+		std::vector<ImageDecoder *> decoders;
+		std::vector<uint8_t> next_rows;
+		int current_line = 0;
+	};
+
 protected:
 	std::function<bool(QString stage, int percent)> *callback;
 	std::vector<ImageDecoder *> decoders;
+	std::vector<uint8_t> next_rows; //row below the current one, for vertical subpixel offsets
+
+	int raw_rows = 1; //raw lines hold two rows per image when some image has a vertical subpixel offset.
+	//row of image i starting at left, with the align offset applied (buffer is used if resampling is needed).
+	const uint8_t *alignedRow(const std::vector<uint8_t> &raw, size_t i, std::vector<uint8_t> &buffer) const;
+	const uint8_t *alignedRow(const uint8_t *rows, size_t i, std::vector<uint8_t> &buffer) const;
+	//decodes the next raw_rows rows of image i, different images can be read from different threads.
+	void readRawRow(size_t i, uint8_t *dst);
+	void readRawRow(ImageDecoder *dec, size_t i, uint8_t *next, uint8_t *dst) const;
 
 
 private:
 	void compensateVignetting(PixelArray &pixels);
+	void compensateVignetting(Pixel &pixel);
 
 	void compensateIntensity(PixelArray &pixels);
+	void compensateIntensity(Pixel &pixel);
 	void applyColorTransform(uint8_t *data, size_t pixel_count);
 };
 
@@ -161,6 +161,26 @@ size_t JpegDecoder::readRows(int nrows, uint8_t *buffer) { //return false on end
 	return readed;
 }
 
+size_t JpegDecoder::skipRows(int nrows) {
+	if(nrows <= 0)
+		return 0;
+	if(decInfo.output_scanline == decInfo.image_height)
+		restart();
+#ifdef LIBJPEG_TURBO_VERSION
+	//entropy decoding only, no idct and color conversion.
+	size_t skipped = jpeg_skip_scanlines(&decInfo, nrows);
+	if(decInfo.output_scanline == decInfo.image_height)
+		jpeg_finish_decompress(&decInfo);
+	return skipped;
+#else
+	std::vector<uint8_t> row(rowSize());
+	size_t skipped = 0;
+	while(int(skipped) < nrows && readRows(1, row.data()))
+		skipped++;
+	return skipped;
+#endif
+}
+
 bool JpegDecoder::finish() {
 	if(file)
 		fclose(file);
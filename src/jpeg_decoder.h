@@ -33,6 +33,7 @@ public:
 
 	//buffer must have rows*rowSize() space at least!
 	size_t readRows(int rows, uint8_t *buffer); //return false on end.
+	size_t skipRows(int rows); //returns the number of rows skipped
 	bool finish();
 	bool restart();
 	bool chromaSubsampled() { return subsampled; }
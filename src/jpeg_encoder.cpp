@@ -156,7 +156,7 @@ bool JpegEncoder::writeRows(uint8_t *rows, int n) {
 		jpeg_write_scanlines(&info, &row, 1);
 		written++;
 	}
-	return true;
+	return written == n;
 }
 
 size_t JpegEncoder::finish() {
@@ -172,13 +172,31 @@ size_t JpegEncoder::finish() {
 		mem_size = 0;
 		mem_output = nullptr;
 	} else if(file) {
-		size = ftell(file);
-		fclose(file);
+		long pos = ftell(file);
+		bool failed = ferror(file) || pos < 0;
+		failed |= fclose(file) != 0;
 		file = nullptr;
+		size = failed ? 0 : size_t(pos);
 	}
 	return size;
 }
 
+void JpegEncoder::abort() {
+	if(!file && !mem_output)
+		return;
+	jpeg_abort_compress(&info);
+	if(mem_buffer) {
+		free(mem_buffer);
+		mem_buffer = nullptr;
+		mem_size = 0;
+	}
+	mem_output = nullptr;
+	if(file) {
+		fclose(file);
+		file = nullptr;
+	}
+}
+
 void JpegEncoder :: onError(j_common_ptr /* cinfo */)
 {
 /*	// cinfo->err is actually a pointer to my_error_mgr.defaultErrorManager, since pub
@@ -38,8 +38,9 @@ public:
 
 	bool init(const char* path, int width, int height);
 	bool init(std::vector<uint8_t> &output, int width, int height);
-	bool writeRows(uint8_t *rows, int n);
-	size_t finish(); //return size
+	bool writeRows(uint8_t *rows, int n); //false if past the last row
+	size_t finish(); //return size, 0 on write errors
+	void abort(); //drop an incomplete image and close the output
 
 private:
 	bool init(int width, int height);
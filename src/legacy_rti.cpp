@@ -1,16 +1,20 @@
 #include "legacy_rti.h"
 #include "jpeg_decoder.h"
 #include "jpeg_encoder.h"
+#include "relight_threadpool.h"
 
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <cstring>
+#include <atomic>
 #include <assert.h>
 #include <math.h>
 
 #include <QString>
 #include <QStringList>
+#include <QFile>
+#include <QThread>
 
 using namespace std;
 
@@ -104,6 +108,284 @@ bool getIntegers(FILE *file, vector<int> &a, unsigned int expected = 0) {
 	return a.size() > 0;
 }
 
+//same as the FILE functions above, on a memory mapped header.
+struct MappedCursor {
+	const uint8_t *pos;
+	const uint8_t *end;
+
+	MappedCursor(const uint8_t *start, const uint8_t *_end): pos(start), end(_end) {}
+
+	bool getLine(string &str) {
+		if(pos >= end)
+			return false;
+		while(pos < end && *pos != '\n')
+			str.push_back(char(*pos++));
+		if(pos < end)
+			pos++;
+		return true;
+	}
+	bool skipComments(char head = '#') {
+		while(pos < end && *pos == head) {
+			string line;
+			getLine(line);
+		}
+		return pos < end;
+	}
+	bool getParts(QStringList &parts) {
+		string line;
+		if(!getLine(line))
+			return false;
+		//some rtis have a space after the last float, other a \n directly.
+		parts = QString::fromStdString(line).trimmed().split(' ');
+		return true;
+	}
+	bool getInteger(int &n) {
+		QStringList parts;
+		if(!getParts(parts))
+			return false;
+		bool ok;
+		n = parts[0].toInt(&ok);
+		return ok;
+	}
+	bool getIntegers(vector<int> &a, unsigned int expected = 0) {
+		QStringList parts;
+		if(!getParts(parts))
+			return false;
+		for(const QString &part: parts) {
+			bool ok;
+			a.push_back(part.toInt(&ok));
+			if(!ok) return false;
+		}
+		if(expected != 0)
+			return expected == a.size();
+		return a.size() > 0;
+	}
+	bool getFloats(vector<float> &a, unsigned int expected = 0) {
+		QStringList parts;
+		if(!getParts(parts))
+			return false;
+		for(const QString &part: parts) {
+			bool ok;
+			a.push_back(part.toDouble(&ok));
+			if(!ok) return false;
+		}
+		if(expected != 0)
+			return expected == a.size();
+		return a.size() > 0;
+	}
+	bool read(void *dst, size_t size) {
+		if(size_t(end - pos) < size)
+			return false;
+		memcpy(dst, pos, size);
+		pos += size;
+		return true;
+	}
+};
+
+bool LRti::open(const char *filename) {
+	auto file = std::make_shared<QFile>(QString(filename));
+	if(!file->open(QIODevice::ReadOnly)) {
+		error = "Could not open file";
+		return false;
+	}
+	qint64 size = file->size();
+	const uint8_t *start = file->map(0, size);
+	if(!start) //mapping not supported
+		return load(filename);
+
+	MappedCursor cursor(start, start + size);
+	string version;
+	cursor.getLine(version);
+
+	size_t coeffs = 0;
+	if(version.compare(0, 3, "PTM", 3) == 0) {
+		string format;
+		if(!cursor.getLine(format)) {
+			error = "File too short!";
+			return false;
+		}
+		if(format == "PTM_FORMAT_RGB") {
+			type = PTM_RGB;
+			coeffs = 18;
+		} else if(format == "PTM_FORMAT_LRGB") {
+			type = PTM_LRGB;
+			coeffs = 9;
+		} else //jpeg or unsupported
+			return load(filename);
+
+		scale.clear();
+		bias.clear();
+		if(!cursor.getInteger(width) || !cursor.getInteger(height) ||
+			!cursor.getFloats(scale, 6) || !cursor.getFloats(bias, 6)) {
+			error =  "File format invalid";
+			return false;
+		}
+		for(auto &b: bias)
+			b /= 255.0;
+		ptm12 = (version == "PTM_1.2");
+
+	} else if(version.compare(0, 7, "#HSH1.2", 7) == 0) {
+		cursor = MappedCursor(start, start + size);
+		cursor.skipComments();
+
+		int rti_type = 0;
+		vector<int> tmp, basis;
+		if(!cursor.getInteger(rti_type) || !cursor.getIntegers(tmp, 3) || !cursor.getIntegers(basis, 3)) {
+			error = "File format invalid";
+			return false;
+		}
+		if(rti_type != 3) {
+			error =  "Unsupported .rti if not HSH (for the moment)";
+			return false;
+		}
+		if(tmp[2] != 3) {
+			error =  "Unsupported components != 3";
+			return false;
+		}
+		type = HSH_RGB;
+		width = tmp[0];
+		height = tmp[1];
+		size_t basis_terms = basis[0];
+		coeffs = basis_terms*3;
+
+		scale.resize(basis_terms);
+		bias.resize(basis_terms);
+		if(!cursor.read(scale.data(), basis_terms*sizeof(float)) ||
+			!cursor.read(bias.data(), basis_terms*sizeof(float))) {
+			error = "Failed reading scale and bias.";
+			return false;
+		}
+		//see loadHSH
+		for(size_t i = 0; i < basis_terms; i++)
+			bias[i] = -bias[i]/scale[i];
+
+	} else {
+		error = "Not a PTM or HSH file.";
+		return false;
+	}
+
+	if(size_t(cursor.end - cursor.pos) < coeffs*width*height) {
+		error = "File is truncated.";
+		return false;
+	}
+	data.clear();
+	mapped = cursor.pos;
+	mapped_file = file;
+	return true;
+}
+
+int LRti::dataPlane(int p, int c) const {
+	if(type == PTM_LRGB) {
+		//lrgb ptm order is: x^2, y^2, xy, x, y, 1, r, g, b
+		//while we use r, g, b, 1, x, y, x2 xy y2
+		static const int order[9] = {6,7,8, 5,3,4, 0,2,1};
+		return order[p*3 + c];
+	}
+	if(type == PTM_RGB) {
+		static const int order[6] = {5, 3, 4, 0, 2, 1};
+		return order[p]*3 + c;
+	}
+	return p*3 + c;
+}
+
+size_t LRti::mappedOffset(int k, int x, int y) const {
+	size_t w = width, h = height;
+	size_t i = x + y*w;
+	switch(type) {
+	case PTM_LRGB:
+		//interleaved abcdefRGB before 1.2, interleaved abcdef then planes RGB after.
+		if(!ptm12)
+			return i*9 + k;
+		return k < 6 ? i*6 + k : w*h*6 + i*3 + (k - 6);
+	case PTM_RGB: //a block of interleaved abcdef for each component
+		return (k%3)*w*h*6 + i*6 + k/3;
+	case HSH_RGB: { //rows are flipped, for each pixel basis_terms for red, green and blue.
+		size_t nb = scale.size();
+		size_t r = h - 1 - y;
+		return r*w*nb*3 + x*nb*3 + (k%3)*nb + k/3;
+	}
+	default:
+		return 0;
+	}
+}
+
+bool LRti::encodeJPEGPlanes(const std::vector<std::string> &filenames, int quality, int nthreads) {
+	if(nthreads <= 0)
+		nthreads = QThread::idealThreadCount();
+
+	RelightThreadPool pool;
+	pool.start(std::min(nthreads, int(filenames.size())));
+
+	if(!mapped) { //already in memory
+		std::vector<std::future<bool>> done;
+		for(size_t p = 0; p < filenames.size(); p++)
+			done.push_back(pool.queue([this, p, &filenames, quality]() { return encodeJPEGtoFile(p*3, quality, filenames[p].c_str()); }));
+		bool ok = true;
+		for(auto &d: done)
+			ok &= d.get();
+		if(!ok)
+			error = "Could not write the planes.";
+		return ok;
+	}
+
+	std::vector<std::unique_ptr<JpegEncoder>> encoders;
+	for(const std::string &filename: filenames) {
+		encoders.emplace_back(new JpegEncoder);
+		JpegEncoder &enc = *encoders.back();
+		enc.setQuality(quality);
+		enc.setColorSpace(JCS_RGB, 3);
+		enc.setJpegColorSpace(JCS_RGB);
+		if(!enc.init(filename.c_str(), width, height)) {
+			error = "Could not create file: " + filename;
+			return false;
+		}
+	}
+
+	//bands of rows, bottom to top: memory is bounded by the band size, the file is read once.
+	const int band = 64;
+	std::vector<std::vector<uint8_t>> lines(filenames.size(), std::vector<uint8_t>(size_t(width)*3*band));
+	std::atomic<bool> written(true);
+	for(int y0 = height - 1; y0 >= 0 && written; y0 -= band) {
+		int n = std::min(band, y0 + 1);
+		std::vector<std::future<void>> done;
+		for(size_t p = 0; p < filenames.size(); p++) {
+			done.push_back(pool.queue([this, p, y0, n, &lines, &encoders, &written]() {
+				uint8_t *line = lines[p].data();
+				for(int r = 0; r < n; r++) {
+					int y = y0 - r;
+					uint8_t *dst = line + size_t(r)*width*3;
+					for(int c = 0; c < 3; c++) {
+						int k = dataPlane(p, c);
+						const uint8_t *src = mapped + mappedOffset(k, 0, y);
+						size_t stride = mappedOffset(k, 1, y) - mappedOffset(k, 0, y);
+						for(int x = 0; x < width; x++)
+							dst[x*3 + c] = src[x*stride];
+					}
+				}
+				if(!encoders[p]->writeRows(line, n))
+					written = false;
+			}));
+		}
+		for(auto &d: done)
+			d.wait();
+	}
+	pool.finish();
+	if(!written) {
+		for(auto &enc: encoders)
+			enc->abort();
+		error = "Could not encode the planes.";
+		return false;
+	}
+	bool ok = true;
+	for(size_t p = 0; p < encoders.size(); p++) {
+		if(encoders[p]->finish() == 0) {
+			error = "Could not write file: " + filenames[p];
+			ok = false;
+		}
+	}
+	return ok;
+}
+
 bool LRti::load(const char *filename) {
 	FILE* file = fopen(filename, "rb");
 	if (file == nullptr) {
@@ -615,15 +897,6 @@ bool LRti::encodeUniversal(const char *filename, int /*quality*/) {
  * write to file, we need to reverse the order of the Y */
 
 bool LRti::encodeJPEGtoFile(int startplane, int quality, const char *filename) {
-	vector<int> order;
-	if(type == PTM_LRGB) {
-		//lrgb ptm order is: x^2, y^2, xy, x, y, 1, r, g, b
-		//while we use r, g, b, 1, x, y, x2 xy y2
-		order = {6,7,8, 5,3,4, 0,2,1};
-	} else if(type == PTM_RGB) {
-		order = {5, 3, 4, 0, 2, 1};
-	} else
-		order = {0, 1, 2, 3, 4, 5, 6, 7, 8};
 	JpegEncoder enc;
 	enc.setQuality(quality);
 	
@@ -634,29 +907,28 @@ bool LRti::encodeJPEGtoFile(int startplane, int quality, const char *filename) {
 	
 	//lets avoid make another copy in memory.
 	
-	enc.init(filename, width, height);
+	if(!enc.init(filename, width, height))
+		return false;
 	
+	const uint8_t *planes[3];
+	for(int c = 0; c < 3; c++)
+		planes[c] = data[dataPlane(startplane/3, c)].data();
+
 	vector<uint8_t> line(width*3);
 	for(int y = height-1; y >= 0; y--) {
 		for(int32_t x = 0; x < width; x++) {
 			int32_t p = y*width + x;
-			if(type == PTM_LRGB) {
-				line[x*3 + 0] = data[order[startplane + 0]][p];
-				line[x*3 + 1] = data[order[startplane + 1]][p];
-				line[x*3 + 2] = data[order[startplane + 2]][p];
-			} else {
-				line[x*3 + 0] = data[order[startplane/3]*3 +  0][p];
-				line[x*3 + 1] = data[order[startplane/3]*3 +  1][p];
-				line[x*3 + 2] = data[order[startplane/3]*3 +  2][p];
-			}
+			line[x*3 + 0] = planes[0][p];
+			line[x*3 + 1] = planes[1][p];
+			line[x*3 + 2] = planes[2][p];
+		}
+		if(!enc.writeRows(line.data(), 1)) {
+			enc.abort();
+			return false;
 		}
-		enc.writeRows(line.data(), 1);
 	}
 	
-	//return size, if needed.
-	enc.finish();
-	
-	return true;
+	return enc.finish() > 0;
 }
 
 bool LRti::encodeJPEG(vector<int> &sizes, vector<uint8_t *> &buffers, int quality) {
@@ -5,6 +5,9 @@
 #include <stdio.h>
 #include <vector>
 #include <string>
+#include <memory>
+
+class QFile;
 
 /* NOTE: the image is flipped in the coefficients! */
 
@@ -26,6 +29,11 @@ public:
 
 	LRti():  type(UNKNOWN), width(0), height(0) {}
 	bool load(const char *filename);
+	//memory maps the file and parses only the header, raw coefficients are read by encodeJPEGPlanes as needed.
+	//jpeg compressed .ptm can't be streamed and are loaded as in load.
+	bool open(const char *filename);
+	//relight planes (3 coefficients per jpeg, rows bottom to top), encoded in parallel across planes.
+	bool encodeJPEGPlanes(const std::vector<std::string> &filenames, int quality, int nthreads = 0);
 
 	void clip(int left, int bottom, int right, int top);
 	LRti clipped(int left, int bottom, int right, int top);
@@ -52,6 +60,15 @@ protected:
 
 	//crop width to multiple of 8 for RTIViewer compatibility
 	void cropToEight();
+
+	//memory mapped raw coefficients (see open)
+	std::shared_ptr<QFile> mapped_file;
+	const uint8_t *mapped = nullptr;
+	bool ptm12 = true;
+	//data plane k (see data) used for channel c of relight plane p
+	int dataPlane(int p, int c) const;
+	//position of the coefficient of data plane k at pixel x, y in the mapped file
+	size_t mappedOffset(int k, int x, int y) const;
 };
 
 #endif // RRTI_H
@@ -15,6 +15,7 @@
 #include <mutex>
 #include <algorithm>
 #include <limits>
+#include <cstring>
 
 /* TODO: try this lib:
 https://amgcl.readthedocs.io/en/latest/tutorial/poisson3Db.html
@@ -60,67 +61,276 @@ bool saveNormalMap(const QString &filename, size_t w, size_t h, std::vector<Eige
 	return true;
 }
 
+static void writePlyHeader(QFile &file, size_t nvertices, size_t nfaces) {
+	QTextStream stream(&file);
+
+	stream << "ply\n";
+	stream << "format binary_little_endian 1.0\n";
+	stream << "element vertex " << nvertices << "\n";
+	stream << "property float x\n";
+	stream << "property float y\n";
+	stream << "property float z\n";
+	stream << "property float s\n";
+	stream << "property float t\n";
+	stream << "element face " << nfaces << "\n";
+	stream << "property list uchar int vertex_index\n";
+	stream << "end_header\n";
+}
+
+//x, y, z, s, t of the heightmap pixel x, y (y is flipped, the mesh is centered).
+static void plyVertex(float *v, size_t x, size_t y, size_t w, size_t h, float z, float scale) {
+	float mesh_y = float(h - 1 - y);
+	v[0] = (float(x) - (w - 1) * 0.5f) * scale;
+	v[1] = (mesh_y - (h - 1) * 0.5f) * scale;
+	v[2] = -z * scale;
+	v[3] = float(x) / float(w - 1);  // s
+	v[4] = mesh_y / float(h - 1);    // t
+	assert(!isnan(v[2]));
+}
+
+static void plyFace(uint8_t *start, uint32_t a, uint32_t b, uint32_t c) {
+	start[0] = 3;
+	uint32_t face[3] = { a, b, c };
+	memcpy(start + 1, face, 12);
+}
+
 bool savePly(const QString &filename, size_t w, size_t h, std::vector<float> &z, float downsampling, float pixel_size) {
 	QFile file(filename);
 	bool success = file.open(QFile::WriteOnly);
 	if(!success)
 		return false;
-	{
-		QTextStream stream(&file);
-
-		stream << "ply\n";
-		stream << "format binary_little_endian 1.0\n";
-		stream << "element vertex " << w*h << "\n";
-		stream << "property float x\n";
-		stream << "property float y\n";
-		stream << "property float z\n";
-		stream << "property float s\n";
-		stream << "property float t\n";
-		stream << "element face " << 2*(w-1)*(h-1) << "\n";
-		stream << "property list uchar int vertex_index\n";
-		stream << "end_header\n";
-	}
+	writePlyHeader(file, w*h, 2*(w-1)*(h-1));
 
 	float scale = (pixel_size > 0) ? downsampling * pixel_size : downsampling;
-	float cx = (w - 1) * 0.5f;
-	float cy = (h - 1) * 0.5f;
 
-	std::vector<float> vertices(w*h*5);
+	//vertices and faces are written one row at a time.
+	std::vector<float> vertices(w*5);
 	for(size_t y = 0; y < h; y++) {
-		for(size_t x = 0; x < w; x++) {
-			size_t pos = x + y*w;
-			float *start = &vertices[5*pos];
-			float mesh_y = float(h - 1 - y);
-			start[0] = (float(x) - cx) * scale;
-			start[1] = (mesh_y - cy) * scale;
-			start[2] = -z[pos] * scale;
-			start[3] = float(x) / float(w - 1);  // s
-			start[4] = mesh_y / float(h - 1);    // t
-			assert(!isnan(start[2]));
-		}
+		for(size_t x = 0; x < w; x++)
+			plyVertex(&vertices[5*x], x, y, w, h, z[x + y*w], scale);
+		if(file.write((const char *)vertices.data(), vertices.size()*4) != qint64(vertices.size()*4))
+			return false;
 	}
-	std::vector<uint8_t> indices(13*2*(w-1)*(h-1));
+	std::vector<uint8_t> indices(13*2*(w-1));
 	for(size_t y = 0; y < h-1; y++) {
 		for(size_t x = 0; x < w-1; x++) {
-			size_t pos = x + y*w;
-			uint8_t *start = &indices[26*(x + y*(w-1))];
-			start[0] = 3;
-			int *face = (int *)(start + 1);
-			assert(pos+w+1 < w*h);
-			face[0] = pos;
-			face[1] = pos+w;
-			face[2] = pos+w+1;
-
-			start += 13;
-			start[0] = 3;
-			face = (int *)(start + 1);
-			face[0] = pos;
-			face[1] = pos+w+1;
-			face[2] = pos+1;
+			uint32_t pos = x + y*w;
+			plyFace(&indices[26*x], pos, pos+w, pos+w+1);
+			plyFace(&indices[26*x + 13], pos, pos+w+1, pos+1);
+		}
+		if(file.write((const char *)indices.data(), indices.size()) != qint64(indices.size()))
+			return false;
+	}
+	file.close();
+	return true;
+}
+
+/* Right triangulated irregular network (as in mapbox martini): the heightmap is split in square tiles of
+ * tile_side + 1 vertices, the error of each vertex is the height error of the triangles it splits (and of their children).
+ * Triangles are split until the error is below max_error, so within a tile the mesh has no cracks.
+ * Tiles extending beyond the heightmap refine fully across its border and drop the triangles outside.
+ * Neighbouring tiles may refine differently along the shared side: the triangles there are split at the
+ * vertices of the other tile, removing t-junctions.
+ */
+static const int tile_side = 512;
+
+static void rtinTile(size_t w, size_t h, const std::vector<float> &z, int x0, int y0, float max_error,
+					 std::vector<float> &errors, std::vector<uint64_t> &triangles) {
+	const int side = tile_side;
+	const int size = side + 1;
+	int limit_x = int(w) - 1 - x0; //last column inside
+	int limit_y = int(h) - 1 - y0;
+	auto height = [&](int x, int y) {
+		return z[std::min(x0 + x, int(w) - 1) + std::min(y0 + y, int(h) - 1)*w];
+	};
+
+	errors.assign(size*size, 0.0f);
+	const float inf = std::numeric_limits<float>::infinity();
+	int64_t ntriangles = int64_t(side)*side*2 - 2;
+	int64_t nparents = ntriangles - int64_t(side)*side;
+
+	//finest triangles first: the errors of the children are complete when the parent is processed.
+	for(int64_t i = ntriangles - 1; i >= 0; i--) {
+		int64_t id = i + 2;
+		int ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+		if(id & 1) {
+			bx = by = cx = side;
+		} else {
+			ax = ay = cy = side;
+		}
+		while((id >>= 1) > 1) {
+			int mx = (ax + bx) >> 1;
+			int my = (ay + by) >> 1;
+			if(id & 1) {
+				bx = ax; by = ay;
+				ax = cx; ay = cy;
+			} else {
+				ax = bx; ay = by;
+				bx = cx; by = cy;
+			}
+			cx = mx; cy = my;
+		}
+		int min_x = std::min(ax, std::min(bx, cx)), max_x = std::max(ax, std::max(bx, cx));
+		int min_y = std::min(ay, std::min(by, cy)), max_y = std::max(ay, std::max(by, cy));
+		if(min_x > limit_x || min_y > limit_y) //outside.
+			continue;
+
+		int mx = (ax + bx) >> 1;
+		int my = (ay + by) >> 1;
+		float &error = errors[mx + my*size];
+		if(max_x > limit_x || max_y > limit_y) {
+			error = inf;
+			continue;
+		}
+		float interpolated = (height(ax, ay) + height(bx, by))/2;
+		error = std::max(error, fabs(interpolated - height(mx, my)));
+		if(i < nparents) {
+			int left = ((ax + cx) >> 1) + ((ay + cy) >> 1)*size;
+			int right = ((bx + cx) >> 1) + ((by + cy) >> 1)*size;
+			error = std::max(error, std::max(errors[left], errors[right]));
+		}
+	}
+
+	std::function<void(int, int, int, int, int, int)> process = [&](int ax, int ay, int bx, int by, int cx, int cy) {
+		int mx = (ax + bx) >> 1;
+		int my = (ay + by) >> 1;
+		if(abs(ax - cx) + abs(ay - cy) > 1 && errors[mx + my*size] > max_error) {
+			process(cx, cy, ax, ay, mx, my);
+			process(bx, by, cx, cy, mx, my);
+			return;
+		}
+		if(std::max(ax, std::max(bx, cx)) > limit_x || std::max(ay, std::max(by, cy)) > limit_y)
+			return;
+		//same winding as the full grid.
+		if((bx - ax)*(cy - ay) - (by - ay)*(cx - ax) > 0) {
+			std::swap(bx, cx);
+			std::swap(by, cy);
 		}
+		triangles.push_back(uint64_t(x0 + ax) + uint64_t(y0 + ay)*w);
+		triangles.push_back(uint64_t(x0 + bx) + uint64_t(y0 + by)*w);
+		triangles.push_back(uint64_t(x0 + cx) + uint64_t(y0 + cy)*w);
+	};
+	process(0, 0, side, side, side, 0);
+	process(side, side, 0, 0, 0, side);
+}
+
+bool saveAdaptivePly(const QString &filename, size_t w, size_t h, std::vector<float> &z, float max_error, float downsampling, float pixel_size) {
+	if(w < 2 || h < 2)
+		return savePly(filename, w, h, z, downsampling, pixel_size);
+	size_t tiles_x = (w - 2)/tile_side + 1;
+	size_t tiles_y = (h - 2)/tile_side + 1;
+	std::vector<std::vector<uint64_t>> tiles(tiles_x*tiles_y);
+
+	RelightThreadPool pool;
+	pool.start(std::thread::hardware_concurrency());
+	for(size_t t = 0; t < tiles.size(); t++) {
+		pool.queue([&, t]() {
+			std::vector<float> errors;
+			rtinTile(w, h, z, (t % tiles_x)*tile_side, (t / tiles_x)*tile_side, max_error, errors, tiles[t]);
+		});
+	}
+	pool.finish();
+
+	//vertices on the tile sides, per side line.
+	std::vector<std::vector<uint32_t>> columns(tiles_x + 1), rows(tiles_y + 1);
+	for(auto &tile: tiles) {
+		for(uint64_t v: tile) {
+			uint32_t x = v % w, y = v / w;
+			if(x % tile_side == 0)
+				columns[x / tile_side].push_back(y);
+			if(y % tile_side == 0)
+				rows[y / tile_side].push_back(x);
+		}
+	}
+	for(auto *lines: { &columns, &rows })
+		for(auto &line: *lines) {
+			std::sort(line.begin(), line.end());
+			line.erase(std::unique(line.begin(), line.end()), line.end());
+		}
+
+	//split the triangles with a side on a tile side where the other tile has more vertices.
+	std::vector<uint64_t> triangles;
+	for(auto &tile: tiles) {
+		std::vector<uint64_t> todo;
+		for(size_t i = 0; i < tile.size(); i += 3) {
+			todo.assign(tile.begin() + i, tile.begin() + i + 3);
+			while(todo.size()) {
+				uint64_t t[3] = { todo[todo.size()-3], todo[todo.size()-2], todo[todo.size()-1] };
+				todo.resize(todo.size() - 3);
+				bool split = false;
+				for(int e = 0; e < 3 && !split; e++) {
+					uint64_t a = t[e], b = t[(e+1)%3], c = t[(e+2)%3];
+					uint32_t ax = a % w, ay = a / w, bx = b % w, by = b / w;
+					std::vector<uint32_t> *line = nullptr;
+					uint32_t from, to;
+					if(ax == bx && ax % tile_side == 0) {
+						line = &columns[ax / tile_side];
+						from = ay; to = by;
+					} else if(ay == by && ay % tile_side == 0) {
+						line = &rows[ay / tile_side];
+						from = ax; to = bx;
+					} else
+						continue;
+					auto first = std::upper_bound(line->begin(), line->end(), std::min(from, to));
+					auto last = std::lower_bound(line->begin(), line->end(), std::max(from, to));
+					if(first == last)
+						continue;
+					//fan from c, the points go from a to b.
+					std::vector<uint64_t> points;
+					for(auto p = first; p != last; p++)
+						points.push_back(ax == bx ? ax + uint64_t(*p)*w : *p + uint64_t(ay)*w);
+					if(from > to)
+						std::reverse(points.begin(), points.end());
+					uint64_t prev = a;
+					for(uint64_t p: points) {
+						todo.insert(todo.end(), { prev, p, c });
+						prev = p;
+					}
+					todo.insert(todo.end(), { prev, b, c });
+					split = true;
+				}
+				if(!split)
+					triangles.insert(triangles.end(), t, t + 3);
+			}
+		}
+		std::vector<uint64_t>().swap(tile);
+	}
+
+	std::vector<uint64_t> vertices = triangles;
+	std::sort(vertices.begin(), vertices.end());
+	vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+	QFile file(filename);
+	if(!file.open(QFile::WriteOnly))
+		return false;
+	writePlyHeader(file, vertices.size(), triangles.size()/3);
+
+	float scale = (pixel_size > 0) ? downsampling * pixel_size : downsampling;
+	const size_t chunk = 1<<16;
+	std::vector<float> buffer;
+	for(size_t i = 0; i < vertices.size(); i += chunk) {
+		size_t n = std::min(chunk, vertices.size() - i);
+		buffer.resize(n*5);
+		for(size_t k = 0; k < n; k++) {
+			uint64_t v = vertices[i + k];
+			plyVertex(&buffer[5*k], v % w, v / w, w, h, z[v], scale);
+		}
+		if(file.write((const char *)buffer.data(), buffer.size()*4) != qint64(buffer.size()*4))
+			return false;
+	}
+	std::vector<uint8_t> faces;
+	for(size_t i = 0; i < triangles.size(); i += 3*chunk) {
+		size_t n = std::min(chunk, (triangles.size() - i)/3);
+		faces.resize(n*13);
+		for(size_t k = 0; k < n; k++) {
+			uint32_t index[3];
+			for(int j = 0; j < 3; j++)
+				index[j] = std::lower_bound(vertices.begin(), vertices.end(), triangles[i + 3*k + j]) - vertices.begin();
+			plyFace(&faces[13*k], index[0], index[1], index[2]);
+		}
+		if(file.write((const char *)faces.data(), faces.size()) != qint64(faces.size()))
+			return false;
 	}
-	file.write((const char *)vertices.data(), vertices.size()*4);
-	file.write((const char *)indices.data(), indices.size());
 	file.close();
 	return true;
 }
@@ -28,6 +28,9 @@ std::vector<float> bni_pyramid(std::function<bool(QString s, int n)> progressed,
 								  int scale = 0);
 
 bool savePly(const QString &filename, size_t w, size_t h, std::vector<float> &z, float downsampling = 1.0f, float pixel_size = 0.0f);
+//adaptive triangulation: fewer triangles where the surface is flat, the height error is below max_error (pixels).
+bool saveAdaptivePly(const QString &filename, size_t w, size_t h, std::vector<float> &z, float max_error,
+					 float downsampling = 1.0f, float pixel_size = 0.0f);
 bool saveTiff(const QString &filename, size_t w, size_t h, std::vector<float> &z, bool normalize = false, float pixel_size = 0.0f);
 bool saveDepthMap(const QString &filename, size_t w, size_t h, std::vector<float> &z);
 
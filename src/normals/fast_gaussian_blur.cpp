@@ -1,12 +1,21 @@
 #include "fast_gaussian_blur.h"
+#include "../relight_threadpool.h"
 
 #include <stdlib.h>
 #include <math.h>
+#include <thread>
+#include <algorithm>
 
 void fast_gaussian_blur(std::vector<float> &data, unsigned int width, unsigned int height, float sigma) {
+	fast_gaussian_blur(data.data(), width, height, 1, sigma);
+}
 
-	// Allocate buffers
-	std::vector<double> buffer(width*height, 0);
+/* Recursive gaussian (Young, van Vliet): the cost does not depend on sigma.
+ * Rows are filtered in parallel, columns in blocks of adjacent floats so that
+ * each step reads contiguous memory and the block loop vectorizes.
+ * Values are stored as float, the filter state is double.
+ */
+void fast_gaussian_blur(float *data, unsigned int width, unsigned int height, unsigned int channels, float sigma) {
 
 	double q;
 	if (sigma >= 2.5f)
@@ -16,69 +25,86 @@ void fast_gaussian_blur(std::vector<float> &data, unsigned int width, unsigned i
 	else
 		return;
 
-
 	double b0 = 1.57825f + 2.44413f*q + 1.4281f*q*q + 0.422205f*q*q*q;
 	double b1 = 2.44413f*q + 2.85619f*q*q + 1.26661f*q*q*q;
 	double b2 = -( 1.4281f*q*q + 1.26661f*q*q*q );
 	double b3 = 0.422205f*q*q*q;
 
 	double B = 1.0 - (b1 + b2 + b3) / b0;
-
-	double prev1, prev2, prev3;
-
-	// Horizontal forward pass
-	for(unsigned int y = 0; y < height; y++) {
-		prev1 = prev2 = prev3 = data[y*width];
-
-		for(unsigned int x = 0; x < width; x++) {
-			double val = B * double(data[x + y*width]) + (b1 * prev1 + b2 * prev2 + b3 * prev3) / b0;
-			buffer[x + y*width] = val;
-			prev3 = prev2;
-			prev2 = prev1;
-			prev1 = val;
-		}
-	}
-
-	// Backward pass
-	for(unsigned int y = height-1; y < height; y--) {
-		prev1 = prev2 = prev3 = buffer[width-1 +  y*width];
-
-		for(int x = width-1; x >= 0; x--) {
-			double val = B * buffer[x + y*width] + (b1 * prev1 + b2 * prev2 + b3 * prev3) / b0;
-			buffer[x + y*width] = val;
-			prev3 = prev2;
-			prev2 = prev1;
-			prev1 = val;
-
-		}
+	b1 /= b0;
+	b2 /= b0;
+	b3 /= b0;
+
+	size_t line = size_t(width)*channels;
+	unsigned int nthreads = std::max(1u, std::thread::hardware_concurrency());
+	RelightThreadPool pool;
+	pool.start(nthreads);
+
+	// Horizontal forward and backward pass
+	unsigned int rows = std::max(1u, height/(4*nthreads));
+	for(unsigned int y0 = 0; y0 < height; y0 += rows) {
+		pool.queue([&, y0]() {
+			for(unsigned int y = y0; y < std::min(height, y0 + rows); y++) {
+				float *row = data + y*line;
+				for(unsigned int c = 0; c < channels; c++) {
+					double prev1, prev2, prev3;
+					prev1 = prev2 = prev3 = row[c];
+					for(size_t i = c; i < line; i += channels) {
+						double val = B * row[i] + b1 * prev1 + b2 * prev2 + b3 * prev3;
+						row[i] = float(val);
+						prev3 = prev2;
+						prev2 = prev1;
+						prev1 = val;
+					}
+					prev1 = prev2 = prev3 = row[line - channels + c];
+					for(size_t i = line - channels + c; i < line; i -= channels) {
+						double val = B * row[i] + b1 * prev1 + b2 * prev2 + b3 * prev3;
+						row[i] = float(val);
+						prev3 = prev2;
+						prev2 = prev1;
+						prev1 = val;
+					}
+				}
+			}
+		});
 	}
-
-	// Vertical  pass
-	for(unsigned int x = 0; x < width; x++) {
-		prev1 = prev2 = prev3 = buffer[x];
-
-		for(unsigned int y = 0; y < height; y++) {
-			double val = B * buffer[x + y*width] + (b1 * prev1 + b2 * prev2 + b3 * prev3) / b0;
-			buffer[x + y*width] = val;
-			prev3 = prev2;
-			prev2 = prev1;
-			prev1 = val;
-
-		}
-	}
-
-
-	for(unsigned int x = width-1; x < width; x--) {
-		prev1 = prev2 = prev3 = buffer[x +  (height-1)*width];
-
-		for(int y = height-1; y >= 0; y--) {
-			double val = B * buffer[x + y*width] + (b1 * prev1 + b2 * prev2 + b3 * prev3) / b0;
-			data[x + y*width] = float(val);
-			prev3 = prev2;
-			prev2 = prev1;
-			prev1 = val;
-
-		}
+	pool.finish();
+
+	// Vertical forward and backward pass, on blocks of columns.
+	const size_t block = 64;
+	pool.start(nthreads);
+	for(size_t x0 = 0; x0 < line; x0 += block) {
+		pool.queue([&, x0]() {
+			size_t n = std::min(block, line - x0);
+			double prev1[block], prev2[block], prev3[block];
+
+			float *col = data + x0;
+			for(size_t k = 0; k < n; k++)
+				prev1[k] = prev2[k] = prev3[k] = col[k];
+			for(unsigned int y = 0; y < height; y++) {
+				float *row = col + y*line;
+				for(size_t k = 0; k < n; k++) {
+					double val = B * row[k] + b1 * prev1[k] + b2 * prev2[k] + b3 * prev3[k];
+					row[k] = float(val);
+					prev3[k] = prev2[k];
+					prev2[k] = prev1[k];
+					prev1[k] = val;
+				}
+			}
+			col = data + x0 + (height-1)*line;
+			for(size_t k = 0; k < n; k++)
+				prev1[k] = prev2[k] = prev3[k] = col[k];
+			for(unsigned int y = height-1; y < height; y--) {
+				float *row = data + x0 + y*line;
+				for(size_t k = 0; k < n; k++) {
+					double val = B * row[k] + b1 * prev1[k] + b2 * prev2[k] + b3 * prev3[k];
+					row[k] = float(val);
+					prev3[k] = prev2[k];
+					prev2[k] = prev1[k];
+					prev1[k] = val;
+				}
+			}
+		});
 	}
+	pool.finish();
 }
-
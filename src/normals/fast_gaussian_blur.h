@@ -5,4 +5,7 @@
 
 void fast_gaussian_blur(std::vector<float> &data, unsigned int width, unsigned int height, float sigma);
 
+//data is interleaved, channels floats per pixel, all channels are blurred in the same sweep.
+void fast_gaussian_blur(float *data, unsigned int width, unsigned int height, unsigned int channels, float sigma);
+
 #endif
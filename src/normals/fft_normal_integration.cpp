@@ -6,101 +6,29 @@
 #include <vector>
 #include <complex>
 #include <cmath>
+#include <thread>
+#include <algorithm>
 
 
 using namespace std;
 using namespace Eigen;
 
-typedef Matrix<std::complex<double>, Dynamic, Dynamic> ComplexMatrix;
+typedef std::complex<float> Complex;
 
-// Helper function to generate meshgrid-like matrices
-void meshgrid(MatrixXd& wx, MatrixXd& wy, int cols, int rows) {
-	wx.resize(rows, cols);
-	wy.resize(rows, cols);
-
-	double colMid = (cols / 2) + 1;
-	double rowMid = (rows / 2) + 1;
-	double colDiv = cols - (cols % 2);
-	double rowDiv = rows - (rows % 2);
-
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			wx(i, j) = (j + 1 - colMid) / colDiv;
-			wy(i, j) = (i + 1 - rowMid) / rowDiv;
-		}
-	}
-}
-
-MatrixXd ifftshift(const MatrixXd& input) {
-	int rows = input.rows();
-	int cols = input.cols();
-	MatrixXd shifted(rows, cols);
-
-	int rowShift = rows / 2;
-	int colShift = cols / 2;
-
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			int newRow = (i + rowShift) % rows;
-			int newCol = (j + colShift) % cols;
-			shifted(newRow, newCol) = input(i, j);
-		}
-	}
-	return shifted;
+// ifftshifted meshgrid frequency of index i over n samples: zero frequency at index 0.
+static float frequency(int i, int n) {
+	int shifted = (i - n/2 + n) % n;
+	return float(shifted - n/2) / float(n - (n % 2));
 }
-void fft2(const MatrixXd& input, ComplexMatrix& output) {
-	int rows = input.rows();
-	int cols = input.cols();
 
-	// Prepare data
-	std::vector<std::complex<double>> data(rows * cols);
-	for (int y = 0; y < rows; ++y) {
-		for (int x = 0; x < cols; ++x) {
-			data[y * cols + x] = input(y, x);
-		}
-	}
-
-	// Perform FFT
-	ptrdiff_t element_size = sizeof(std::complex<double>);
+// 2D fft of a row major rows x cols buffer, in place.
+static void fft2(std::vector<Complex> &data, int cols, int rows, bool forward, float fct) {
+	ptrdiff_t element_size = sizeof(Complex);
 	pocketfft::shape_t shape = {size_t(cols), size_t(rows)};
 	pocketfft::stride_t stride = { element_size, ptrdiff_t(cols)*element_size };
 	pocketfft::shape_t axes{0, 1};
-
-	pocketfft::c2c(shape, stride, stride, axes, pocketfft::FORWARD, data.data(), data.data(), 1.0);
-
-	// Fill output
-	output.resize(rows, cols);
-	for (int y = 0; y < rows; ++y)
-		for (int x = 0; x < cols; ++x) {
-			output(y, x) = data[y * cols + x];
-		}
-}
-
-// Function to compute 2D IFFT using PocketFFT
-void ifft2(const ComplexMatrix& input, MatrixXd& output) {
-	int rows = input.rows();
-	int cols = input.cols();
-
-	// Prepare data
-	std::vector<std::complex<double>> data(rows * cols);
-	for (int i = 0; i < rows; ++i)
-		for (int j = 0; j < cols; ++j) {
-			data[i * cols + j] = input(i, j);
-		}
-
-	// Perform IFFT
-	ptrdiff_t element_size = sizeof(std::complex<double>);
-	pocketfft::shape_t shape = {size_t(cols), size_t(rows)};
-	pocketfft::stride_t stride = { element_size, ptrdiff_t(cols)*element_size };
-	pocketfft::shape_t axes{0, 1};
-	pocketfft::c2c(shape, stride, stride, axes, pocketfft::BACKWARD, data.data(), data.data(), 1.0/(4*sqrt(2)* rows * cols));
-
-	// Fill output and normalize
-	output.resize(rows, cols);
-	for (int i = 0; i < rows; ++i)
-		for (int j = 0; j < cols; ++j) {
-			output(i, j) = data[i * cols + j].real();
-		}
+	size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+	pocketfft::c2c(shape, stride, stride, axes, forward, data.data(), data.data(), fct, nthreads);
 }
 
 void pad(int &w, int &h, std::vector<Eigen::Vector3f> &normals, int padding) {
@@ -171,49 +99,41 @@ void fft_integrate(std::function<bool(QString s, int n)> progressed,
 	pad(cols, rows, normals, padding);
 
 
-	MatrixXd dzdx(rows, cols);
-	MatrixXd dzdy(rows, cols);
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			auto &normal = normals[i * cols + j];
-			dzdx(i, j) = normal[0] / normal[2]; // dz/dx = -nx/nz
-			dzdy(i, j) = -normal[1] / normal[2]; // dz/dy = -ny/nz			assert(!isnan(dzdx(i, j)));
-			assert(!isnan(dzdy(i, j)));
-		}
+	//single precision is plenty for a spectral solve, the gradients come from float normals.
+	size_t n = size_t(rows)*cols;
+	std::vector<Complex> DZDX(n), DZDY(n);
+	for (size_t i = 0; i < n; ++i) {
+		auto &normal = normals[i];
+		DZDX[i] = normal[0] / normal[2];  // dz/dx = -nx/nz
+		DZDY[i] = -normal[1] / normal[2]; // dz/dy = -ny/nz
+		assert(!isnan(DZDX[i].real()));
+		assert(!isnan(DZDY[i].real()));
 	}
-
-	MatrixXd wx, wy;
-	meshgrid(wx, wy, cols, rows);
-
-	wx = ifftshift(wx);
-	wy = ifftshift(wy);
+	std::vector<Eigen::Vector3f>().swap(normals);
 
 	// Fourier Transforms of gradients
-	ComplexMatrix DZDX, DZDY;
-	fft2(dzdx, DZDX);
-	fft2(dzdy, DZDY);
-
-	// Frequency domain integration
-	ComplexMatrix Z(rows, cols);
-	std::complex<double> j(0, 1); // Imaginary unit
+	fft2(DZDX, cols, rows, pocketfft::FORWARD, 1.0f);
+	fft2(DZDY, cols, rows, pocketfft::FORWARD, 1.0f);
 
+	// Frequency domain integration, Z overwrites DZDX.
+	const Complex j(0, 1); // Imaginary unit
 	for (int y = 0; y < rows; ++y) {
+		float wy = frequency(y, rows);
 		for (int x = 0; x < cols; ++x) {
-			double wx2_wy2 = wx(y, x) * wx(y, x) + wy(y, x) * wy(y, x) + 1e-12; // Avoid division by zero
-			Z(y, x) = (-j * wx(y, x) * DZDX(y, x) - j * wy(y, x) * DZDY(y, x)) / wx2_wy2;
+			float wx = frequency(x, cols);
+			float wx2_wy2 = wx*wx + wy*wy + 1e-12f; // Avoid division by zero
+			size_t i = size_t(y)*cols + x;
+			DZDX[i] = (-j * wx * DZDX[i] - j * wy * DZDY[i]) / wx2_wy2;
 		}
 	}
+	std::vector<Complex>().swap(DZDY);
 
 	// Inverse FFT to reconstruct z
-	MatrixXd z;
-	ifft2(Z, z);
+	fft2(DZDX, cols, rows, pocketfft::BACKWARD, float(1.0/(4*sqrt(2)*double(rows)*cols)));
 
-	heights.resize(rows* cols);
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			heights[i * cols + j] = static_cast<float>(z(i, j));
-		}
-	}
+	heights.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		heights[i] = DZDX[i].real();
 	depad(cols, rows, heights, padding);
 
 	/*
@@ -11,6 +11,7 @@
  * IEEE PAMI Vol 10, No 4 July 1988. pp 439-451
  */
 
+// integrates in single precision, normalmap is padded and released.
 void fft_integrate(std::function<bool(QString s, int n)> progressed,
 								  int w, int h, std::vector<Eigen::Vector3f> &normalmap, std::vector<float> &heights);
 
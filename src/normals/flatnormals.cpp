@@ -1,5 +1,6 @@
 #include "flatnormals.h"
 #include "fast_gaussian_blur.h"
+#include "../relight_threadpool.h"
 #include <assm/Grid.h>
 
 #include <QFile>
@@ -16,9 +17,31 @@ using namespace Eigen;
 using namespace pocketfft;
 
 #include <vector>
+#include <thread>
+#include <functional>
 #include <iostream>
 using namespace std;
 
+//rows are split in a few bands per thread.
+static int bandRows(int h) {
+	int nthreads = std::max(1u, std::thread::hardware_concurrency());
+	return std::max(1, (h + 4*nthreads - 1)/(4*nthreads));
+}
+
+static int rowBands(int h) {
+	return (h + bandRows(h) - 1)/bandRows(h);
+}
+
+//f(band, start, end) is run in parallel on the bands.
+static void forRowBands(int h, std::function<void(int band, int y0, int y1)> f) {
+	int step = bandRows(h);
+	RelightThreadPool pool;
+	pool.start(std::max(1u, std::thread::hardware_concurrency()));
+	for(int band = 0; band < rowBands(h); band++)
+		pool.queue([&, band]() { f(band, band*step, std::min(h, (band + 1)*step)); });
+	pool.finish();
+}
+
 NormalsImage::~NormalsImage() {
 
 }
@@ -73,158 +96,177 @@ void NormalsImage::save(QString filename) {
 void flattenRadialNormals(int w, int h, std::vector<Eigen::Vector3f> &normals, double binSize) {
 
 	//don't use normals not flat enough
-	double z_threshold = 0.7171;
-	vector<double> binCount;
-	vector<double> derivatives;
-	for(int y = 0; y < h; y++) {
-		for(int x = 0; x < w; x++) {
-			int index = 3*(x + y*w);
-
-			Vector3d n;
-			n[0] = double(normals[index/3][0]);
-			n[1] = double(normals[index/3][1]);
-			n[2] = double(normals[index/3][2]);
-
-			assert(!isnan(n[0]));
-			assert(!isnan(n[1]));
-			assert(!isnan(n[2]));
-
-			if(n[2] < z_threshold) continue;
-
-			Vector3d radial;
-			radial[0] = x - w/2.0;
-			radial[1] = h/2.0 - y;
-			radial[2] = 1.0; //TODO Was zero!
-			double distance = radial.norm();
-			assert(distance > 0);
-			radial.normalize();
-
-			double outward = radial.dot(n);
-			int bin = (int) floor(distance/binSize);
-			if(derivatives.size() < size_t(bin+1)) {
-				derivatives.resize(bin+1, 0.0);
-				binCount.resize(bin+1, 0);
+	float z_threshold = 0.7171f;
+	double cx = w/2.0, cy = h/2.0;
+	size_t nbins = size_t(floor(sqrt(cx*cx + cy*cy + 1.0)/binSize)) + 1;
+
+	//outward component of the normals binned by distance from the center, per band of rows.
+	int nbands = rowBands(h);
+	vector<vector<double>> band_derivatives(nbands, vector<double>(nbins, 0.0));
+	vector<vector<double>> band_count(nbands, vector<double>(nbins, 0.0));
+	forRowBands(h, [&](int band, int y0, int y1) {
+		vector<double> &derivatives = band_derivatives[band];
+		vector<double> &binCount = band_count[band];
+		for(int y = y0; y < y1; y++) {
+			double ry = cy - y;
+			for(int x = 0; x < w; x++) {
+				const Eigen::Vector3f &n = normals[x + y*w];
+				assert(!isnan(n[0]) && !isnan(n[1]) && !isnan(n[2]));
+				if(n[2] < z_threshold) continue;
+
+				double rx = x - cx;
+				double distance = sqrt(rx*rx + ry*ry + 1.0); //TODO z was zero!
+				double outward = (rx*n[0] + ry*n[1] + n[2])/distance;
+				int bin = (int) floor(distance/binSize);
+				derivatives[bin] += outward;
+				binCount[bin]++;
 			}
-			derivatives[bin] += outward;
-			binCount[bin]++;
 		}
-	}
-	for(size_t i = 0; i < derivatives.size(); i++)
-		derivatives[i] /= binCount[i];
-
-#if 0
-	QFile csv("bins.csv");
-	csv.open(QFile::WriteOnly | QFile::Truncate);
-	QTextStream stream(&csv);
-	for(int i = 0; i < derivatives.size(); i++)
-		stream << i << "," << derivatives[i] << endl;
-#endif
+	});
 
+	//line fit of the mean derivatives, empty bins are skipped.
 	double sum_x = 0;
 	double sum_y = 0;
 	double sum_xy = 0;
 	double sum_x2 = 0;
-
-	for(size_t i = 0; i < derivatives.size(); i++) {
+	int n = 0;
+	for(size_t i = 0; i < nbins; i++) {
+		double derivative = 0, count = 0;
+		for(int band = 0; band < nbands; band++) {
+			derivative += band_derivatives[band][i];
+			count += band_count[band][i];
+		}
+		if(count == 0)
+			continue;
+		derivative /= count;
 		double x = i * binSize + binSize/2.0;
 		sum_x += x;
-		sum_y += derivatives[i];
-		sum_xy += x * derivatives[i];
+		sum_y += derivative;
+		sum_xy += x * derivative;
 		sum_x2 += x*x;
+		n++;
 	}
+	if(n < 2)
+		return;
 
 	// means
-	double mean_x = sum_x / derivatives.size();
-	double mean_y = sum_y / derivatives.size();
+	double mean_x = sum_x / n;
+	double mean_y = sum_y / n;
 
-	float varx = sum_x2 - sum_x * mean_x;
-	float cov = sum_xy - sum_x * mean_y;
+	double varx = sum_x2 - sum_x * mean_x;
+	double cov = sum_xy - sum_x * mean_y;
+	if(varx <= 0)
+		return;
 
-	// check for zero varx
-	double M = cov / varx;
-	double Q = mean_y - M * mean_x;
+	float M = float(cov / varx);
+	float Q = float(mean_y - M * mean_x);
 
 	//overwrite normals;
-
-	for(int y = 0; y < h; y++) {
-		for(int x = 0; x < w; x++) {
-			Vector3d n;
-			int idx = 3*(x + y*w);
-			n[0] = double(normals[idx/3][0]);
-			n[1] = double(normals[idx/3][1]);
-			n[2] = double(normals[idx/3][2]);
-			Vector3d radial;
-			radial[0] = x - w/2.0;
-			radial[1] = h/2.0 - y;
-			radial[2] = 0;
-			double distance = radial.norm();
-			double inward = M*distance + Q;
-			radial.normalize();
-			radial = radial * inward;
-			n -= radial;
-			n.normalize();
-			int pos = x + y*w;
-			normals[pos][0] = float(n[0]);
-			normals[pos][1] = float(n[1]);
-			normals[pos][2] = float(n[2]);
-
+	forRowBands(h, [&](int, int y0, int y1) {
+		for(int y = y0; y < y1; y++) {
+			float ry = float(cy - y);
+			Eigen::Vector3f *row = normals.data() + size_t(y)*w;
+			for(int x = 0; x < w; x++) {
+				float rx = float(x - cx);
+				float distance = sqrt(rx*rx + ry*ry);
+				float k = distance > 0 ? (M*distance + Q)/distance : 0.0f;
+				float nx = row[x][0] - k*rx;
+				float ny = row[x][1] - k*ry;
+				float nz = row[x][2];
+				float d = 1.0f/sqrt(nx*nx + ny*ny + nz*nz);
+				row[x][0] = nx*d;
+				row[x][1] = ny*d;
+				row[x][2] = nz*d;
+			}
 		}
-	}
+	});
 }
 
 
-void flattenRadialHeights(int w, int h, std::vector<float> &heights, double binSize) {
-
-	vector<double> z(heights.size());
-
-	//subsampling?
-	Eigen::MatrixXd A(w*h, 6);
-	for(int y = 0; y < h; y++) {
-		for(int x= 0; x < w; x++) {
-			int i = x + y*w;
-			A(i, 0) = 1;
-			A(i, 1) = x;
-			A(i, 2) = y;
-			A(i, 3) = x * x;
-			A(i, 4) = y * y;
-			A(i, 5) = x * y;
-			z[i] = double(heights[i]);
+void flattenRadialHeights(int w, int h, std::vector<float> &heights, double /*binSize*/, int stride) {
+	stride = std::max(1, stride);
+
+	//quadric z = c0 + c1*u + c2*v + c3*u² + c4*v² + c5*u*v, u and v are centered and scaled to [-1, 1].
+	//the normal equations need the sums of u^i*v^j (from the sampled columns and rows)
+	//and of z, z*u, z*u² for each row: no design matrix is built.
+	double cx = (w - 1)/2.0, cy = (h - 1)/2.0;
+	double scale = 2.0/std::max(1, std::max(w, h) - 1);
+	auto U = [&](int x) { return (x - cx)*scale; };
+	auto V = [&](int y) { return (y - cy)*scale; };
+
+	double su[5] = { 0, 0, 0, 0, 0 }, sv[5] = { 0, 0, 0, 0, 0 };
+	for(int x = 0; x < w; x += stride)
+		for(int k = 0; k < 5; k++)
+			su[k] += pow(U(x), k);
+	for(int y = 0; y < h; y += stride)
+		for(int k = 0; k < 5; k++)
+			sv[k] += pow(V(y), k);
+
+	int nbands = rowBands(h);
+	vector<Eigen::Matrix<double, 6, 1>> band_b(nbands, Eigen::Matrix<double, 6, 1>::Zero());
+	forRowBands(h, [&](int band, int y0, int y1) {
+		Eigen::Matrix<double, 6, 1> &b = band_b[band];
+		for(int y = y0 + (stride - y0 % stride) % stride; y < y1; y += stride) {
+			const float *row = heights.data() + size_t(y)*w;
+			double z0 = 0, z1 = 0, z2 = 0;
+			for(int x = 0; x < w; x += stride) {
+				double z = row[x];
+				double u = U(x);
+				z0 += z;
+				z1 += z*u;
+				z2 += z*u*u;
+			}
+			double v = V(y);
+			b += Eigen::Matrix<double, 6, 1>(z0, z1, v*z0, z2, v*v*z0, v*z1);
 		}
-	}
-
-	Eigen::VectorXd b = Eigen::Map<const Eigen::VectorXd>(z.data(), w*h);
-
-	// Solve  A^T * A * coeffs = A^T * b
-	Eigen::VectorXd coeffs = (A.transpose() * A).ldlt().solve(A.transpose() * b);
+	});
+	Eigen::Matrix<double, 6, 1> Atb = Eigen::Matrix<double, 6, 1>::Zero();
+	for(auto &b: band_b)
+		Atb += b;
+
+	//exponents of u and v of the basis 1, u, v, u², v², uv.
+	const int eu[6] = { 0, 1, 0, 2, 0, 1 };
+	const int ev[6] = { 0, 0, 1, 0, 2, 1 };
+	Eigen::Matrix<double, 6, 6> AtA;
+	for(int i = 0; i < 6; i++)
+		for(int j = 0; j < 6; j++)
+			AtA(i, j) = su[eu[i] + eu[j]] * sv[ev[i] + ev[j]];
+
+	Eigen::Matrix<double, 6, 1> coeffs = AtA.ldlt().solve(Atb);
 	cout << coeffs << endl;
 
-	for(int y = 0; y < h; y++) {
-		for(int x= 0; x < w; x++) {
-			int i = x + y*w;
-			double h = coeffs(0) + coeffs(1) * x + coeffs(2) * y
-					+ coeffs(3) * x * x + coeffs(4) * y * y
-					+ coeffs(5) * x * y;
-			heights[i]  = float(z[i] - h);
+	forRowBands(h, [&](int, int y0, int y1) {
+		for(int y = y0; y < y1; y++) {
+			double v = V(y);
+			//z = r0 + r1*u + r2*u² along the row.
+			float r0 = float(coeffs(0) + coeffs(2)*v + coeffs(4)*v*v);
+			float r1 = float(coeffs(1) + coeffs(5)*v);
+			float r2 = float(coeffs(3));
+			float u0 = float(-cx*scale), du = float(scale);
+			float *row = heights.data() + size_t(y)*w;
+			for(int x = 0; x < w; x++) {
+				float u = u0 + x*du;
+				row[x] -= r0 + u*(r1 + u*r2);
+			}
 		}
-	}
+	});
 }
 
 
 void flattenBlurNormals(int w, int h, std::vector<Eigen::Vector3f> &normals, double sigma) {
-	std::vector<float> b[2];
-	for(int k = 0; k < 2; k++) {
-		std::vector<float> &v = b[k];
-		v.reserve(normals.size());
-		for(Eigen::Vector3f n: normals) {
-			n[k] = n[k]/n[2];
-			v.push_back(n[k]);
-		}
-		fast_gaussian_blur(v, w, h, sigma);
+	//gradients interleaved, both blurred in one sweep.
+	std::vector<float> b(normals.size()*2);
+	for(size_t i = 0; i < normals.size(); i++) {
+		const auto &n = normals[i];
+		b[2*i] = n[0]/n[2];
+		b[2*i+1] = n[1]/n[2];
 	}
+	fast_gaussian_blur(b.data(), w, h, 2, sigma);
+
 	for(size_t i = 0; i < normals.size(); i++) {
 		auto &n = normals[i];
-		n[0] -= b[0][i];
-		n[1] -= b[1][i];
+		n[0] -= b[2*i];
+		n[1] -= b[2*i+1];
 
 		float d = 1/sqrt(n[0]*n[0] + n[1]*n[1] + 1);
 		n[0] *= d;
@@ -523,22 +565,24 @@ void flattenPlaneNormals(int w, int h, std::vector<Eigen::Vector3f> &normals,
 void applyNormalCorrection(int w, int h, std::vector<Eigen::Vector3f> &normals,
                            const SurfaceCoeffs &sc)
 {
-	for(int y = 0; y < h; y++) {
-		for(int x = 0; x < w; x++) {
-			double wx = x - sc.center.x();
-			double wy = sc.center.y() - y;
-			double gx, gy;
-			sc.gradient(wx, wy, gx, gy);
-			Eigen::Vector3f n_fit(-(float)gx, -(float)gy, 1.0f);
-			n_fit.normalize();
-			Eigen::Vector3f axis = n_fit.cross(Eigen::Vector3f(0, 0, 1));
-			float sin_a = axis.norm();
-			if(sin_a < 1e-6f) continue;
-			axis /= sin_a;
-			Eigen::Matrix3f R = Eigen::AngleAxisf(std::atan2(sin_a, n_fit[2]), axis).toRotationMatrix();
-			normals[x + y*w] = (R * normals[x + y*w]).normalized();
+	forRowBands(h, [&](int, int y0, int y1) {
+		for(int y = y0; y < y1; y++) {
+			for(int x = 0; x < w; x++) {
+				double wx = x - sc.center.x();
+				double wy = sc.center.y() - y;
+				double gx, gy;
+				sc.gradient(wx, wy, gx, gy);
+				Eigen::Vector3f n_fit(-(float)gx, -(float)gy, 1.0f);
+				n_fit.normalize();
+				Eigen::Vector3f axis = n_fit.cross(Eigen::Vector3f(0, 0, 1));
+				float sin_a = axis.norm();
+				if(sin_a < 1e-6f) continue;
+				axis /= sin_a;
+				Eigen::Matrix3f R = Eigen::AngleAxisf(std::atan2(sin_a, n_fit[2]), axis).toRotationMatrix();
+				normals[x + y*w] = (R * normals[x + y*w]).normalized();
+			}
 		}
-	}
+	});
 }
 
 void flattenPlaneHeights(int w, int h, std::vector<float> &heights,
@@ -646,42 +690,40 @@ void flattenPlaneHeights(int w, int h, std::vector<float> &heights,
 
 		SurfaceCoeffs sc;
 		sc.center = center;
-		if(!general) {
-			sc.nterms = 4;
-			sc.c[0] = cf[0]; sc.c[1] = cf[1]; sc.c[2] = cf[2]; sc.c[3] = cf[3];
-			for(int y = 0; y < h; y++) {
-				for(int x = 0; x < w; x++) {
-					double wx = x - center.x();
-					double wy = center.y() - y;
-					heights[x + y*w] -= (float)(cf[0]*wx*wx + cf[1]*wx*wy + cf[2]*wy*wy + cf[3]);
-				}
-			}
-		} else if(!linear) {
-			sc.nterms = 7;
-			for(int k = 0; k < 7; k++) sc.c[k] = cf[k];
-			for(int y = 0; y < h; y++) {
-				for(int x = 0; x < w; x++) {
-					double wx = x - center.x();
-					double wy = center.y() - y;
-					heights[x + y*w] -= (float)(
-						cf[0]*wx*wx*wx*wx + cf[1]*wx*wx*wy*wy + cf[2]*wy*wy*wy*wy +
-						cf[3]*wx*wx       + cf[4]*wx*wy       + cf[5]*wy*wy + cf[6]);
+		sc.nterms = !general ? 4 : (!linear ? 7 : 9);
+		for(int k = 0; k < sc.nterms; k++) sc.c[k] = cf[k];
+
+		const double *c = sc.c;
+		const int nterms = sc.nterms;
+		forRowBands(h, [&](int, int y0, int y1) {
+			for(int y = y0; y < y1; y++) {
+				double wy = center.y() - y;
+				//polynomial in wx along the row: z = r0 + r1*wx + r2*wx² + r4*wx⁴.
+				double r0, r1, r2, r4 = 0;
+				if(nterms == 4) {
+					r0 = c[2]*wy*wy + c[3];
+					r1 = c[1]*wy;
+					r2 = c[0];
+				} else {
+					r0 = c[2]*wy*wy*wy*wy + c[5]*wy*wy;
+					r1 = c[4]*wy;
+					r2 = c[1]*wy*wy + c[3];
+					r4 = c[0];
+					if(nterms == 7) {
+						r0 += c[6];
+					} else {
+						r0 += c[7]*wy + c[8];
+						r1 += c[6];
+					}
 				}
-			}
-		} else {
-			sc.nterms = 9;
-			for(int k = 0; k < 9; k++) sc.c[k] = cf[k];
-			for(int y = 0; y < h; y++) {
+				float *row = heights.data() + size_t(y)*w;
 				for(int x = 0; x < w; x++) {
 					double wx = x - center.x();
-					double wy = center.y() - y;
-					heights[x + y*w] -= (float)(
-						cf[0]*wx*wx*wx*wx + cf[1]*wx*wx*wy*wy + cf[2]*wy*wy*wy*wy +
-						cf[3]*wx*wx       + cf[4]*wx*wy       + cf[5]*wy*wy +
-						cf[6]*wx          + cf[7]*wy          + cf[8]);
+					double wx2 = wx*wx;
+					row[x] -= (float)(r0 + r1*wx + r2*wx2 + r4*wx2*wx2);
 				}
 			}
-		}
+		});
 		if(out_sc) *out_sc = sc;
 
 		if(correct_normals)
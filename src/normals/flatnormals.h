@@ -90,7 +90,8 @@ void flattenPlaneHeights(int w, int h, std::vector<float> &heights,
                          std::vector<Eigen::Vector3f> *normals = nullptr,
                          SurfaceCoeffs *out_sc = nullptr);
 
-void flattenRadialHeights(int w, int h, std::vector<float> &heights, double binSize = 20.0);
+//quadric fit, stride > 1 samples one pixel every stride in both directions.
+void flattenRadialHeights(int w, int h, std::vector<float> &heights, double binSize = 20.0, int stride = 1);
 void flattenFourierHeights(int w, int h, std::vector<float> &heights, float padding = 0.2, double sigma = 20);
 
 class NormalsImage {
@@ -36,6 +36,26 @@ QString surfaceIntegrationToString(SurfaceIntegration mode) {
 	}
 }
 
+QString normalmapFormatToString(NormalMapFormat format) {
+	switch(format) {
+	case NORMALMAP_JPEG: return QStringLiteral("NORMALMAP_JPEG");
+	case NORMALMAP_PNG16: return QStringLiteral("NORMALMAP_PNG16");
+	case NORMALMAP_TIFF16: return QStringLiteral("NORMALMAP_TIFF16");
+	case NORMALMAP_EXR: return QStringLiteral("NORMALMAP_EXR");
+	default:
+		return QStringLiteral("UNKNOWN");
+	}
+}
+
+}
+
+QString NormalsParameters::normalmapExtension() const {
+	switch(normalmap_format) {
+	case NORMALMAP_PNG16: return ".png";
+	case NORMALMAP_TIFF16: return ".tiff";
+	case NORMALMAP_EXR: return ".exr";
+	default: return ".jpg";
+	}
 }
 
 QString NormalsParameters::summary() const {
@@ -71,8 +91,13 @@ QJsonObject NormalsParameters::toJson() const {
 	obj["surfaceIntegration"] = surfaceIntegrationToString(surface_integration);
 	obj["bniK"] = bni_k;
 	obj["assmError"] = assm_error;
+	obj["assmMaxFaces"] = assm_max_faces;
+	obj["assmMaxSeconds"] = assm_max_seconds;
+	obj["meshError"] = mesh_error;
 	obj["surfaceWidth"] = surface_width;
 	obj["surfaceHeight"] = surface_height;
+	obj["previewScale"] = preview_scale;
 	obj["normalsname"] = normalsname;
+	obj["normalmapFormat"] = normalmapFormatToString(normalmap_format);
 	return obj;
 }
@@ -11,6 +11,7 @@ enum NormalSolver { NORMALS_L2, NORMALS_SBL, NORMALS_RPCA, NORMALS_ROBUST };
 enum NormalFormat { NORMAL_OPENGL, NORMAL_DIRECTX };
 enum FlatMethod { FLAT_NONE, FLAT_RADIAL, FLAT_PLANE, FLAT_FOURIER, FLAT_BLUR };
 enum SurfaceIntegration { SURFACE_NONE, SURFACE_BNI, SURFACE_ASSM, SURFACE_FFT };
+enum NormalMapFormat { NORMALMAP_JPEG, NORMALMAP_PNG16, NORMALMAP_TIFF16, NORMALMAP_EXR };
 
 class NormalsParameters : public TaskParameters {
 public:
@@ -37,11 +38,18 @@ public:
 	SurfaceIntegration surface_integration = SURFACE_NONE;
 	float bni_k = 0.0;
 	float assm_error = 0.1;
+	int assm_max_faces = 0;       //remeshing budget, 0 for no limit.
+	float assm_max_seconds = 0;
+	float mesh_error = 0.0; //adaptive ply mesh error in pixels, 0 for the full grid.
 
 	int surface_width = 0;  //3d surface grid width after downsampling.
 	int surface_height = 0;
+	int preview_scale = 1;  //> 1: quick preview using one row and column every preview_scale pixels.
 
 	QString normalsname = "normals"; //filename for normals  img.
+	NormalMapFormat normalmap_format = NORMALMAP_JPEG; //8 bit jpeg, 16 bit png/tiff or half float exr.
+
+	QString normalmapExtension() const;
 
 	QString summary() const override;
 	QJsonObject toJson() const override;
@@ -2,6 +2,8 @@
 #include "normalsworker.h"
 #include "../jpeg_decoder.h"
 #include "../jpeg_encoder.h"
+#include "../image_decoder.h"
+#include "../image_encoder.h"
 #include "../imageset.h"
 #include "../relight_threadpool.h"
 #include "bni_normal_integration.h"
@@ -16,6 +18,8 @@
 #include <Eigen/Core>
 #include <Eigen/Dense>
 
+#include <QCryptographicHash>
+#include <QFileInfo>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -27,6 +31,9 @@
 #include <iostream>
 #include <time.h>
 #include <cmath>
+#include <charconv>
+#include <cstring>
+#include <thread>
 
 using namespace std;
 using namespace Eigen;
@@ -52,6 +59,7 @@ void NormalsTask::initFromProject(Project &project) {
 	imageset.rotateLights(-parameters.crop.angle);
 
 	imageset.pixel_size = project.pixelSize();
+	cache_dir = project.dir.filePath("resources");
 }
 
 void NormalsTask::initFromFolder(const char *folder, Dome &dome, const Crop &folderCrop) {
@@ -80,7 +88,26 @@ void invertZ(vector<float> &z) {
 	}
 }
 
-void saveNormalmap(	std::vector<Eigen::Vector3f> normals, int width, int height, QString filename) {
+bool saveNormalmap(const std::vector<Eigen::Vector3f> &normals, int width, int height, QString filename,
+				   NormalMapFormat format = NORMALMAP_JPEG) {
+	if(format != NORMALMAP_JPEG) {
+		//exr keeps the signed normals, integer formats store (n + 1)/2.
+		bool exr = format == NORMALMAP_EXR;
+		ImageEncoder enc;
+		enc.setPixelType(exr ? PixelType::FLOAT16 : PixelType::UINT16);
+		if(!enc.init(filename.toStdString().c_str(), width, height, 3))
+			return false;
+		vector<float> row(width*3);
+		for(int y = 0; y < height; y++) {
+			const Eigen::Vector3f *line = &normals[size_t(y)*width];
+			for(int x = 0; x < width; x++)
+				for(int c = 0; c < 3; c++)
+					row[x*3 + c] = exr ? line[x][c] : (line[x][c] + 1.0f)/2.0f;
+			if(enc.writeRows(1, row.data()) != 1)
+				return false;
+		}
+		return enc.finish();
+	}
 	// Save the corrected normals at original (full) resolution.
 	vector<uint8_t> normalmap(width * height * 3);
 	for(size_t i = 0; i < normals.size(); i++) {
@@ -95,7 +122,141 @@ void saveNormalmap(	std::vector<Eigen::Vector3f> normals, int width, int height,
 	enc2.setOptimize(true);
 	enc2.setChromaSubsampling(false);
 	//TODO save resolution in exif.
-	enc2.encode(normalmap.data(), width, height, filename.toStdString().c_str());
+	return enc2.encode(normalmap.data(), width, height, filename.toStdString().c_str());
+}
+
+//reads 16 bit and float normalmaps at full precision, float formats hold the signed normals.
+//8 bit maps return false and are left to QImage, the decoder is released by its destructor.
+static bool loadNormalmap(QString filename, std::vector<Eigen::Vector3f> &normals, int &width, int &height) {
+	ImageDecoder dec;
+	if(!dec.init(filename.toStdString().c_str(), width, height) ||
+		dec.pixelType() == PixelType::UINT8 || dec.numChannels() < 3)
+		return false;
+	int channels = dec.numChannels();
+	bool signed_normals = dec.pixelType() == PixelType::FLOAT16 || dec.pixelType() == PixelType::FLOAT32;
+	normals.resize(size_t(width)*height);
+	vector<float> row(size_t(width)*channels);
+	for(int y = 0; y < height; y++) {
+		if(dec.readRows(1, row.data()) != 1)
+			return false;
+		Eigen::Vector3f *line = &normals[size_t(y)*width];
+		for(int x = 0; x < width; x++)
+			for(int c = 0; c < 3; c++) {
+				float v = row[x*channels + c];
+				line[x][c] = signed_normals ? v : v*2.0f - 1.0f;
+			}
+	}
+	return true;
+}
+
+//one normal every step pixels in both directions.
+static void decimateNormals(std::vector<Eigen::Vector3f> &normals, int &width, int &height, int step) {
+	int w = (width + step - 1)/step;
+	int h = (height + step - 1)/step;
+	std::vector<Eigen::Vector3f> decimated(size_t(w)*h);
+	for(int y = 0; y < h; y++)
+		for(int x = 0; x < w; x++)
+			decimated[size_t(y)*w + x] = normals[size_t(y*step)*width + x*step];
+	swap(normals, decimated);
+	width = w;
+	height = h;
+}
+
+//raw normals cache: 'RNRM', width, height (int32) then width*height*3 floats.
+static bool loadCachedNormals(QString filename, std::vector<Eigen::Vector3f> &normals, int &width, int &height) {
+	QFile file(filename);
+	if(filename.isEmpty() || !file.open(QFile::ReadOnly))
+		return false;
+	char magic[4];
+	int32_t size[2];
+	if(file.read(magic, 4) != 4 || memcmp(magic, "RNRM", 4) != 0 ||
+		file.read((char *)size, sizeof(size)) != sizeof(size) || size[0] <= 0 || size[1] <= 0)
+		return false;
+	qint64 bytes = qint64(size[0])*size[1]*sizeof(Eigen::Vector3f);
+	if(file.size() != 4 + qint64(sizeof(size)) + bytes)
+		return false;
+	normals.resize(size_t(size[0])*size[1]);
+	if(file.read((char *)normals.data(), bytes) != bytes)
+		return false;
+	width = size[0];
+	height = size[1];
+	return true;
+}
+
+//only the latest normals of each scale are kept (full resolution and previews), they take 12 bytes per pixel.
+static void saveCachedNormals(QString filename, const std::vector<Eigen::Vector3f> &normals, int width, int height) {
+	if(filename.isEmpty())
+		return;
+	QFileInfo info(filename);
+	QDir dir = info.dir();
+	QString pattern = info.fileName().section('_', 0, 0) + "_*.raw";
+	for(QString stale: dir.entryList(QStringList() << pattern, QDir::Files))
+		if(stale != info.fileName())
+			dir.remove(stale);
+
+	QFile file(filename);
+	if(!file.open(QFile::WriteOnly))
+		return;
+	int32_t size[2] = { width, height };
+	qint64 bytes = qint64(normals.size()*sizeof(Eigen::Vector3f));
+	bool ok = file.write("RNRM", 4) == 4 &&
+		file.write((const char *)size, sizeof(size)) == sizeof(size) &&
+		file.write((const char *)normals.data(), bytes) == bytes;
+	file.close();
+	if(!ok)
+		file.remove();
+}
+
+QString NormalsTask::normalsCacheFile() {
+	if(cache_dir.isEmpty() || !QDir(cache_dir).exists())
+		return QString();
+
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	auto add = [&](const void *data, size_t size) { hash.addData(QByteArray((const char *)data, int(size))); };
+	auto addValue = [&](auto value) { add(&value, sizeof(value)); };
+
+	hash.addData(QByteArray("normals cache 2"));
+	addValue(parameters.preview_scale);
+	QDir dir(imageset.path);
+	for(const QString &image: imageset.images) {
+		QFileInfo info(dir.filePath(image));
+		hash.addData(image.toUtf8());
+		addValue(qint64(info.size()));
+		addValue(qint64(info.lastModified().toMSecsSinceEpoch()));
+	}
+	add(imageset.lights1.data(), imageset.lights1.size()*sizeof(Eigen::Vector3f));
+	addValue(imageset.light3d);
+	addValue(imageset.idealLightDistance2);
+	for(const QPoint &offset: imageset.offsets) {
+		addValue(offset.x());
+		addValue(offset.y());
+	}
+	for(const QPointF &offset: imageset.subpixel) {
+		addValue(offset.x());
+		addValue(offset.y());
+	}
+	QRect crop = imageset.crop.rect();
+	for(int v: { crop.left(), crop.top(), crop.width(), crop.height(), imageset.width, imageset.height })
+		addValue(v);
+	addValue(imageset.crop.angle);
+	//the input profile (or the forced colorspace) and the working space decide the conversion of the samples.
+	addValue(int(imageset.color_profile_mode));
+	add(imageset.icc_profile_data.data(), imageset.icc_profile_data.size());
+	addValue(imageset.color_lut.isValid());
+	addValue(imageset.color_transform != nullptr);
+	addValue(imageset.compensateVignettingEnabled);
+	addValue(imageset.compensateIntensityEnabled);
+	hash.addData(QJsonDocument(lens.toJson()).toJson(QJsonDocument::Compact));
+
+	addValue(int(parameters.solver));
+	addValue(parameters.robust_threshold_high);
+	addValue(parameters.robust_threshold_low);
+	addValue(parameters.crop.angle);
+	addValue(z_threshold);
+
+	//previews are kept next to the full resolution field.
+	QString prefix = parameters.preview_scale > 1 ? QString("normals%1_").arg(parameters.preview_scale) : QString("normals_");
+	return QDir(cache_dir).filePath(prefix + QString(hash.result().toHex()) + ".raw");
 }
 
 void NormalsTask::run() {
@@ -120,54 +281,96 @@ void NormalsTask::run() {
 
 	int width = 0, height = 0;
 
-	if(parameters.compute) {
+	//preview: rows are skipped in the decoders and columns in the solver, the rest runs at the reduced size.
+	int step = std::max(1, parameters.preview_scale);
+	if(step > 1) {
+		parameters.surface_width /= step;
+		parameters.surface_height /= step;
+	}
+
+	QString cache_file = parameters.compute ? normalsCacheFile() : QString();
+	if(parameters.compute && loadCachedNormals(cache_file, normals, width, height)) {
+		mime = IMAGE;
+		if(!progressed("Loaded cached normals", 0))
+			return;
+
+	} else if(parameters.compute) {
 		mime = IMAGE;
-		width = imageset.width;
-		height = imageset.height;
+		width = (imageset.width + step - 1)/step;
+		height = (imageset.height + step - 1)/step;
 
 		normals.resize(width * height);
-		RelightThreadPool pool;
-		PixelArray line;
+		RelightThreadPool own_pool;
+		RelightThreadPool *pool = shared_pool;
 		imageset.setCallback(nullptr);
-		pool.start(QThread::idealThreadCount());
+
+		ImageSet::Band band(imageset);
+		if(step > 1 && !band.open(0)) {
+			error = "Could not open the images";
+			status = FAILED;
+			return;
+		}
+		if(!pool) {
+			own_pool.start(QThread::idealThreadCount());
+			pool = &own_pool;
+		}
+		//with a shared pool other tasks rows are in the queue too, wait only for ours.
+		std::vector<std::future<void>> rows;
+		auto waitRows = [&rows]() {
+			for(std::future<void> &row: rows)
+				row.wait();
+		};
 
 		for (int i = 0; i < height; i++) {
-			// Read a line
-			imageset.readLine(line);
+			// Only decode here, color conversion runs in the worker
+			std::vector<uint8_t> raw;
+			int y;
+			if(step > 1) {
+				y = band.readRawLine(raw);
+				if(i + 1 < height)
+					band.skipLines(step - 1);
+			} else
+				y = imageset.readRawLine(raw);
 
 			// Create the normal task and get the run lambda
 			uint32_t idx = i * width;
 			Eigen::Vector3f* data = &normals[idx];
 
-			NormalsWorker *task = new NormalsWorker(parameters.solver, i, line, data, imageset,
-				parameters.robust_threshold_high, parameters.robust_threshold_low);
-
-			std::function<void(void)> run = [task](void)->void {
-				task->run();
-				delete task;
+			std::function<void(void)> run = [this, raw = std::move(raw), y, i, data, step](void)->void {
+				PixelArray line;
+				imageset.convertLine(raw, y, line, step);
+				//the worker places the 3d lights at the full resolution row and columns.
+				NormalsWorker task(parameters.solver, i*step, line, data, imageset,
+					parameters.robust_threshold_high, parameters.robust_threshold_low, step);
+				task.run();
 			};
 
 			// Launch the task
-			pool.queue(run);
-			pool.waitForSpace();
+			rows.push_back(pool->queue(run));
+			pool->waitForSpace();
 
-			bool proceed = progressed("Computing normals...", ((float)i / imageset.height) * 100);
-			if(!proceed)
+			bool proceed = progressed("Computing normals...", ((float)i / height) * 100);
+			if(!proceed) {
+				waitRows();
 				return;
+			}
 		}
 
-		// Wait for the end of all the threads
-		pool.finish();
+		// Wait for the end of all the rows
+		waitRows();
 		if(parameters.crop.angle != 0.0f) {
-			//rotate and crop the normals.
-			normals = parameters.crop.cropBoundingNormals(normals, width, height);
+			//rotate and crop the normals, the crop size is scaled for previews.
+			Crop crop = parameters.crop;
+			crop.setSize(QSize(crop.width()/step, crop.height()/step));
+			normals = crop.cropBoundingNormals(normals, width, height);
 		}
 		//check no normals with z == 0.
 		for(Eigen::Vector3f &n: normals) {
 			fixNormal(n);
 		}
+		saveCachedNormals(cache_file, normals, width, height);
 
-	} else {
+	} else if(!loadNormalmap(parameters.input_path, normals, width, height)) {
 		QImage normalmap(parameters.input_path);
 		if(normalmap.isNull()) {
 			status = FAILED;
@@ -189,8 +392,11 @@ void NormalsTask::run() {
 			}
 		}
 	}
+	if(!parameters.compute && step > 1)
+		decimateNormals(normals, width, height, step);
 
-	float downsampling = 1.0;
+	//sizes below are in units of the output grid, step rescales them to image pixels.
+	float downsampling = step;
 
 	const bool will_integrate_plane =
 		parameters.flatMethod == FLAT_PLANE &&
@@ -229,7 +435,7 @@ void NormalsTask::run() {
 	}
 
 
-	QString normalmap_path = destination.filePath(parameters.normalsname + ".jpg");
+	QString normalmap_path = destination.filePath(parameters.normalsname + parameters.normalmapExtension());
 
 	//Save these values for later, if using flat plane, which needs to integrate the surface to fix the normalmap.
 
@@ -237,8 +443,12 @@ void NormalsTask::run() {
 	const int normals_height = height;
 	std::vector<Eigen::Vector3f> full_normals;
 
-	if(parameters.flatMethod != FLAT_PLANE)
-		saveNormalmap(normals, width, height, normalmap_path);
+	if(parameters.flatMethod != FLAT_PLANE &&
+		!saveNormalmap(normals, width, height, normalmap_path, parameters.normalmap_format)) {
+		error = "Failed to save normalmap to: " + normalmap_path;
+		status = FAILED;
+		return;
+	}
 
 	if(parameters.surface_width != 0 &&
 		(parameters.surface_width != width || parameters.surface_height != height)) {
@@ -252,7 +462,7 @@ void NormalsTask::run() {
 			fixNormal(n);
 		}
 
-		downsampling = float(width)/parameters.surface_width;
+		downsampling = step*float(width)/parameters.surface_width;
 		width = parameters.surface_width;
 		height = parameters.surface_height;
 	}
@@ -323,7 +533,10 @@ void NormalsTask::run() {
 		progressed("Saving surface...", 99);
 		QString filename = destination.filePath("3D_surface.ply");
 		float pixel_size = imageset.pixel_size * downsampling;
-		if(!savePly(filename, width, height, z, downsampling, pixel_size)) {
+		bool saved = parameters.mesh_error > 0 ?
+			saveAdaptivePly(filename, width, height, z, parameters.mesh_error, downsampling, pixel_size) :
+			savePly(filename, width, height, z, downsampling, pixel_size);
+		if(!saved) {
 			error = "Failed to save .ply to: " + filename;
 			status = FAILED;
 			return;
@@ -365,6 +578,9 @@ QJsonObject NormalsTask::info() const {
 	return obj;
 }
 
+//meshes are converted in chunks of elements into reused buffers.
+static const size_t mesh_chunk = 1<<16;
+
 bool savePly(const char *filename, pmp::SurfaceMesh &mesh, int width, int height, float pixel_size) {
 	QFile file(filename);
 	bool success = file.open(QFile::WriteOnly);
@@ -375,59 +591,119 @@ bool savePly(const char *filename, pmp::SurfaceMesh &mesh, int width, int height
 	float cx = (width  - 1) * 0.5f;
 	float cy = (height - 1) * 0.5f;
 
-	std::vector<float> vertices;
+	{
+		QTextStream stream(&file);
+
+		stream << "ply\n";
+		stream << "format binary_little_endian 1.0\n";
+		stream << "element vertex " << mesh.n_vertices() << "\n";
+		stream << "property float x\n";
+		stream << "property float y\n";
+		stream << "property float z\n";
+		stream << "property float s\n";
+		stream << "property float t\n";
+		stream << "element face " << mesh.n_faces() << "\n";
+		stream << "property list uchar int vertex_index\n";
+		stream << "end_header\n";
+	}
+
+	std::vector<float> vertices(5*mesh_chunk);
+	size_t count = 0;
+	auto flushVertices = [&]() {
+		qint64 size = qint64(count*5*sizeof(float));
+		count = 0;
+		return file.write((const char *)vertices.data(), size) == size;
+	};
 	for(auto vertex: mesh.vertices()) {
 		auto p = mesh.position(vertex);
-		float u = p[0] / (width  - 1);
-		float v = p[1] / (height - 1);
-		vertices.push_back((p[0] - cx) * scale);
-		vertices.push_back((p[1] - cy) * scale);
-		vertices.push_back(p[2] * scale);
-		vertices.push_back(u);
-		vertices.push_back(v);
+		float *v = &vertices[5*count];
+		v[0] = (p[0] - cx) * scale;
+		v[1] = (p[1] - cy) * scale;
+		v[2] = p[2] * scale;
+		v[3] = p[0] / (width  - 1);
+		v[4] = p[1] / (height - 1);
+		if(++count == mesh_chunk && !flushVertices())
+			return false;
 	}
-	std::vector<uint8_t> indices;
+	if(!flushVertices())
+		return false;
 
-	int count =0 ;
+	std::vector<uint8_t> indices(13*mesh_chunk);
+	auto flushFaces = [&]() {
+		qint64 size = qint64(count*13);
+		count = 0;
+		return file.write((const char *)indices.data(), size) == size;
+	};
 	for (auto face : mesh.faces()) {
-		indices.resize(13*(count+1));
 		uint8_t *start = &indices[13*count];
 		start[0] = 3;
-		int *triangle = (int *)(start + 1);
 
 		int i = 0;
 		int index[3];
 		for (auto vertex : mesh.vertices(face)) {
 			index[i++] = vertex.idx();
-
 		}
 		//flip triangle order for consistency.
-		triangle[0] = index[0];
-		triangle[1] = index[2];
-		triangle[2] = index[1];
-		count++;
+		int triangle[3] = { index[0], index[2], index[1] };
+		memcpy(start + 1, triangle, 12);
+		if(++count == mesh_chunk && !flushFaces())
+			return false;
 	}
+	if(!flushFaces())
+		return false;
+	file.close();
+	return true;
+}
 
-	{
-		QTextStream stream(&file);
+//same output as printf("%f"): a float times 1e6 is exact in a double, ties round to even as in printf.
+//longest formatFloat output: sign, 12 digits, dot and 6 decimals, or the %.9g fallback ("-1.23456789e+38").
+static const size_t max_float = 24;
 
-		stream << "ply\n";
-		stream << "format binary_little_endian 1.0\n";
-		stream << "element vertex " << vertices.size()/5 << "\n";
-		stream << "property float x\n";
-		stream << "property float y\n";
-		stream << "property float z\n";
-		stream << "property float s\n";
-		stream << "property float t\n";
-		stream << "element face " << indices.size()/13 << "\n";
-		stream << "property list uchar int vertex_index\n";
-		stream << "end_header\n";
+static char *formatFloat(char *p, float value) {
+	if(!std::isfinite(value) || fabs(value) >= 1e12f)
+		return p + snprintf(p, max_float, "%.9g", value);
+	if(std::signbit(value)) {
+		*p++ = '-';
+		value = -value;
 	}
+	uint64_t n = uint64_t(std::nearbyint(double(value)*1e6));
+	p = std::to_chars(p, p + 24, n/1000000).ptr;
+	*p++ = '.';
+	uint64_t fraction = n % 1000000;
+	for(int k = 5; k >= 0; k--) {
+		p[k] = char('0' + fraction % 10);
+		fraction /= 10;
+	}
+	return p + 6;
+}
 
-
-	file.write((const char *)vertices.data(), vertices.size()*4);
-	file.write((const char *)indices.data(), indices.size());
-	file.close();
+//lines are formatted by line(p, i) in parallel chunks, and written in order.
+static bool writeLines(FILE *fp, size_t n, size_t max_line, std::function<char *(char *p, size_t i)> line) {
+	size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::vector<char>> buffers(nthreads, std::vector<char>(max_line*mesh_chunk));
+	std::vector<size_t> sizes(nthreads);
+
+	RelightThreadPool pool;
+	pool.start(nthreads);
+	for(size_t start = 0; start < n; start += nthreads*mesh_chunk) {
+		std::vector<std::future<void>> done;
+		for(size_t k = 0; k < nthreads && start + k*mesh_chunk < n; k++) {
+			done.push_back(pool.queue([&, k, start]() {
+				size_t first = start + k*mesh_chunk;
+				size_t last = std::min(n, first + mesh_chunk);
+				char *begin = buffers[k].data();
+				char *p = begin;
+				for(size_t i = first; i < last; i++)
+					p = line(p, i);
+				sizes[k] = p - begin;
+			}));
+		}
+		for(size_t k = 0; k < done.size(); k++) {
+			done[k].wait();
+			if(fwrite(buffers[k].data(), 1, sizes[k], fp) != sizes[k])
+				return false;
+		}
+	}
 	return true;
 }
 
@@ -441,35 +717,55 @@ bool saveObj(const char *filename, pmp::SurfaceMesh &mesh, int width, int height
 	float cx = (width  - 1) * 0.5f;
 	float cy = (height - 1) * 0.5f;
 
-	int nvertices = 0;
-	for(auto vertex: mesh.vertices()) {
-		auto p = mesh.position(vertex);
-		fprintf(fp, "v %f %f %f\n",
-			(p[0] - cx) * scale,
-			(p[1] - cy) * scale,
-			p[2] * scale);
-		nvertices++;
-	}
-	for(auto vertex: mesh.vertices()) {
-		auto p = mesh.position(vertex);
-		fprintf(fp, "vt %f %f\n",
-			p[0] / (width  - 1),
-			p[1] / (height - 1));
-	}
-	for (auto face : mesh.faces()) {
-		int indexes[3];
-		int count = 0;
+	//vertices are indexed by idx(): the mesh has no deleted vertices.
+	int nvertices = mesh.n_vertices();
+	//"v x y z\n", "vt u v\n" and "f v/v ...\n" with at most max_valence vertices.
+	size_t max_valence = 0;
+	for(auto face: mesh.faces())
+		max_valence = std::max<size_t>(max_valence, mesh.valence(face));
+	size_t max_vertex = 2 + 3*(1 + max_float) + 1;
+	size_t max_face = 1 + max_valence*2*(1 + 11) + 1;
+
+	bool ok = writeLines(fp, nvertices, max_vertex, [&](char *p, size_t i) {
+		auto pos = mesh.position(pmp::Vertex(i));
+		*p++ = 'v';
+		for(float c: { (pos[0] - cx) * scale, (pos[1] - cy) * scale, pos[2] * scale }) {
+			*p++ = ' ';
+			p = formatFloat(p, c);
+		}
+		*p++ = '\n';
+		return p;
+	});
+	ok = ok && writeLines(fp, nvertices, max_vertex, [&](char *p, size_t i) {
+		auto pos = mesh.position(pmp::Vertex(i));
+		*p++ = 'v';
+		*p++ = 't';
+		for(float c: { pos[0] / (width  - 1), pos[1] / (height - 1) }) {
+			*p++ = ' ';
+			p = formatFloat(p, c);
+		}
+		*p++ = '\n';
+		return p;
+	});
+	ok = ok && writeLines(fp, mesh.faces_size(), max_face, [&](char *p, size_t i) {
+		pmp::Face face(i);
+		if(mesh.is_deleted(face))
+			return p;
+		*p++ = 'f';
 		for (auto vertex : mesh.vertices(face)) {
-			int v = indexes[count++] = vertex.idx() + 1;
+			int v = vertex.idx() + 1;
 			assert(v > 0 && v <= nvertices);
+			for(int k = 0; k < 2; k++) {
+				*p++ = k == 0 ? ' ' : '/';
+				p = std::to_chars(p, p + 12, v).ptr;
+			}
 		}
-		fprintf(fp, "f %d/%d %d/%d %d/%d\n",
-			indexes[0], indexes[0],
-			indexes[1], indexes[1],
-			indexes[2], indexes[2]);
-	}
-	fclose(fp);
-	return true;
+		*p++ = '\n';
+		return p;
+	});
+	if(fclose(fp) != 0)
+		return false;
+	return ok;
 }
 
 void NormalsTask::assm(QString filename, std::vector<Eigen::Vector3f> &_normals, int width, int height, float downsampling,
@@ -490,8 +786,10 @@ void NormalsTask::assm(QString filename, std::vector<Eigen::Vector3f> &_normals,
 
 	if(callback && !(*callback)("Remeshing...", 0))
 		return;
+	//start from a grid of 4 pixels quads instead of one quad per pixel, remeshing refines where needed.
+	int coarse_step = 4;
 	PhotometricRemeshing<pmp::Orthographic> remesher(normals, mask);
-	remesher.run(l_min, l_max, approx_error, 10, true, callback);
+	remesher.run(l_min, l_max, approx_error, 10, true, callback, coarse_step, parameters.assm_max_faces, parameters.assm_max_seconds);
 
 	pmp::Integration<double, pmp::Orthographic> integrator(remesher.mesh(), normals, mask);
 	integrator.run(callback);
@@ -17,6 +17,7 @@
 
 #include <functional>
 
+struct RelightThreadPool;
 
 class NormalsTask :  public Task {
 public:
@@ -25,6 +26,8 @@ public:
 	ImageSet imageset;
 	Lens lens;
 	float z_threshold =0.001;
+	QString cache_dir; //raw normals are cached here (project resources), empty disables the cache.
+	RelightThreadPool *shared_pool = nullptr; //rows are solved here if set (batch processing), otherwise in a private pool.
 
 	virtual void run() override;
 	virtual QJsonObject info() const override;
@@ -36,6 +39,9 @@ public:
 	void assm(QString filename, std::vector<Eigen::Vector3f> &normals, int width, int height, float downsampling,
 			  std::function<bool(QString, int)> *_callback);
 	void fixNormal(Eigen::Vector3f &n); //check for nan, and z< threshold
+
+	//cache file for the solved normals, keyed on images, lights, crop, alignment, color conversion and solver.
+	QString normalsCacheFile();
 };
 
 #endif // NORMALSTASK_H
@@ -54,7 +54,7 @@ void NormalsWorker::solveL2()
 
 		if(m_Imageset.light3d) {
 			for(size_t i = 0; i < m_Lights.size(); i++) {
-				Vector3f light = m_Imageset.relativeLight(m_Lights[i], p, m_Imageset.height - row);
+				Vector3f light = m_Imageset.relativeLight(m_Lights[i], int(p)*step, m_Imageset.height - row);
 				light.normalize();
 				for (int j = 0; j < 3; j++)
 					mLights(i, j) = light[j];
@@ -69,12 +69,188 @@ void NormalsWorker::solveL2()
 	}
 }
 
+// Lights of the row (or of the pixel when light3d) as separate x, y, z arrays, so the
+// loops over the lights vectorize.
+void NormalsWorker::pixelLights(size_t p, std::vector<float> &lx, std::vector<float> &ly, std::vector<float> &lz) {
+	vector<Vector3f> &m_Lights = m_Imageset.lights();
+	const size_t nLights = m_Lights.size();
+	lx.resize(nLights);
+	ly.resize(nLights);
+	lz.resize(nLights);
+	for(size_t m = 0; m < nLights; m++) {
+		Vector3f light = m_Lights[m];
+		if(m_Imageset.light3d) {
+			light = m_Imageset.relativeLight(m_Lights[m], int(p)*step, m_Imageset.height - row);
+			light.normalize();
+		}
+		lx[m] = light[0];
+		ly[m] = light[1];
+		lz[m] = light[2];
+	}
+}
+
+// Weighted normal equations (A^T W A) x = A^T W b accumulated over the lights as a fixed 3x3 system.
+static Vector3d solveWeighted(const float *lx, const float *ly, const float *lz, const float *b, const float *w, int n) {
+	double xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+	double bx = 0, by = 0, bz = 0;
+#pragma omp simd reduction(+:xx,xy,xz,yy,yz,zz,bx,by,bz)
+	for(int m = 0; m < n; m++) {
+		double wx = w[m]*lx[m], wy = w[m]*ly[m], wz = w[m]*lz[m];
+		xx += wx*lx[m]; xy += wx*ly[m]; xz += wx*lz[m];
+		yy += wy*ly[m]; yz += wy*lz[m];
+		zz += wz*lz[m];
+		bx += wx*b[m]; by += wy*b[m]; bz += wz*b[m];
+	}
+	Matrix3d AtA;
+	AtA << xx, xy, xz,
+	       xy, yy, yz,
+	       xz, yz, zz;
+	return AtA.ldlt().solve(Vector3d(bx, by, bz));
+}
+
+static Vector3f unitNormal(const Vector3d &x) {
+	Vector3d n = x;
+	if(n.norm() > 1e-10)
+		n.normalize();
+	return Vector3f(float(n[0]), float(n[1]), float(n[2]));
+}
+
+// Sparse Bayesian learning (Ikehata et al. 2012): b = L x + e, where shadows and highlights are
+// a sparse error e with a per light variance gamma. EM alternates the weighted solve for x
+// (weights 1/(sigma^2 + gamma)) and the update of gamma from the posterior of e; most gammas
+// shrink to zero, the outliers keep a variance of the size of their residual and are ignored.
 void NormalsWorker::solveSBL()
 {
+	const size_t nLights = m_Imageset.lights().size();
+	const int n = int(nLights);
+
+	const int maxIter = 30;
+	const double sigma2 = 1e-4; // noise variance, intensities normalized to the brightest sample
+
+	vector<float> lx, ly, lz;
+	vector<float> b(nLights), w(nLights), gamma(nLights);
+	if(!m_Imageset.light3d)
+		pixelLights(0, lx, ly, lz);
+
+	for(size_t p = 0; p < m_Row.size(); p++) {
+		if(m_Imageset.light3d)
+			pixelLights(p, lx, ly, lz);
+
+		float scale = 0.0f;
+		for(size_t m = 0; m < nLights; m++) {
+			b[m] = m_Row[p][m].mean();
+			scale = std::max(scale, b[m]);
+		}
+		if(scale <= 0.0f) {
+			m_Normals[p] = Vector3f(0, 0, 0);
+			continue;
+		}
+		for(size_t m = 0; m < nLights; m++) {
+			b[m] /= scale;
+			gamma[m] = 1.0f;
+			w[m] = float(1.0/(sigma2 + 1.0));
+		}
+
+		Vector3d x = solveWeighted(lx.data(), ly.data(), lz.data(), b.data(), w.data(), n);
+		for(int iter = 0; iter < maxIter; iter++) {
+#pragma omp simd
+			for(int m = 0; m < n; m++) {
+				double r = b[m] - (lx[m]*x[0] + ly[m]*x[1] + lz[m]*x[2]);
+				double g = gamma[m];
+				double k = g/(g + sigma2);
+				//posterior mean and variance of the error.
+				gamma[m] = float(k*k*r*r + k*sigma2);
+				w[m] = float(1.0/(sigma2 + gamma[m]));
+			}
+			Vector3d next = solveWeighted(lx.data(), ly.data(), lz.data(), b.data(), w.data(), n);
+			double change = (next - x).norm();
+			x = next;
+			if(change < 1e-5*std::max(1.0, x.norm()))
+				break;
+		}
+		m_Normals[p] = unitNormal(x);
+	}
 }
 
+// Robust PCA (Wu et al. 2010) on the row: the lights x pixels intensity matrix O is split
+// in a low rank part A (Lambertian, rank 3) and a sparse part E (shadows, highlights),
+// minimizing |A|_* + lambda |E|_1 with O = A + E by inexact augmented Lagrangian.
+// The singular value thresholding is replaced by the rank 3 projection, the subspace is
+// tracked with one subspace iteration per step starting from the lights directions.
+// With 3d lights the row is only approximately rank 3: the subspace is seeded from the
+// directional lights while the final solve uses the per pixel lights.
+// Normals are then the least squares solution on A.
 void NormalsWorker::solveRPCA()
 {
+	vector<Vector3f> &m_Lights = m_Imageset.lights();
+	const int n = int(m_Lights.size());
+	const int np = int(m_Row.size());
+	if(np == 0)
+		return;
+
+	MatrixXf O(n, np);
+	for(int p = 0; p < np; p++)
+		for(int m = 0; m < n; m++)
+			O(m, p) = m_Row[p][m].mean();
+
+	float norm_fro = O.norm();
+	MatrixXf A = O;
+	if(norm_fro > 0.0f && n > 3) {
+		//spectral norm by power iteration.
+		VectorXf v = VectorXf::Ones(np).normalized();
+		float norm_2 = 0.0f;
+		for(int i = 0; i < 20; i++) {
+			VectorXf u = O*v;
+			v = O.transpose()*u;
+			float nv = v.norm();
+			if(nv <= 0.0f)
+				break;
+			v /= nv;
+			norm_2 = std::sqrt(nv);
+		}
+		const float lambda = 1.0f/std::sqrt(float(std::max(n, np)));
+		float norm_inf = O.cwiseAbs().maxCoeff()/lambda;
+
+		MatrixXf Y = O/std::max(norm_2, norm_inf);
+		MatrixXf E = MatrixXf::Zero(n, np);
+		float mu = 1.25f/norm_2;
+		const float mu_max = mu*1e7f;
+		const float rho = 1.5f;
+
+		MatrixXf L(n, 3);
+		for(int m = 0; m < n; m++)
+			L.row(m) = m_Lights[m].transpose();
+		MatrixXf U = HouseholderQR<MatrixXf>(L).householderQ()*MatrixXf::Identity(n, 3);
+
+		MatrixXf M(n, np);
+		for(int iter = 0; iter < 50; iter++) {
+			M = O - E + Y/mu;
+			MatrixXf V = M.transpose()*U;
+			U = HouseholderQR<MatrixXf>(M*V).householderQ()*MatrixXf::Identity(n, 3);
+			A.noalias() = U*(U.transpose()*M);
+
+			float t = lambda/mu;
+			M = O - A + Y/mu;
+			E = M.unaryExpr([t](float e) { return e > t ? e - t : (e < -t ? e + t : 0.0f); }) ;
+			M = O - A - E;
+			Y += mu*M;
+			mu = std::min(mu*rho, mu_max);
+
+			if(M.norm() < 1e-4f*norm_fro)
+				break;
+		}
+	}
+
+	vector<float> lx, ly, lz;
+	vector<float> w(n, 1.0f);
+	if(!m_Imageset.light3d)
+		pixelLights(0, lx, ly, lz);
+	for(int p = 0; p < np; p++) {
+		if(m_Imageset.light3d)
+			pixelLights(p, lx, ly, lz);
+		Vector3d x = solveWeighted(lx.data(), ly.data(), lz.data(), A.col(p).data(), w.data(), n);
+		m_Normals[p] = unitNormal(x);
+	}
 }
 
 // Robust least-squares solver using IRLS (Iteratively Reweighted Least Squares).
@@ -82,92 +258,76 @@ void NormalsWorker::solveRPCA()
 // Pixels with intensity below low_threshold are considered in shadow and excluded.
 // The remaining pixels are used in IRLS with a Huber-like weighting to further
 // reduce the influence of remaining outliers.
+// Excluded samples get weight 0 instead of being removed, so every iteration is
+// a fixed 3x3 system accumulated over all the lights, with buffers shared by the row.
 void NormalsWorker::solveRobust()
 {
-	vector<Vector3f> &m_Lights = m_Imageset.lights();
-	const size_t nLights = m_Lights.size();
+	const size_t nLights = m_Imageset.lights().size();
+	const int n = int(nLights);
 
 	// Thresholds: pixel values in m_Row are Color3f::mean() – typically in [0, 255]
 	const float high = robust_threshold_high;
 	const float low  = robust_threshold_low;
 
-	unsigned int normalIdx = 0;
+	const int maxIter = 10;
+	const float epsilon = 1e-6f;  // numerical floor for weights
+	const float huberDelta = 5.0f; // Huber threshold in intensity units
+
+	vector<float> lx, ly, lz;
+	vector<float> b(nLights), violation(nLights), mask(nLights), w(nLights);
+	vector<int> order(nLights);
+	if(!m_Imageset.light3d)
+		pixelLights(0, lx, ly, lz);
 
 	for (size_t p = 0; p < m_Row.size(); p++) {
+		if(m_Imageset.light3d)
+			pixelLights(p, lx, ly, lz);
 
-		// Sort by |distance from nearest threshold| descending: worst violators at the back.
-		// A sample below `low` has violation (low - val), above `high` has (val - high);
-		// in-range samples get a negative "distance" so they sort towards the front.
-		vector<pair<float, int>> samples;
-		samples.reserve(nLights);
+		// A sample below `low` has violation (low - val), above `high` has (val - high),
+		// out-of-range samples are dropped as long as at least 5 samples are left.
+		int nValid = 0;
 		for (size_t m = 0; m < nLights; m++) {
-			float val = m_Row[p][m].mean();
-			float violation = std::max(val - high, low - val); // >0 if out-of-range
-			samples.push_back({ violation, (int)m });
+			b[m] = m_Row[p][m].mean();
+			violation[m] = std::max(b[m] - high, low - b[m]); // >0 if out-of-range
+			mask[m] = violation[m] > 0.0f ? 0.0f : 1.0f;
+			nValid += violation[m] > 0.0f ? 0 : 1;
 		}
-		std::sort(samples.begin(), samples.end());
-
-		// Remove from the back while the worst sample is still out-of-range and
-		// we have more than 3 samples left.
-		int nValid = (int)nLights;
-		while (nValid > 5 && samples[nValid - 1].first > 0.0f)
-			nValid--;
-
-		// Build A and b from the first nValid samples (already sorted best-first)
-		MatrixXd A(nValid, 3);
-		VectorXd b(nValid);
-
-		for (int k = 0; k < nValid; k++) {
-			int m = samples[k].second;
-			Eigen::Vector3f light;
-			if (m_Imageset.light3d) {
-				light = m_Imageset.relativeLight(m_Lights[m], p, m_Imageset.height - row);
-				light.normalize();
-			} else {
-				light = m_Lights[m];
-			}
-			A(k, 0) = light[0];
-			A(k, 1) = light[1];
-			A(k, 2) = light[2];
-			b(k)    = m_Row[p][m].mean();
+		if(nValid < 5) {
+			// keep the 5 least violating samples
+			nValid = std::min(n, 5);
+			for(int m = 0; m < n; m++)
+				order[m] = m;
+			std::nth_element(order.begin(), order.begin() + (nValid - 1), order.end(),
+							 [&](int a, int c) { return violation[a] < violation[c]; });
+			for(int k = 0; k < n; k++)
+				mask[order[k]] = k < nValid ? 1.0f : 0.0f;
 		}
+		for (int m = 0; m < n; m++)
+			w[m] = mask[m];
 
-		const int maxIter = 10;
-		const double epsilon = 1e-6;  // numerical floor for weights
-		const double huberDelta = 5.0; // Huber threshold in intensity units
-
-		VectorXd weights = VectorXd::Ones(nValid);
-		VectorXd x(3);
-
-
+		Vector3d x(0, 0, 0);
 		for (int iter = 0; iter < maxIter; iter++) {
-			// Weighted normal equations: (A^T W A) x = A^T W b
-			MatrixXd AtW = A.transpose() * weights.asDiagonal();
-			x = (AtW * A).ldlt().solve(AtW * b);
-
-            if(nValid <= 5)
-                break; // Not enough samples for robust estimation, skip IRLS
-
-			// Compute residuals and update Huber weights
-			VectorXd residuals = b - A * x;
-			VectorXd newWeights(nValid);
-			for (int k = 0; k < nValid; k++) {
-				double r = std::abs(residuals(k));
-				newWeights(k) = (r < huberDelta) ? 1.0 : (huberDelta / (r + epsilon));
+			x = solveWeighted(lx.data(), ly.data(), lz.data(), b.data(), w.data(), n);
+
+			if(nValid <= 5)
+				break; // Not enough samples for robust estimation, skip IRLS
+
+			// Residuals and Huber weights
+			const float x0 = float(x[0]), x1 = float(x[1]), x2 = float(x[2]);
+			float change = 0.0f;
+#pragma omp simd reduction(+:change)
+			for (int m = 0; m < n; m++) {
+				float r = std::fabs(b[m] - (lx[m]*x0 + ly[m]*x1 + lz[m]*x2));
+				float nw = mask[m]*((r < huberDelta) ? 1.0f : (huberDelta / (r + epsilon)));
+				change += (nw - w[m])*(nw - w[m]);
+				w[m] = nw;
 			}
 
 			// Check convergence
-			if ((newWeights - weights).norm() < 1e-4)
+			if (std::sqrt(change) < 1e-4f)
 				break;
-
-			weights = newWeights;
 		}
 
-		// Normalise to get unit normal
-		if (x.norm() > 1e-10)
-			x.normalize();
-
-		m_Normals[normalIdx] = Eigen::Vector3f(float(x(0)), float(x(1)), float(x(2)));
-		normalIdx++;
+		m_Normals[p] = unitNormal(x);
 	}
 }
@@ -11,9 +11,10 @@
 class NormalsWorker
 {
 public:
+	//row is in the full resolution crop, step > 1 if toProcess has one column every step (previews).
 	NormalsWorker(NormalSolver _solver, int _row, const PixelArray& toProcess, Eigen::Vector3f* normals, ImageSet &imageset,
-	              float highThreshold = 250.0f, float lowThreshold = 5.0f):
-		solver(_solver), row(_row), m_Row(toProcess), m_Normals(normals), m_Imageset(imageset),
+	              float highThreshold = 250.0f, float lowThreshold = 5.0f, int _step = 1):
+		solver(_solver), row(_row), step(_step), m_Row(toProcess), m_Normals(normals), m_Imageset(imageset),
 		robust_threshold_high(highThreshold), robust_threshold_low(lowThreshold) {
 		m_Row.resize(toProcess.npixels(), toProcess.nlights);
 		for(size_t i = 0; i < m_Row.size(); i++)
@@ -26,9 +27,12 @@ private:
 	void solveSBL();
 	void solveRPCA();
 	void solveRobust();
+
+	void pixelLights(size_t p, std::vector<float> &lx, std::vector<float> &ly, std::vector<float> &lz);
 private:
 	NormalSolver solver;
 	int row;
+	int step;
 	PixelArray m_Row;
 
 	Eigen::Vector3f* m_Normals;
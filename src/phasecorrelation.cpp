@@ -0,0 +1,132 @@
+#include "phasecorrelation.h"
+#include "relight_threadpool.h"
+#include "normals/pocketfft.h"
+
+#include <QThread>
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+PhaseCorrelation::PhaseCorrelation(const QImage &reference, int max_side) {
+	int w = reference.width();
+	int h = reference.height();
+	scale = std::max(1.0f, std::max(w, h)/float(max_side));
+	width = std::max(1, int(round(w/scale)));
+	height = std::max(1, int(round(h/scale)));
+
+	side = 1;
+	while(side < std::max(width, height))
+		side *= 2;
+
+	//hann window on the patch, the padding is zero.
+	window.resize(width*height);
+	for(int y = 0; y < height; y++) {
+		float wy = 0.5f - 0.5f*cos(2.0f*M_PI*(y + 0.5f)/height);
+		for(int x = 0; x < width; x++) {
+			float wx = 0.5f - 0.5f*cos(2.0f*M_PI*(x + 0.5f)/width);
+			window[x + y*width] = wx*wy;
+		}
+	}
+	transform(reference, reference_freq);
+}
+
+void PhaseCorrelation::transform(const QImage &img, std::vector<std::complex<float>> &freq) const {
+	QImage gray = img.convertToFormat(QImage::Format_Grayscale8);
+	if(gray.width() != width || gray.height() != height)
+		gray = gray.scaled(width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+	double mean = 0.0;
+	for(int y = 0; y < height; y++) {
+		const uchar *line = gray.constScanLine(y);
+		for(int x = 0; x < width; x++)
+			mean += line[x];
+	}
+	mean /= width*height;
+
+	freq.assign(side*side, std::complex<float>(0.0f, 0.0f));
+	for(int y = 0; y < height; y++) {
+		const uchar *line = gray.constScanLine(y);
+		for(int x = 0; x < width; x++)
+			freq[x + y*side] = float((line[x] - mean)*window[x + y*width]);
+	}
+
+	ptrdiff_t element_size = sizeof(std::complex<float>);
+	pocketfft::shape_t shape = { size_t(side), size_t(side) };
+	pocketfft::stride_t stride = { ptrdiff_t(side)*element_size, element_size };
+	pocketfft::shape_t axes{0, 1};
+	pocketfft::c2c(shape, stride, stride, axes, pocketfft::FORWARD, freq.data(), freq.data(), 1.0f);
+}
+
+QPointF PhaseCorrelation::offset(const QImage &img, float *confidence) const {
+	std::vector<std::complex<float>> freq;
+	transform(img, freq);
+
+	//normalized cross power spectrum, the inverse is a peak at the displacement.
+	for(size_t i = 0; i < freq.size(); i++) {
+		std::complex<float> c = freq[i]*std::conj(reference_freq[i]);
+		float m = std::abs(c);
+		freq[i] = m > 1e-12f ? c/m : std::complex<float>(0.0f, 0.0f);
+	}
+	ptrdiff_t element_size = sizeof(std::complex<float>);
+	pocketfft::shape_t shape = { size_t(side), size_t(side) };
+	pocketfft::stride_t stride = { ptrdiff_t(side)*element_size, element_size };
+	pocketfft::shape_t axes{0, 1};
+	pocketfft::c2c(shape, stride, stride, axes, pocketfft::BACKWARD, freq.data(), freq.data(), 1.0f/(side*side));
+
+	int best = 0;
+	for(size_t i = 1; i < freq.size(); i++)
+		if(freq[i].real() > freq[best].real())
+			best = i;
+
+	int px = best % side;
+	int py = best / side;
+	auto value = [&](int x, int y) { return freq[((x + side) % side) + ((y + side) % side)*side].real(); };
+
+	//parabolic fit around the peak.
+	float c = value(px, py);
+	float dx = 0.0f, dy = 0.0f;
+	float l = value(px - 1, py), r = value(px + 1, py);
+	float denom = l - 2*c + r;
+	if(fabs(denom) > 1e-12f)
+		dx = std::max(-0.5f, std::min(0.5f, 0.5f*(l - r)/denom));
+	float t = value(px, py - 1), b = value(px, py + 1);
+	denom = t - 2*c + b;
+	if(fabs(denom) > 1e-12f)
+		dy = std::max(-0.5f, std::min(0.5f, 0.5f*(t - b)/denom));
+
+	if(px > side/2) px -= side;
+	if(py > side/2) py -= side;
+
+	if(confidence)
+		*confidence = c;
+	return QPointF((px + dx)*scale, (py + dy)*scale);
+}
+
+std::vector<QPointF> PhaseCorrelation::align(const std::vector<QImage> &patches, int reference, int max_side,
+											 std::function<bool(QString stage, int percent)> *callback) {
+	std::vector<QPointF> offsets(patches.size(), QPointF(0, 0));
+	if(reference < 0 || size_t(reference) >= patches.size() || patches[reference].isNull())
+		return offsets;
+
+	PhaseCorrelation correlation(patches[reference], max_side);
+
+	RelightThreadPool pool;
+	pool.start(QThread::idealThreadCount());
+	std::vector<std::future<void>> done;
+	for(size_t i = 0; i < patches.size(); i++) {
+		if(int(i) == reference || patches[i].isNull())
+			continue;
+		done.push_back(pool.queue([&, i]() { offsets[i] = correlation.offset(patches[i]); }));
+	}
+	for(size_t k = 0; k < done.size(); k++) {
+		done[k].wait();
+		if(callback && !(*callback)("Aligning:", 100*(k+1)/done.size())) {
+			pool.abort();
+			throw std::string("Cancelled");
+		}
+	}
+	pool.finish();
+	return offsets;
+}
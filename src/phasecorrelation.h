@@ -0,0 +1,38 @@
+#ifndef PHASECORRELATION_H
+#define PHASECORRELATION_H
+
+#include <QImage>
+#include <QPointF>
+
+#include <vector>
+#include <complex>
+#include <functional>
+
+/* Subpixel translation between patches using phase correlation.
+ * Patches larger than max_side are downsampled, the correlation peak is refined
+ * with a parabolic fit and rescaled to the original patch pixels.
+ */
+
+class PhaseCorrelation {
+public:
+	PhaseCorrelation(const QImage &reference, int max_side = 256);
+
+	//displacement of the content of img relative to the reference (img(p + offset) = reference(p)).
+	//confidence is the height of the correlation peak (1 for a perfect match).
+	QPointF offset(const QImage &img, float *confidence = nullptr) const;
+
+	//offsets of all the patches relative to patches[reference], computed in parallel.
+	static std::vector<QPointF> align(const std::vector<QImage> &patches, int reference = 0, int max_side = 256,
+									  std::function<bool(QString stage, int percent)> *callback = nullptr);
+
+private:
+	int width = 0, height = 0; //downsampled patch size
+	int side = 0;              //fft size (power of 2)
+	float scale = 1.0f;        //original/downsampled
+	std::vector<float> window;
+	std::vector<std::complex<float>> reference_freq;
+
+	void transform(const QImage &img, std::vector<std::complex<float>> &freq) const;
+};
+
+#endif // PHASECORRELATION_H
@@ -67,7 +67,8 @@ public:
             std::unique_lock<std::mutex> lock(work_mutex);
             if(work.size() < m_MaxThreads)
                 break;
-            finished_task.wait(lock, [] { return true; });
+            //several producers can share the pool, sleep until a task is done.
+            finished_task.wait(lock);
         }
     }
 
@@ -97,7 +98,7 @@ private:
             }
             if (!task.valid()) return;
             task();
-            finished_task.notify_one();
+            finished_task.notify_all();
         }
     }
 private:
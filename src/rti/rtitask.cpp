@@ -107,18 +107,48 @@ void RtiTask::run() {
 			status = FAILED;
 			return;
 		}
+		//pyramids are built while saving the planes, unless the rotated crop needs the plane jpegs.
+		bool iip = parameters.format == RtiParameters::IIP;
+		bool tiled = parameters.format == RtiParameters::WEB && parameters.web_layout != RtiParameters::PLAIN;
+		bool stream = (iip || tiled) && parameters.crop.angle == 0.0f;
+		//the savers return 0 on errors and when cancelled.
+		auto saved = [this](size_t size) {
+			if(size == 0)
+				throw QString(builder->error.empty() ? "Could not save the output." : builder->error.c_str());
+		};
+
 		if(parameters.format == RtiParameters::RTI) {
 			if(builder->type == Rti::HSH) {
 				mime = RTI;
-				builder->saveUniversal(output.toStdString());
+				saved(builder->saveUniversal(output.toStdString()));
 			} else if(builder->type == Rti::PTM) {
 				mime = PTM;
-				builder->savePTM(output.toStdString());
+				saved(builder->savePTM(output.toStdString()));
 			} else
 				throw QString("Legacy RTI and PTM formats are supported only for HSH and PTM basis");
 		} else {
 			mime = RELIGHT;
-			builder->save(output.toStdString(), parameters.quality);
+			if(stream) {
+				PyramidFormat format = PyramidFormat::DeepZoom;
+				if(iip)
+					format = PyramidFormat::TiledTiff;
+				else if(parameters.web_layout != RtiParameters::DEEPZOOM)
+					format = PyramidFormat::Tzb;
+
+				QDir().mkpath(output);
+				int nplanes = (builder->nplanes - 1)/3 + 1;
+				PlanePyramids pyramids(output, nplanes, builder->width, builder->height, parameters.quality, 256, 0, format);
+				std::function<void(uint32_t, std::vector<uint8_t> &)> plane_output = [&pyramids](uint32_t plane, std::vector<uint8_t> &row) {
+					pyramids.addLine(plane, row);
+				};
+				builder->plane_output = &plane_output;
+				size_t size = builder->save(output.toStdString(), parameters.quality);
+				builder->plane_output = nullptr;
+				//the partial pyramids are dropped with the builders.
+				saved(size);
+				pyramids.finish();
+			} else
+				saved(builder->save(output.toStdString(), parameters.quality));
 		}
 		if(parameters.crop.angle != 0.0f) {
 			rotatedCrop(output);
@@ -127,7 +157,7 @@ void RtiTask::run() {
 		if(parameters.openlime && parameters.format == RtiParameters::WEB)
 			openlime();
 
-		if(parameters.format == RtiParameters::IIP) {
+		if(iip && !stream) {
 			// Build TIFF pyramids for IIP using tiffZoom helper
 			tiffZoom(output, output, parameters.quality, 256,
 				[this](QString s, int n)->bool {
@@ -135,10 +165,10 @@ void RtiTask::run() {
 				});
 		}
 		//format is now WEB
-		if(parameters.web_layout != RtiParameters::PLAIN) {
+		if(parameters.web_layout != RtiParameters::PLAIN && !stream) {
 			deepZoom(output, output, parameters.quality, 0, 256, callback);
 		}
-		if(parameters.web_layout == RtiParameters::TARZOOM || parameters.web_layout == RtiParameters::ITARZOOM) {
+		if((parameters.web_layout == RtiParameters::TARZOOM || parameters.web_layout == RtiParameters::ITARZOOM) && !stream) {
 			tarZoom(output, output, callback);
 		}
 		if(parameters.web_layout == RtiParameters::ITARZOOM) {
@@ -147,11 +177,12 @@ void RtiTask::run() {
 
 	} catch(QString e) {
 		error = e;
-		status = FAILED;
+		if(status != STOPPED)
+			status = FAILED;
 		return;
 	}
 
-	if(status != FAILED)
+	if(status != FAILED && status != STOPPED)
 		status = DONE;
 }
 